@@ -5,6 +5,13 @@
 #include "Components/BrushComponent.h"
 #include "Components/PostProcessComponent.h"
 #include "Kismet/KismetRenderingLibrary.h"
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+#include "EngineUtils.h"
+#include "RHI.h"
+#include "FogOfWarHeightfieldAsset.h"
+#include "MassFogOfWarProcessors.h"
+#include "Misc/ScopeExit.h"
 #include "Subsystems/MinimapDataSubsystem.h"
 #include "Utils/ManagerComponent.h"
 #include "Utils/ManagerStatics.h"
@@ -12,12 +19,165 @@
 
 DEFINE_LOG_CATEGORY(LogFogOfWar);
 
-DECLARE_STATS_GROUP(TEXT("FogOfWar"), STATGROUP_FogOfWar, STATCAT_Advanced);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Team visibility chunks"), STAT_FogOfWarTeamVisibilityChunks, STATGROUP_FogOfWar);
+DECLARE_MEMORY_STAT(TEXT("Team visibility memory"), STAT_FogOfWarTeamVisibilityMemory, STATGROUP_FogOfWar);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile chunks resident"), STAT_FogOfWarTileChunksResident, STATGROUP_FogOfWar);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Tile chunks virtual"), STAT_FogOfWarTileChunksVirtual, STATGROUP_FogOfWar);
+DECLARE_MEMORY_STAT(TEXT("Tile grid memory"), STAT_FogOfWarTileGridMemory, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Snapshot bytes uploaded"), STAT_FogOfWarSnapshotBytesUploaded, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Explored bytes uploaded"), STAT_FogOfWarExploredBytesUploaded, STATGROUP_FogOfWar);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Pipeline skipped frames"), STAT_FogOfWarPipelineSkippedFrames, STATGROUP_FogOfWar);
+
+namespace
+{
+	/**
+	 * @brief 把一行瓦片的队伍可见性位掩码打包为位图：第k位为1表示第k个瓦片对AllyMask中的某个队伍可见。
+	 * @details 每16个瓦片用一次SIMD比较和一次掩码提取完成，剩余不足16个的瓦片逐个处理。
+	 */
+	void PackVisibilityRow(const uint8* TeamMasks, uint8 AllyMask, int32 NumTiles, uint8* OutPacked)
+	{
+		int32 Tile = 0;
+#if PLATFORM_CPU_X86_FAMILY
+		const __m128i AllyMaskVector = _mm_set1_epi8(static_cast<char>(AllyMask));
+		const __m128i Zero = _mm_setzero_si128();
+		for (; Tile + 16 <= NumTiles; Tile += 16)
+		{
+			const __m128i Masks = _mm_loadu_si128(reinterpret_cast<const __m128i*>(TeamMasks + Tile));
+			const uint32 HiddenBits = static_cast<uint32>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(Masks, AllyMaskVector), Zero)));
+			const uint32 VisibleBits = ~HiddenBits & 0xFFFFu;
+			OutPacked[Tile / 8] = static_cast<uint8>(VisibleBits);
+			OutPacked[Tile / 8 + 1] = static_cast<uint8>(VisibleBits >> 8);
+		}
+#elif PLATFORM_CPU_ARM_FAMILY && PLATFORM_ENABLE_VECTORINTRINSICS_NEON && PLATFORM_64BITS
+		// NEON has no movemask, so each lane keeps only its own bit and the halves are summed horizontally
+		static const uint8 BitWeights[16] = { 1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128 };
+		const uint8x16_t BitWeightsVector = vld1q_u8(BitWeights);
+		const uint8x16_t AllyMaskVector = vdupq_n_u8(AllyMask);
+		for (; Tile + 16 <= NumTiles; Tile += 16)
+		{
+			const uint8x16_t Visible = vtstq_u8(vld1q_u8(TeamMasks + Tile), AllyMaskVector);
+			const uint8x16_t Bits = vandq_u8(Visible, BitWeightsVector);
+			OutPacked[Tile / 8] = vaddv_u8(vget_low_u8(Bits));
+			OutPacked[Tile / 8 + 1] = vaddv_u8(vget_high_u8(Bits));
+		}
+#endif
+		for (; Tile < NumTiles; Tile += 8)
+		{
+			uint8 Packed = 0;
+			for (int32 Bit = 0; Bit < 8 && Tile + Bit < NumTiles; Bit++)
+			{
+				Packed |= (TeamMasks[Tile + Bit] & AllyMask) != 0 ? uint8(1u << Bit) : uint8(0);
+			}
+			OutPacked[Tile / 8] = Packed;
+		}
+	}
+}
+
+namespace
+{
+	FAutoConsoleCommandWithWorld ReportCommand(
+		TEXT("FogOfWar.Report"),
+		TEXT("Logs the memory usage and average tick time of every active fog of war actor."),
+		FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+		{
+			for (TActorIterator<AFogOfWar> It(World); It; ++It)
+			{
+				It->LogMemoryReport();
+			}
+		}));
+
+	FAutoConsoleCommandWithWorldAndArgs CompareRenderModesCommand(
+		TEXT("FogOfWar.CompareRenderModes"),
+		TEXT("Runs the same moving-vision workload on temporary copies of the first active fog of war actor in render and in data-only mode, and logs both tick times and memory side by side. Usage: FogOfWar.CompareRenderModes [Frames=120] [Units=256]"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			const int32 NumFrames = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 120;
+			const int32 NumUnits = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 256;
+			AFogOfWar* FogOfWar = nullptr;
+			for (TActorIterator<AFogOfWar> It(World); It; ++It)
+			{
+				if (It->IsActivated())
+				{
+					FogOfWar = *It;
+					break;
+				}
+			}
+			// the copies are spawned outside of the iteration
+			if (FogOfWar)
+			{
+				FogOfWar->LogRenderModeComparison(NumFrames, NumUnits);
+			}
+		}));
+
+	FAutoConsoleCommandWithWorldAndArgs ValidateGridResolutionCommand(
+		TEXT("FogOfWar.ValidateGridResolution"),
+		TEXT("Builds the tile grid and team visibility for a square grid, checks the corner tiles and logs the memory footprint. With a world, also computes a vision footprint at the far corner with every vision kernel. Usage: FogOfWar.ValidateGridResolution [Size=16384]"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+		{
+			const int32 Size = Args.Num() > 0 ? FMath::Clamp(FCString::Atoi(*Args[0]), 2, AFogOfWar::MaxGridResolution) : 16384;
+			const FIntPoint GridResolution(Size);
+			const FIntPoint Corners[] = { { 0, 0 }, { 0, Size - 1 }, { Size - 1, 0 }, { Size - 1, Size - 1 } };
+
+			FFogOfWarTileGrid TileGrid;
+			TileGrid.Initialize(GridResolution, -10000.0f, 10000.0f);
+			FFogOfWarTeamVisibility TeamVisibility;
+			TeamVisibility.Initialize(GridResolution);
+
+			// every corner gets its own height and its own team, so any index aliasing shows up as a wrong value
+			bool bPassed = true;
+			for (int32 CornerIndex = 0; CornerIndex < UE_ARRAY_COUNT(Corners); CornerIndex++)
+			{
+				const float Height = 100.0f * (CornerIndex + 1);
+				TileGrid.SetTileHeight(Corners[CornerIndex], Height);
+				TeamVisibility.Increment(CornerIndex, Corners[CornerIndex], false);
+			}
+			TeamVisibility.ResolveDirtyChunks();
+
+			for (int32 CornerIndex = 0; CornerIndex < UE_ARRAY_COUNT(Corners); CornerIndex++)
+			{
+				const FIntPoint Corner = Corners[CornerIndex];
+				bPassed &= FMath::IsNearlyEqual(TileGrid.GetTileHeight(Corner), 100.0f * (CornerIndex + 1), TileGrid.GetHeightStep());
+				bPassed &= TeamVisibility.GetTeamMask(Corner) == (1u << CornerIndex);
+				bPassed &= TeamVisibility.GetCounter(CornerIndex, Corner) == 1;
+				bPassed &= TeamVisibility.IsExplored(CornerIndex, Corner);
+			}
+			const SIZE_T TileGridSize = TileGrid.GetAllocatedSize();
+			const SIZE_T TeamVisibilitySize = TeamVisibility.GetAllocatedSize();
+
+			for (int32 CornerIndex = 0; CornerIndex < UE_ARRAY_COUNT(Corners); CornerIndex++)
+			{
+				TeamVisibility.Decrement(CornerIndex, Corners[CornerIndex], false);
+			}
+			TeamVisibility.ResolveDirtyChunks();
+			bPassed &= TeamVisibility.GetNumAllocatedChunks() == 0 && TeamVisibility.GetTeamMask(Corners[3]) == 0;
+
+			if (World && UMinimapDataSubsystem::Get())
+			{
+				bPassed &= AFogOfWar::ValidateFarCornerVision(World, Size);
+			}
+			else
+			{
+				UE_LOG(LogFogOfWar, Warning, TEXT("No world with a minimap data subsystem, the vision kernels are not checked at the far corner."));
+			}
+
+			const int64 NumTiles = static_cast<int64>(Size) * Size;
+			if (bPassed)
+			{
+				UE_LOG(LogFogOfWar, Log, TEXT("Grid %dx%d (%lld tiles) passed: tile grid %llu bytes (dense: %llu bytes), team visibility %llu bytes with 4 visible tiles."),
+					Size, Size, NumTiles, (uint64)TileGridSize, (uint64)TileGrid.GetDenseSize(), (uint64)TeamVisibilitySize);
+			}
+			else
+			{
+				UE_LOG(LogFogOfWar, Error, TEXT("Grid %dx%d (%lld tiles) failed: corner tiles or far corner vision did not read back what was written."), Size, Size, NumTiles);
+			}
+		}));
+}
 
 namespace Names
 {
 	DECLARE_STATIC_FNAME(FOW_AccumulatedMask);
 	DECLARE_STATIC_FNAME(FOW_NewSnapshot);
+	DECLARE_STATIC_FNAME(FOW_ExploredTexture);
 	DECLARE_STATIC_FNAME(FOW_MinimalVisibility);
 	DECLARE_STATIC_FNAME(FOW_NewSnapshotAbsorption);
 	DECLARE_STATIC_FNAME(FOW_VisibilityTextureRenderTarget);
@@ -46,9 +206,324 @@ bool AFogOfWar::IsLocationVisible(FVector WorldLocation)
 		return false;
 	}
 
-	const FTile& Tile = GetGlobalTile(TileIJ);
-	bool bIsVisible = Tile.VisibilityCounter > 0;
-	return bIsVisible;
+	return IsLocationVisible(WorldLocation, LocalTeamIndex);
+}
+
+bool AFogOfWar::IsLocationVisible(FVector WorldLocation, int32 TeamIndex) const
+{
+	FIntPoint TileIJ = UMinimapDataSubsystem::ConvertWorldLocationToVisionTileIJ_Static(FVector2D(WorldLocation));
+	if (!bActivated || !UMinimapDataSubsystem::IsVisionGridIJValid_Static(TileIJ) || !ensure(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams))
+	{
+		return false;
+	}
+
+	// the masks are resolved only in Tick, resolving here would race with the vision processors and the texture uploads
+	return IsTileVisibleForAllyMask(TileIJ, AllyMasks[TeamIndex]);
+}
+
+bool AFogOfWar::IsLocationExplored(FVector WorldLocation)
+{
+	return IsLocationExplored(WorldLocation, LocalTeamIndex);
+}
+
+bool AFogOfWar::IsLocationExplored(FVector WorldLocation, int32 TeamIndex) const
+{
+	FIntPoint TileIJ = UMinimapDataSubsystem::ConvertWorldLocationToVisionTileIJ_Static(FVector2D(WorldLocation));
+	if (!bActivated || !UMinimapDataSubsystem::IsVisionGridIJValid_Static(TileIJ) || !ensure(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams))
+	{
+		return false;
+	}
+
+	return TeamVisibility.GetExploredMask(TileIJ, AllyMasks[TeamIndex]) != 0;
+}
+
+void AFogOfWar::ResetExplored(int32 TeamIndex)
+{
+	if (bActivated && ensure(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams))
+	{
+		TeamVisibility.ResetExplored(TeamIndex);
+	}
+}
+
+void AFogOfWar::LogMemoryReport() const
+{
+	const SIZE_T TileGridSize = TileGrid.GetAllocatedSize();
+	const SIZE_T DenseTileGridSize = TileGrid.GetDenseSize();
+	UE_LOG(LogFogOfWar, Log, TEXT("FogOfWar memory report (%dx%d tiles):"), GridResolution.X, GridResolution.Y);
+	UE_LOG(LogFogOfWar, Log, TEXT("  Tile grid: %d resident / %d virtual chunks, %d shared, %llu bytes (dense: %llu bytes, %.1f%%)"),
+		TileGrid.GetNumResidentChunks(), TileGrid.GetNumVirtualChunks(), TileGrid.GetNumSharedChunks(),
+		(uint64)TileGridSize, (uint64)DenseTileGridSize, DenseTileGridSize > 0 ? 100.0 * TileGridSize / DenseTileGridSize : 0.0);
+	UE_LOG(LogFogOfWar, Log, TEXT("  Team visibility: %d counter chunks, %llu bytes"), TeamVisibility.GetNumAllocatedChunks(), (uint64)TeamVisibility.GetAllocatedSize());
+	UE_LOG(LogFogOfWar, Log, TEXT("  Footprint cache: %d entries, %llu bytes"), FootprintCache.Num(), (uint64)FootprintCache.GetAllocatedSize());
+
+	if (bDataOnly)
+	{
+		UE_LOG(LogFogOfWar, Log, TEXT("  Render pipeline: data only, no textures"));
+	}
+	else
+	{
+		UE_LOG(LogFogOfWar, Log, TEXT("  Render pipeline: %llu bytes"), (uint64)GetRenderResourcesSize());
+	}
+	UE_LOG(LogFogOfWar, Log, TEXT("  Average tick: %.3f ms"), AverageTickSeconds * 1000.0);
+}
+
+SIZE_T AFogOfWar::GetRenderResourcesSize() const
+{
+	const UTexture* const RenderTextures[] = { SnapshotTexture, ExploredTexture, VisibilityTextureRenderTarget, PreFinalVisibilityTextureRenderTarget, FinalVisibilityTextureRenderTarget };
+	SIZE_T RenderResourcesSize = 0;
+	for (const UTexture* Texture : RenderTextures)
+	{
+		if (Texture)
+		{
+			RenderResourcesSize += Texture->GetResourceSizeBytes(EResourceSizeMode::EstimatedTotal);
+		}
+	}
+	return RenderResourcesSize;
+}
+
+void AFogOfWar::LogRenderModeComparison(int32 NumFrames, int32 NumUnits)
+{
+	UWorld* World = GetWorld();
+	if (!bActivated || !World)
+	{
+		UE_LOG(LogFogOfWar, Warning, TEXT("The render mode comparison needs an activated fog of war actor."));
+		return;
+	}
+	if (!FApp::CanEverRender() || FMath::Max(GridResolution.X, GridResolution.Y) > static_cast<int32>(GetMax2DTextureDimension()))
+	{
+		UE_LOG(LogFogOfWar, Warning, TEXT("The render mode comparison needs a process that can render a %dx%d texture."), GridResolution.X, GridResolution.Y);
+		return;
+	}
+	NumFrames = FMath::Max(NumFrames, 1);
+	NumUnits = FMath::Max(NumUnits, 1);
+
+	constexpr int32 VisionRadius = 16;
+	constexpr float DeltaSeconds = 1.0f / 30.0f;
+	const int32 TeamIndex = FMath::Clamp(LocalTeamIndex, 0, FogOfWarMaxTeams - 1);
+	const EFogOfWarRenderMode Modes[] = { EFogOfWarRenderMode::Render, EFogOfWarRenderMode::DataOnly };
+	const TCHAR* const ModeNames[] = { TEXT("Render"), TEXT("DataOnly") };
+
+	UE_LOG(LogFogOfWar, Log, TEXT("FogOfWar render mode comparison (%dx%d tiles, %d units, %d frames):"), GridResolution.X, GridResolution.Y, NumUnits, NumFrames);
+	for (int32 ModeIndex = 0; ModeIndex < UE_ARRAY_COUNT(Modes); ModeIndex++)
+	{
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.Template = this;
+		SpawnParameters.bDeferConstruction = true;
+		SpawnParameters.ObjectFlags |= RF_Transient;
+		SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+		AFogOfWar* Copy = World->SpawnActor<AFogOfWar>(GetClass(), GetActorTransform(), SpawnParameters);
+		if (!Copy)
+		{
+			return;
+		}
+
+		Copy->bAutoActivate = false;
+		Copy->RenderMode = Modes[ModeIndex];
+		// the workload writes the counters directly, so the terrain is left flat instead of scanned
+		Copy->BakedHeightfield = nullptr;
+		Copy->HeightScanMode = EFogOfWarHeightScanMode::Amortized;
+		// the template copies the references to this actor's textures and materials, neither run may report or draw into them
+#if WITH_EDITORONLY_DATA
+		Copy->HeightmapTexture = nullptr;
+#endif
+		Copy->SnapshotTexture = nullptr;
+		Copy->ExploredTexture = nullptr;
+		Copy->VisibilityTextureRenderTarget = nullptr;
+		Copy->PreFinalVisibilityTextureRenderTarget = nullptr;
+		Copy->FinalVisibilityTextureRenderTarget = nullptr;
+		Copy->InterpolationMID = nullptr;
+		Copy->AfterInterpolationMID = nullptr;
+		Copy->SuperSamplingMID = nullptr;
+		Copy->PostProcessingMID = nullptr;
+		Copy->PostProcess->bEnabled = false;
+		Copy->FinishSpawning(GetActorTransform());
+		Copy->ActivateWithoutRegistering();
+		Copy->HeightScanNextRow = Copy->GridResolution.X;
+
+		// the same seed in both modes, so both runs see exactly the same counter updates
+		FRandomStream Random(NumUnits);
+		TArray<FIntPoint> Centers;
+		TArray<FIntPoint> Steps;
+		for (int32 Unit = 0; Unit < NumUnits; Unit++)
+		{
+			Centers.Add({ Random.RandRange(0, GridResolution.X - 1), Random.RandRange(0, GridResolution.Y - 1) });
+			Steps.Add({ Random.RandBool() ? 1 : -1, Random.RandBool() ? 1 : -1 });
+		}
+
+		auto StampVision = [Copy, TeamIndex](FIntPoint Center, bool bAdd)
+		{
+			const FIntPoint Min = (Center - FIntPoint(VisionRadius)).ComponentMax(FIntPoint::ZeroValue);
+			const FIntPoint Max = (Center + FIntPoint(VisionRadius)).ComponentMin(Copy->GridResolution - FIntPoint(1));
+			for (int32 I = Min.X; I <= Max.X; I++)
+			{
+				for (int32 J = Min.Y; J <= Max.Y; J++)
+				{
+					if (FMath::Square(I - Center.X) + FMath::Square(J - Center.Y) <= VisionRadius * VisionRadius)
+					{
+						if (bAdd)
+						{
+							Copy->TeamVisibility.Increment(TeamIndex, { I, J }, false);
+						}
+						else
+						{
+							Copy->TeamVisibility.Decrement(TeamIndex, { I, J }, false);
+						}
+					}
+				}
+			}
+		};
+
+		for (const FIntPoint& Center : Centers)
+		{
+			StampVision(Center, true);
+		}
+		double TickSeconds = 0.0;
+		for (int32 Frame = 0; Frame <= NumFrames; Frame++)
+		{
+			for (int32 Unit = 0; Unit < NumUnits; Unit++)
+			{
+				FIntPoint& Center = Centers[Unit];
+				FIntPoint& Step = Steps[Unit];
+				StampVision(Center, false);
+				// bounce off the grid border so that every frame moves every unit
+				if (Center.X + Step.X < 0 || Center.X + Step.X >= GridResolution.X)
+				{
+					Step.X = -Step.X;
+				}
+				if (Center.Y + Step.Y < 0 || Center.Y + Step.Y >= GridResolution.Y)
+				{
+					Step.Y = -Step.Y;
+				}
+				Center += Step;
+				StampVision(Center, true);
+			}
+
+			const double TickStartSeconds = FPlatformTime::Seconds();
+			Copy->Tick(DeltaSeconds);
+			if (Frame > 0)
+			{
+				TickSeconds += FPlatformTime::Seconds() - TickStartSeconds;
+			}
+		}
+
+		const SIZE_T DataSize = Copy->TileGrid.GetAllocatedSize() + Copy->TeamVisibility.GetAllocatedSize() + Copy->FootprintCache.GetAllocatedSize();
+		UE_LOG(LogFogOfWar, Log, TEXT("  %-8s  tick %.3f ms, data %llu bytes, render pipeline %llu bytes"),
+			ModeNames[ModeIndex], TickSeconds * 1000.0 / NumFrames, (uint64)DataSize, (uint64)Copy->GetRenderResourcesSize());
+		Copy->Destroy();
+	}
+}
+
+bool AFogOfWar::ValidateFarCornerVision(UWorld* World, int32 Size)
+{
+	UMinimapDataSubsystem* Minimap = UMinimapDataSubsystem::Get();
+	check(World && Minimap);
+
+	// the kernels convert coordinates through the minimap subsystem, so it points at the test grid until the check is done
+	const FVector2D SavedGridBottomLeftWorldLocation = Minimap->GridBottomLeftWorldLocation;
+	const FIntPoint SavedVisionGridResolution = Minimap->VisionGridResolution;
+	Minimap->GridBottomLeftWorldLocation = FVector2D::ZeroVector;
+	Minimap->VisionGridResolution = FIntPoint(Size);
+	ON_SCOPE_EXIT
+	{
+		Minimap->GridBottomLeftWorldLocation = SavedGridBottomLeftWorldLocation;
+		Minimap->VisionGridResolution = SavedVisionGridResolution;
+	};
+
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.bDeferConstruction = true;
+	SpawnParameters.ObjectFlags |= RF_Transient;
+	AFogOfWar* FogOfWar = World->SpawnActor<AFogOfWar>(StaticClass(), FTransform::Identity, SpawnParameters);
+	if (!FogOfWar)
+	{
+		return false;
+	}
+	ON_SCOPE_EXIT
+	{
+		FogOfWar->Destroy();
+	};
+	FogOfWar->bAutoActivate = false;
+	FogOfWar->PostProcess->bEnabled = false;
+	FogOfWar->bUseFootprintCache = true;
+	// the cache is keyed by height bucket and stays off without one
+	FogOfWar->VisionHeightBucketSize = FMath::Max(FogOfWar->VisionHeightBucketSize, 50.0f);
+	FogOfWar->FinishSpawning(FTransform::Identity);
+
+	// the state Activate would derive from a grid volume of Size x Size tiles, left unscanned so that nothing blocks vision
+	FogOfWar->TileSize = Minimap->VisionTileSize;
+	FogOfWar->GridResolution = FIntPoint(Size);
+	FogOfWar->GridSize = FVector2D(FogOfWar->GridResolution) * FogOfWar->TileSize;
+	FogOfWar->GridBottomLeftWorldLocation = FVector2D::ZeroVector;
+	FogOfWar->TileGrid.Initialize(FogOfWar->GridResolution, FogOfWar->MinTerrainHeight, FogOfWar->MaxTerrainHeight);
+	FogOfWar->TeamVisibility.Initialize(FogOfWar->GridResolution);
+	FogOfWar->RefreshAllyMasks();
+	FogOfWar->HeightScanNextRow = Size;
+	if (FApp::CanEverRender() && Size <= static_cast<int32>(GetMax2DTextureDimension()))
+	{
+		FogOfWar->SnapshotTexture = FogOfWar->CreateSnapshotTexture();
+	}
+
+	const FIntPoint Corner(Size - 1);
+	const int64 CornerGlobalIndex = static_cast<int64>(Size) * Size - 1;
+	// one tile inside and one tile just outside of the 8 tile vision circle, both within the local area of the footprint
+	const FIntPoint Inside = Corner - FIntPoint(4, 3);
+	const FIntPoint Outside = Corner - FIntPoint(7, 7);
+	FMassVisionFragment Vision;
+	Vision.SightRadius = 8.0f * FogOfWar->TileSize;
+	Vision.TeamIndex = 0;
+	const FVector Location(UMinimapDataSubsystem::ConvertVisionTileIJToTileCenterWorldLocation_Static(Corner), 0.0);
+
+	bool bPassed = FogOfWar->GetGlobalIndex(Corner) == CornerGlobalIndex
+		&& UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(Corner) == CornerGlobalIndex
+		&& UMinimapDataSubsystem::GetVisionGridTileIJ_Static(CornerGlobalIndex) == Corner
+		&& UMinimapDataSubsystem::ConvertWorldLocationToVisionTileIJ_Static(FVector2D(Location)) == Corner;
+
+	const EFogOfWarVisionKernel Kernels[] = { EFogOfWarVisionKernel::DDA, EFogOfWarVisionKernel::Shadowcasting, EFogOfWarVisionKernel::PrecomputedDDA };
+	for (const EFogOfWarVisionKernel Kernel : Kernels)
+	{
+		FogOfWar->VisionKernel = Kernel;
+		bool bKernelPassed = true;
+		FVisionUnitData CachedVisionData;
+		// the second pass must hit the cache entry written by the first one and leave every counter as it is
+		for (int32 Pass = 0; Pass < 2; Pass++)
+		{
+			const int32 NumCacheEntries = FogOfWar->FootprintCache.Num();
+			FFogOfWarMassHelpers::UpdateEntityVision(FogOfWar, Location, Vision, CachedVisionData, false);
+			FogOfWar->TeamVisibility.ResolveDirtyChunks();
+
+			bKernelPassed &= CachedVisionData.HasCachedData() && CachedVisionData.CachedOriginGlobalIndex == CornerGlobalIndex;
+			bKernelPassed &= FogOfWar->FootprintCache.Num() == NumCacheEntries + (Pass == 0 ? 1 : 0);
+			bKernelPassed &= FogOfWar->TeamVisibility.GetCounter(0, Corner) == 1 && FogOfWar->TeamVisibility.GetCounter(0, Inside) == 1 && FogOfWar->TeamVisibility.GetCounter(0, Outside) == 0;
+			bKernelPassed &= FogOfWar->TeamVisibility.GetTeamMask(Corner) == 1 && FogOfWar->TeamVisibility.GetTeamMask(Inside) == 1 && FogOfWar->TeamVisibility.GetTeamMask(Outside) == 0;
+		}
+
+		if (UTexture2D* Texture = FogOfWar->SnapshotTexture)
+		{
+			bKernelPassed &= FogOfWar->WriteVisionDataToTexture(Texture);
+			const uint8* TextureData = static_cast<const uint8*>(Texture->GetPlatformData()->Mips[0].BulkData.LockReadOnly());
+			bKernelPassed &= TextureData[FogOfWar->GetGlobalIndex(Corner)] == 0xFF && TextureData[FogOfWar->GetGlobalIndex(Inside)] == 0xFF && TextureData[FogOfWar->GetGlobalIndex(Outside)] == 0;
+			Texture->GetPlatformData()->Mips[0].BulkData.Unlock();
+		}
+
+		FFogOfWarMassHelpers::ApplyEntityFootprint(FogOfWar, CachedVisionData, FVisionUnitData(), false);
+		FogOfWar->TeamVisibility.ResolveDirtyChunks();
+		bKernelPassed &= FogOfWar->TeamVisibility.GetNumAllocatedChunks() == 0 && FogOfWar->TeamVisibility.GetTeamMask(Corner) == 0;
+
+		if (!bKernelPassed)
+		{
+			UE_LOG(LogFogOfWar, Error, TEXT("The %s vision kernel failed at tile (%d, %d) of a %dx%d grid."),
+				*StaticEnum<EFogOfWarVisionKernel>()->GetNameStringByValue(static_cast<int64>(Kernel)), Corner.X, Corner.Y, Size, Size);
+		}
+		bPassed &= bKernelPassed;
+	}
+	return bPassed;
+}
+
+void AFogOfWar::RefreshAllyMasks()
+{
+	for (int32 TeamIndex = 0; TeamIndex < FogOfWarMaxTeams; TeamIndex++)
+	{
+		AllyMasks[TeamIndex] = FTeamRelationshipResolver::ComputeAllyMask(TeamIndex);
+	}
 }
 
 UTexture* AFogOfWar::GetFinalVisibilityTexture()
@@ -70,6 +545,19 @@ void AFogOfWar::Activate()
 	{
 		return;
 	}
+
+	ActivateWithoutRegistering();
+
+	// Deprecated: MinimapSubsystem is now decoupled from AFogOfWar.
+
+	auto GameManager = UManagerStatics::GetGameManager(this);
+	GameManager->Register<ThisClass>(this);
+	PrimaryActorTick.SetTickFunctionEnable(true);
+}
+
+void AFogOfWar::ActivateWithoutRegistering()
+{
+	check(!bActivated);
 	bActivated = true;
 
 	checkf(IsValid(GridVolume), TEXT("Volume was not set for the FogOfWar Volume"));
@@ -77,35 +565,70 @@ void AFogOfWar::Activate()
 
 	Initialize();
 
-	checkf(GridResolution.X + GridResolution.Y <= 10000, TEXT("Grid resolution is too big (possible int32 overflow when calculating square distance)"));
-
-	const int GridTilesNum = GridResolution.X * GridResolution.Y;
-	Tiles.SetNum(GridTilesNum);
-	TextureDataBuffer.SetNum(GridTilesNum);
-
-	for (int I = 0; I < GridResolution.X; I++)
+	bDataOnly = RenderMode == EFogOfWarRenderMode::DataOnly
+		|| (RenderMode == EFogOfWarRenderMode::Auto && (IsRunningDedicatedServer() || !FApp::CanEverRender()));
+	if (bDataOnly)
 	{
-		for (int J = 0; J < GridResolution.Y; J++)
-		{
-			FTile& Tile = GetGlobalTile({ I, J });
-			CalculateTileHeight(Tile, { I,J });
-		}
+		UE_LOG(LogFogOfWar, Log, TEXT("Fog of war runs data only, the render pipeline is not created."));
 	}
 
+	checkf(GridResolution.X <= MaxGridResolution && GridResolution.Y <= MaxGridResolution,
+		TEXT("Grid resolution %dx%d is too big, at most %d tiles per axis are supported"), GridResolution.X, GridResolution.Y, MaxGridResolution);
+	checkf(bDataOnly || FMath::Max(GridResolution.X, GridResolution.Y) <= static_cast<int32>(GetMax2DTextureDimension()),
+		TEXT("Grid resolution %dx%d does not fit into a %d texel texture, increase TileSize or use the DataOnly render mode"), GridResolution.X, GridResolution.Y, GetMax2DTextureDimension());
+
+	// tiles that were not scanned yet never block vision
+	TileGrid.Initialize(GridResolution, MinTerrainHeight, MaxTerrainHeight);
+	TeamVisibility.Initialize(GridResolution);
+	RefreshAllyMasks();
+
 #if WITH_EDITORONLY_DATA
-	HeightmapTexture = CreateSnapshotTexture();
-	HeightmapTexture->Filter = TF_Nearest;
-	WriteHeightmapDataToTexture(HeightmapTexture);
+	if (!bDataOnly)
+	{
+		HeightmapTexture = CreateSnapshotTexture();
+		HeightmapTexture->Filter = TF_Nearest;
+	}
 #endif
 
-	SnapshotTexture = CreateSnapshotTexture();
+	HeightScanNextRow = 0;
+	if (LoadBakedHeightfield())
+	{
+		HeightScanNextRow = GridResolution.X;
+		OnHeightScanFinished();
+	}
+	else if (HeightScanMode == EFogOfWarHeightScanMode::Blocking)
+	{
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Height scan"), STAT_FogOfWarHeightScan, STATGROUP_FogOfWar);
+		ScanTileHeights(0, GridResolution.X);
+		HeightScanNextRow = GridResolution.X;
+		OnHeightScanFinished();
+	}
+
+	if (!bDataOnly)
+	{
+		CreateRenderPipeline();
+	}
+}
+
+void AFogOfWar::CreateRenderPipeline()
+{
+	bSnapshotPacked = bPackedSnapshot && PackedSnapshotInterpolationMaterial;
+	if (bPackedSnapshot && !bSnapshotPacked)
+	{
+		UE_LOG(LogFogOfWar, Warning, TEXT("bPackedSnapshot is enabled but PackedSnapshotInterpolationMaterial is not set, falling back to one texel per tile."));
+	}
+	SnapshotTexture = bSnapshotPacked ? CreatePackedSnapshotTexture() : CreateSnapshotTexture();
+	SnapshotTextureAllyMask = 0;
+	ExploredTexture = CreateSnapshotTexture();
+	ExploredTextureAllyMask = 0;
 	VisibilityTextureRenderTarget = CreateRenderTarget();
 	PreFinalVisibilityTextureRenderTarget = CreateRenderTarget();
 	FinalVisibilityTextureRenderTarget = CreateRenderTarget();
 
-	InterpolationMID = UMaterialInstanceDynamic::Create(InterpolationMaterial, this);
+	InterpolationMID = UMaterialInstanceDynamic::Create(bSnapshotPacked ? PackedSnapshotInterpolationMaterial : InterpolationMaterial, this);
 	InterpolationMID->SetTextureParameterValue(Names::FOW_AccumulatedMask, VisibilityTextureRenderTarget);
 	InterpolationMID->SetTextureParameterValue(Names::FOW_NewSnapshot, SnapshotTexture);
+	InterpolationMID->SetVectorParameterValue(Names::FOW_GridResolution, FVector(GridResolution.X, GridResolution.Y, 0));
 
 	AfterInterpolationMID = UMaterialInstanceDynamic::Create(AfterInterpolationMaterial, this);
 	AfterInterpolationMID->SetTextureParameterValue(Names::FOW_VisibilityTextureRenderTarget, VisibilityTextureRenderTarget);
@@ -118,14 +641,205 @@ void AFogOfWar::Activate()
 	PostProcessingMID = UMaterialInstanceDynamic::Create(PostProcessingMaterial, this);
 	SetCommonMIDParameters(PostProcessingMID);
 	PostProcessingMID->SetScalarParameterValue(Names::FOW_NotVisibleRegionBrightness, NotVisibleRegionBrightness);
+	PostProcessingMID->SetTextureParameterValue(Names::FOW_ExploredTexture, ExploredTexture);
 
 	PostProcess->AddOrUpdateBlendable(PostProcessingMID);
+}
 
-	// Deprecated: MinimapSubsystem is now decoupled from AFogOfWar.
+void AFogOfWar::RefreshHeightfieldRegion(FBox WorldBounds)
+{
+	if (!bActivated)
+	{
+		return;
+	}
 
-	auto GameManager = UManagerStatics::GetGameManager(this);
-	GameManager->Register<ThisClass>(this);
-	PrimaryActorTick.SetTickFunctionEnable(true);
+	const FIntPoint MaxTileIJ = GridResolution - FIntPoint(1, 1);
+	const FIntPoint MinIJ = UMinimapDataSubsystem::ConvertWorldLocationToVisionTileIJ_Static(FVector2D(WorldBounds.Min)).ComponentMax(FIntPoint::ZeroValue);
+	const FIntPoint MaxIJ = UMinimapDataSubsystem::ConvertWorldLocationToVisionTileIJ_Static(FVector2D(WorldBounds.Max)).ComponentMin(MaxTileIJ);
+	if (MinIJ.X > MaxIJ.X || MinIJ.Y > MaxIJ.Y)
+	{
+		return;
+	}
+
+	for (int I = MinIJ.X; I <= MaxIJ.X; I++)
+	{
+		for (int J = MinIJ.Y; J <= MaxIJ.Y; J++)
+		{
+			CalculateTileHeight({ I, J });
+		}
+	}
+
+	const FIntRect TileRect(MinIJ, MaxIJ + FIntPoint(1, 1));
+	TileGrid.Compact(TileRect);
+	MarkHeightfieldDirty(TileRect);
+
+#if WITH_EDITORONLY_DATA
+	if (HeightmapTexture)
+	{
+		WriteHeightmapDataToTexture(HeightmapTexture);
+	}
+#endif
+}
+
+void AFogOfWar::ScanTileHeights(int32 FirstRow, int32 NumRows)
+{
+	ParallelFor(TEXT("FogOfWar.ScanTileHeights"), NumRows, 1, [this, FirstRow](int32 RowOffset)
+	{
+		const int I = FirstRow + RowOffset;
+		for (int J = 0; J < GridResolution.Y; J++)
+		{
+			CalculateTileHeight({ I, J });
+		}
+	});
+}
+
+void AFogOfWar::TickHeightScan()
+{
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Height scan"), STAT_FogOfWarHeightScan, STATGROUP_FogOfWar);
+
+	const int32 FirstRow = HeightScanNextRow;
+	const int32 NumRows = FMath::Min(HeightScanRowsPerTick, GridResolution.X - FirstRow);
+	ScanTileHeights(FirstRow, NumRows);
+	HeightScanNextRow += NumRows;
+
+	const FIntRect TileRect(FIntPoint(FirstRow, 0), FIntPoint(FirstRow + NumRows, GridResolution.Y));
+	TileGrid.Compact(TileRect);
+	MarkHeightfieldDirty(TileRect);
+
+	if (HeightScanNextRow >= GridResolution.X)
+	{
+		OnHeightScanFinished();
+	}
+	else
+	{
+		OnHeightScanProgress.Broadcast(GetHeightScanProgress());
+	}
+}
+
+void AFogOfWar::OnHeightScanFinished()
+{
+	TileGrid.Compact(FIntRect(FIntPoint::ZeroValue, GridResolution));
+	UE_LOG(LogFogOfWar, Log, TEXT("Height scan of %dx%d tiles finished, %d of %d tile chunks resident."),
+		GridResolution.X, GridResolution.Y, TileGrid.GetNumResidentChunks(), TileGrid.GetNumVirtualChunks());
+
+#if WITH_EDITORONLY_DATA
+	if (HeightmapTexture)
+	{
+		WriteHeightmapDataToTexture(HeightmapTexture);
+	}
+#endif
+
+	OnHeightScanProgress.Broadcast(1.0f);
+}
+
+bool AFogOfWar::LoadBakedHeightfield()
+{
+	if (!BakedHeightfield)
+	{
+		return false;
+	}
+
+	if (!BakedHeightfield->IsCompatible(GridResolution, GridBottomLeftWorldLocation, TileSize))
+	{
+		UE_LOG(LogFogOfWar, Warning, TEXT("Baked heightfield %s does not match the grid, falling back to the height scan. Rebake it with RefreshVolume."), *GetNameSafe(BakedHeightfield));
+		return false;
+	}
+
+	if (BakedHeightfield->TerrainSignature != ComputeTerrainSignature())
+	{
+		UE_LOG(LogFogOfWar, Warning, TEXT("Baked heightfield %s was baked from a different terrain, falling back to the height scan. Rebake it with RefreshVolume."), *GetNameSafe(BakedHeightfield));
+		return false;
+	}
+
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Load baked heightfield"), STAT_FogOfWarLoadBakedHeightfield, STATGROUP_FogOfWar);
+	if (!BakedHeightfield->LoadTileHeights(TileGrid))
+	{
+		UE_LOG(LogFogOfWar, Error, TEXT("Baked heightfield %s is corrupted, falling back to the height scan."), *GetNameSafe(BakedHeightfield));
+		return false;
+	}
+	return true;
+}
+
+uint32 AFogOfWar::ComputeTerrainSignature() const
+{
+	const FIntPoint NumSamples = GridResolution.ComponentMin(FIntPoint(UFogOfWarHeightfieldAsset::TerrainSignatureSamplesPerAxis));
+	if (NumSamples.X <= 0 || NumSamples.Y <= 0)
+	{
+		return 0;
+	}
+
+	// like BakeHeightfield, the sample positions come from this actor's grid so that the editor and the game agree
+	uint32 Signature = GetTypeHash(NumSamples);
+	for (int32 SampleI = 0; SampleI < NumSamples.X; SampleI++)
+	{
+		for (int32 SampleJ = 0; SampleJ < NumSamples.Y; SampleJ++)
+		{
+			const FIntPoint TileIJ(static_cast<int32>(static_cast<int64>(SampleI) * GridResolution.X / NumSamples.X), static_cast<int32>(static_cast<int64>(SampleJ) * GridResolution.Y / NumSamples.Y));
+			const FVector2D TileCenter = GridBottomLeftWorldLocation + (FVector2D(TileIJ) + 0.5) * TileSize;
+			const float Height = TraceTerrainHeight(TileCenter);
+			// whole centimeters, so the cooked and the editor collision of the same terrain hash the same
+			const int32 QuantizedHeight = FMath::IsFinite(Height) ? FMath::RoundToInt32(Height) : MIN_int32;
+			Signature = HashCombine(Signature, GetTypeHash(QuantizedHeight));
+		}
+	}
+	return Signature;
+}
+
+#if WITH_EDITOR
+void AFogOfWar::BakeHeightfield()
+{
+	TArray<float> BakedHeights;
+	BakedHeights.SetNum(static_cast<int64>(GridResolution.X) * GridResolution.Y);
+	// the minimap subsystem grid is only set up at runtime, so tile centers are derived from this actor's own grid
+	ParallelFor(TEXT("FogOfWar.BakeHeightfield"), GridResolution.X, 1, [this, &BakedHeights](int32 I)
+	{
+		for (int J = 0; J < GridResolution.Y; J++)
+		{
+			const FVector2D TileCenter = GridBottomLeftWorldLocation + (FVector2D(I, J) + 0.5) * TileSize;
+			BakedHeights[GetGlobalIndex({ I, J })] = TraceTerrainHeight(TileCenter);
+		}
+	});
+
+	BakedHeightfield->Modify();
+	BakedHeightfield->Bake(BakedHeights, GridResolution, GridBottomLeftWorldLocation, TileSize, ComputeTerrainSignature());
+	UE_LOG(LogFogOfWar, Log, TEXT("Baked %dx%d tiles into %s (%lld bytes)."), GridResolution.X, GridResolution.Y, *GetNameSafe(BakedHeightfield), BakedHeightfield->CompressedSize);
+}
+#endif
+
+void AFogOfWar::MarkHeightfieldDirty(const FIntRect& TileRect)
+{
+	HeightfieldRevision++;
+	if (HeightfieldChanges.Num() >= MaxHeightfieldChangesHistory)
+	{
+		HeightfieldChanges.RemoveAt(0);
+	}
+	HeightfieldChanges.Emplace(HeightfieldRevision, TileRect);
+
+	FootprintCache.InvalidateRegion(TileRect);
+}
+
+bool AFogOfWar::GetHeightfieldChangesSince(uint32 SinceRevision, TArray<FIntRect>& OutTileRects) const
+{
+	OutTileRects.Reset();
+	if (SinceRevision == HeightfieldRevision)
+	{
+		return true;
+	}
+
+	// the oldest kept record must directly follow the caller's revision, otherwise some changes were dropped
+	if (HeightfieldChanges.IsEmpty() || HeightfieldChanges[0].Key > SinceRevision + 1)
+	{
+		return false;
+	}
+
+	for (const TPair<uint32, FIntRect>& Change : HeightfieldChanges)
+	{
+		if (Change.Key > SinceRevision)
+		{
+			OutTileRects.Add(Change.Value);
+		}
+	}
+	return true;
 }
 
 void AFogOfWar::BeginPlay()
@@ -144,6 +858,11 @@ void AFogOfWar::RefreshVolumeInEditor()
 	if (GetWorld() && !GetWorld()->IsGameWorld())
 	{
 		Initialize();
+
+		if (BakedHeightfield && GridResolution.X > 0 && GridResolution.Y > 0)
+		{
+			BakeHeightfield();
+		}
 	}
 }
 #endif
@@ -187,6 +906,7 @@ void AFogOfWar::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEve
 			{
 				AfterInterpolationMID->SetScalarParameterValue(Names::FOW_MinimalVisibility, MinimalVisibility);
 			}
+			PipelineResidual = 1.0f;
 			return;
 		}
 
@@ -208,6 +928,15 @@ void AFogOfWar::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEve
 		if (PropertyName == GET_MEMBER_NAME_CHECKED(AFogOfWar, VisionBlockingDeltaHeightThreshold))
 		{
 			// This part is obsolete in Mass. The Mass processors will handle vision recalculation.
+			FootprintCache.Empty();
+			return;
+		}
+
+		if (PropertyName == GET_MEMBER_NAME_CHECKED(AFogOfWar, VisionHeightBucketSize) ||
+			PropertyName == GET_MEMBER_NAME_CHECKED(AFogOfWar, bUseFootprintCache))
+		{
+			// cached footprints were bucketed with the old settings
+			FootprintCache.Empty();
 			return;
 		}
 	}
@@ -227,38 +956,88 @@ void AFogOfWar::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEve
 void AFogOfWar::Tick(float DeltaSeconds)
 {
 	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Tick"), STAT_FogOfWarTick, STATGROUP_FogOfWar);
+	const double TickStartSeconds = FPlatformTime::Seconds();
 
 	Super::Tick(DeltaSeconds);
 
 	// The vision update loop is now handled by Mass processors.
 
+	if (bActivated && HeightScanNextRow < GridResolution.X)
+	{
+		TickHeightScan();
+	}
+
+	{
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Resolve team visibility"), STAT_FogOfWarResolveTeamVisibility, STATGROUP_FogOfWar);
+		TeamVisibility.ResolveDirtyChunks();
+		SET_DWORD_STAT(STAT_FogOfWarTeamVisibilityChunks, TeamVisibility.GetNumAllocatedChunks());
+		SET_MEMORY_STAT(STAT_FogOfWarTeamVisibilityMemory, TeamVisibility.GetAllocatedSize());
+		SET_DWORD_STAT(STAT_FogOfWarTileChunksResident, TileGrid.GetNumResidentChunks());
+		SET_DWORD_STAT(STAT_FogOfWarTileChunksVirtual, TileGrid.GetNumVirtualChunks());
+		SET_MEMORY_STAT(STAT_FogOfWarTileGridMemory, TileGrid.GetAllocatedSize());
+	}
+	// the query API only needs the resolved team masks above
+	if (!bDataOnly)
+	{
+		TickRenderPipeline(DeltaSeconds);
+	}
+
+	if (IsFootprintCacheEnabled())
+	{
+		FootprintCache.PublishStats();
+	}
+
+	bFirstTick = false;
+
+	const double TickSeconds = FPlatformTime::Seconds() - TickStartSeconds;
+	AverageTickSeconds = AverageTickSeconds > 0.0 ? FMath::Lerp(AverageTickSeconds, TickSeconds, 0.05) : TickSeconds;
+}
+
+void AFogOfWar::TickRenderPipeline(float DeltaSeconds)
+{
+	{
+		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Update explored texture"), STAT_FogOfWarUpdateExploredTexture, STATGROUP_FogOfWar);
+		UpdateExploredTexture();
+	}
+
 	{
 		DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline"), STAT_FogOfWarPipeline, STATGROUP_FogOfWar);
 		{
 			// step 1: creating a snapshot texture from the newest vision data
 			DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 1"), STAT_FogOfWarPipelineStep1, STATGROUP_FogOfWar);
-			WriteVisionDataToTexture(SnapshotTexture);
-		}
-		{
-			// step 2: interpolating the snapshot with the previous visibility texture (to avoid flickering)
-			DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 2"), STAT_FogOfWarPipelineStep2, STATGROUP_FogOfWar);
-			const float NewSnapshotAbsorption = bFirstTick ? 1.0f : FMath::Min(DeltaSeconds / ApproximateSecondsToAbsorbNewSnapshot, 1.0f);
-			InterpolationMID->SetScalarParameterValue(Names::FOW_NewSnapshotAbsorption, NewSnapshotAbsorption);
-			UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, VisibilityTextureRenderTarget, InterpolationMID);
+			if (WriteVisionDataToTexture(SnapshotTexture) || bFirstTick)
+			{
+				PipelineResidual = 1.0f;
+			}
 		}
+
+		// once the interpolation has converged on an unchanged snapshot every later step reproduces its previous output
+		if (bSkipPipelineWhenIdle && PipelineResidual < 0.5f / 255.0f)
 		{
-			// step 3: cutting off the minimal visibility
-			DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 3"), STAT_FogOfWarPipelineStep3, STATGROUP_FogOfWar);
-			UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, PreFinalVisibilityTextureRenderTarget, AfterInterpolationMID);
+			INC_DWORD_STAT(STAT_FogOfWarPipelineSkippedFrames);
 		}
+		else
 		{
-			// step 4: super sampling
-			DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 4"), STAT_FogOfWarPipelineStep4, STATGROUP_FogOfWar);
-			UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, FinalVisibilityTextureRenderTarget, SuperSamplingMID);
+			{
+				// step 2: interpolating the snapshot with the previous visibility texture (to avoid flickering)
+				DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 2"), STAT_FogOfWarPipelineStep2, STATGROUP_FogOfWar);
+				const float NewSnapshotAbsorption = bFirstTick ? 1.0f : FMath::Min(DeltaSeconds / ApproximateSecondsToAbsorbNewSnapshot, 1.0f);
+				InterpolationMID->SetScalarParameterValue(Names::FOW_NewSnapshotAbsorption, NewSnapshotAbsorption);
+				UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, VisibilityTextureRenderTarget, InterpolationMID);
+				PipelineResidual *= 1.0f - NewSnapshotAbsorption;
+			}
+			{
+				// step 3: cutting off the minimal visibility
+				DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 3"), STAT_FogOfWarPipelineStep3, STATGROUP_FogOfWar);
+				UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, PreFinalVisibilityTextureRenderTarget, AfterInterpolationMID);
+			}
+			{
+				// step 4: super sampling
+				DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Pipeline: step 4"), STAT_FogOfWarPipelineStep4, STATGROUP_FogOfWar);
+				UKismetRenderingLibrary::DrawMaterialToRenderTarget(this, FinalVisibilityTextureRenderTarget, SuperSamplingMID);
+			}
 		}
 	}
-
-	bFirstTick = false;
 }
 
 void AFogOfWar::Initialize()
@@ -289,23 +1068,26 @@ void AFogOfWar::Initialize()
 	};
 }
 
-void AFogOfWar::CalculateTileHeight(FTile& Tile, FIntPoint TileIJ)
+void AFogOfWar::CalculateTileHeight(FIntPoint TileIJ)
+{
+	TileGrid.SetTileHeight(TileIJ, TraceTerrainHeight(UMinimapDataSubsystem::ConvertVisionTileIJToTileCenterWorldLocation_Static(TileIJ)));
+}
+
+float AFogOfWar::TraceTerrainHeight(FVector2D WorldLocation) const
 {
-	FVector2D WorldLocation = UMinimapDataSubsystem::ConvertVisionTileIJToTileCenterWorldLocation_Static(TileIJ);
 	FHitResult HitResult;
 	bool bFoundBlockingHit = GetWorld()->LineTraceSingleByChannel(
 		HitResult,
-		FVector(WorldLocation.X, WorldLocation.Y, 10000.0),
-		FVector(WorldLocation.X, WorldLocation.Y, -10000.0),
+		FVector(WorldLocation.X, WorldLocation.Y, MaxTerrainHeight),
+		FVector(WorldLocation.X, WorldLocation.Y, MinTerrainHeight),
 		HeightScanCollisionChannel);
 
 	if (bFoundBlockingHit && HitResult.HasValidHitObjectHandle())
 	{
-		Tile.Height = HitResult.ImpactPoint.Z;
-		return;
+		return HitResult.ImpactPoint.Z;
 	}
 
-	Tile.Height = -std::numeric_limits<decltype(Tile.Height)>::infinity();
+	return -std::numeric_limits<float>::infinity();
 }
 
 UTexture2D* AFogOfWar::CreateSnapshotTexture()
@@ -320,6 +1102,21 @@ UTexture2D* AFogOfWar::CreateSnapshotTexture()
 		Texture->Filter = TF_Nearest;
 	}
 #endif
+	// the only full upload, later frames go through UploadTextureRegions
+	Texture->UpdateResource();
+
+	return Texture;
+}
+
+UTexture2D* AFogOfWar::CreatePackedSnapshotTexture()
+{
+	UTexture2D* Texture = UTexture2D::CreateTransient(FMath::DivideAndRoundUp(GridResolution.Y, 8), GridResolution.X, PF_R8);
+	Texture->AddressX = TA_Clamp;
+	Texture->AddressY = TA_Clamp;
+	Texture->SRGB = 0;
+	// filtering would blend the bits of neighbouring texels
+	Texture->Filter = TF_Nearest;
+	Texture->UpdateResource();
 
 	return Texture;
 }
@@ -340,42 +1137,200 @@ UTextureRenderTarget2D* AFogOfWar::CreateRenderTarget()
 	return RenderTarget;
 }
 
-void AFogOfWar::WriteVisionDataToTexture(UTexture2D* Texture)
+bool AFogOfWar::WriteVisionDataToTexture(UTexture2D* Texture)
 {
-	for (int TileIndex = 0; TileIndex < Tiles.Num(); TileIndex++)
+	const uint8 AllyMask = AllyMasks[FMath::Clamp(LocalTeamIndex, 0, FogOfWarMaxTeams - 1)];
+
+	if (AllyMask != SnapshotTextureAllyMask)
+	{
+		// the dirty chunks are covered by the full rebuild
+		TeamVisibility.ConsumeMaskDirtyChunks(SnapshotDirtyTileRects);
+		SnapshotDirtyTileRects.Reset();
+		SnapshotDirtyTileRects.Add(FIntRect(FIntPoint::ZeroValue, GridResolution));
+		SnapshotTextureAllyMask = AllyMask;
+	}
+	else if (!TeamVisibility.ConsumeMaskDirtyChunks(SnapshotDirtyTileRects))
 	{
-		const FTile& Tile = Tiles[TileIndex];
-		TextureDataBuffer[TileIndex] = Tile.VisibilityCounter > 0 ? 0xFF : 0;
+		return false;
 	}
 
-	void* TextureData = Texture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE);
-	FMemory::Memcpy(TextureData, TextureDataBuffer.GetData(), sizeof(TextureDataBuffer[0]) * TextureDataBuffer.Num());
+	// written straight into the mip, a separate staging buffer would double the per-tile memory
+	uint8* TextureData = static_cast<uint8*>(Texture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE));
+	if (bSnapshotPacked)
+	{
+		const int32 PackedPitch = FMath::DivideAndRoundUp(GridResolution.Y, 8);
+		for (FIntRect& TileRect : SnapshotDirtyTileRects)
+		{
+			// dirty rects are made of whole chunks, so every packed byte belongs to exactly one of them
+			checkSlow(TileRect.Min.Y % 8 == 0);
+			for (int I = TileRect.Min.X; I < TileRect.Max.X; I++)
+			{
+				uint8* PackedRow = TextureData + static_cast<int64>(I) * PackedPitch;
+				for (int J = TileRect.Min.Y; J < TileRect.Max.Y; J += FFogOfWarTeamVisibility::ChunkSize)
+				{
+					// one chunk wide at a time, the masks are only contiguous inside a chunk
+					const int32 NumTiles = FMath::Min(FFogOfWarTeamVisibility::ChunkSize, TileRect.Max.Y - J);
+					if (const uint8* MaskRow = TeamVisibility.GetTeamMaskRow({ I, J }))
+					{
+						PackVisibilityRow(MaskRow, AllyMask, NumTiles, PackedRow + J / 8);
+					}
+					else
+					{
+						FMemory::Memzero(PackedRow + J / 8, FMath::DivideAndRoundUp(NumTiles, 8));
+					}
+				}
+			}
+			TileRect.Min.Y /= 8;
+			TileRect.Max.Y = FMath::DivideAndRoundUp(TileRect.Max.Y, 8);
+		}
+		INC_DWORD_STAT_BY(STAT_FogOfWarSnapshotBytesUploaded, UploadTextureRegions(Texture, TextureData, PackedPitch, SnapshotDirtyTileRects));
+	}
+	else
+	{
+		for (const FIntRect& TileRect : SnapshotDirtyTileRects)
+		{
+			for (int I = TileRect.Min.X; I < TileRect.Max.X; I++)
+			{
+				for (int J = TileRect.Min.Y; J < TileRect.Max.Y; J += FFogOfWarTeamVisibility::ChunkSize)
+				{
+					const int32 NumTiles = FMath::Min(FFogOfWarTeamVisibility::ChunkSize, TileRect.Max.Y - J);
+					uint8* Texels = TextureData + GetGlobalIndex({ I, J });
+					if (const uint8* MaskRow = TeamVisibility.GetTeamMaskRow({ I, J }))
+					{
+						for (int32 Tile = 0; Tile < NumTiles; Tile++)
+						{
+							Texels[Tile] = (MaskRow[Tile] & AllyMask) != 0 ? 0xFF : 0;
+						}
+					}
+					else
+					{
+						FMemory::Memzero(Texels, NumTiles);
+					}
+				}
+			}
+		}
+		INC_DWORD_STAT_BY(STAT_FogOfWarSnapshotBytesUploaded, UploadTextureRegions(Texture, TextureData, GridResolution.Y, SnapshotDirtyTileRects));
+	}
 	Texture->GetPlatformData()->Mips[0].BulkData.Unlock();
-	// TODO: likely a better version exists
-	Texture->UpdateResource();
+	return true;
 }
 
-#if WITH_EDITORONLY_DATA
-void AFogOfWar::WriteHeightmapDataToTexture(UTexture2D* Texture)
+void AFogOfWar::UpdateExploredTexture()
+{
+	const uint8 AllyMask = AllyMasks[FMath::Clamp(LocalTeamIndex, 0, FogOfWarMaxTeams - 1)];
+	const bool bFullRebuild = AllyMask != ExploredTextureAllyMask;
+
+	if (bFullRebuild)
+	{
+		// the dirty chunks are covered by the full rebuild
+		TeamVisibility.ConsumeExploredDirtyChunks(ExploredDirtyTileRects);
+		ExploredDirtyTileRects.Reset();
+		ExploredDirtyTileRects.Add(FIntRect(FIntPoint::ZeroValue, GridResolution));
+		ExploredTextureAllyMask = AllyMask;
+	}
+	else if (!TeamVisibility.ConsumeExploredDirtyChunks(ExploredDirtyTileRects))
+	{
+		return;
+	}
+
+	// the mip keeps its previous contents, so only the dirty chunks are rewritten
+	uint8* TextureData = static_cast<uint8*>(ExploredTexture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE));
+	for (const FIntRect& TileRect : ExploredDirtyTileRects)
+	{
+		for (int I = TileRect.Min.X; I < TileRect.Max.X; I++)
+		{
+			for (int J = TileRect.Min.Y; J < TileRect.Max.Y; J++)
+			{
+				TextureData[GetGlobalIndex({ I, J })] = TeamVisibility.GetExploredMask({ I, J }, AllyMask) != 0 ? 0xFF : 0;
+			}
+		}
+	}
+	INC_DWORD_STAT_BY(STAT_FogOfWarExploredBytesUploaded, UploadTextureRegions(ExploredTexture, TextureData, GridResolution.Y, ExploredDirtyTileRects));
+	ExploredTexture->GetPlatformData()->Mips[0].BulkData.Unlock();
+}
+
+int32 AFogOfWar::UploadTextureRegions(UTexture2D* Texture, const uint8* TextureData, int32 TexturePitch, TConstArrayView<FIntRect> TexelRects)
+{
+	// without a resource UpdateTextureRegions drops the update without running the cleanup, which would leak the staging buffers
+	if (TexelRects.IsEmpty() || !Texture->GetResource())
+	{
+		return 0;
+	}
+
+	// all regions are stacked into one staging buffer so that the whole update is a single render command
+	int32 StagingPitch = 0;
+	int32 NumStagingRows = 0;
+	for (const FIntRect& TexelRect : TexelRects)
+	{
+		StagingPitch = FMath::Max(StagingPitch, TexelRect.Max.Y - TexelRect.Min.Y);
+		NumStagingRows += TexelRect.Max.X - TexelRect.Min.X;
+	}
+
+	uint8* StagingData = static_cast<uint8*>(FMemory::Malloc(static_cast<SIZE_T>(StagingPitch) * NumStagingRows));
+	FUpdateTextureRegion2D* Regions = new FUpdateTextureRegion2D[TexelRects.Num()];
+	int32 StagingRow = 0;
+	int32 NumUploadedBytes = 0;
+	for (int32 RegionIndex = 0; RegionIndex < TexelRects.Num(); RegionIndex++)
+	{
+		const FIntRect& TexelRect = TexelRects[RegionIndex];
+		const int32 Width = TexelRect.Max.Y - TexelRect.Min.Y;
+		const int32 Height = TexelRect.Max.X - TexelRect.Min.X;
+
+		// like the tile grid, X is the texture row and Y the texture column
+		Regions[RegionIndex] = FUpdateTextureRegion2D(TexelRect.Min.Y, TexelRect.Min.X, 0, StagingRow, Width, Height);
+		for (int32 Row = TexelRect.Min.X; Row < TexelRect.Max.X; Row++)
+		{
+			FMemory::Memcpy(StagingData + static_cast<int64>(StagingRow + Row - TexelRect.Min.X) * StagingPitch, TextureData + static_cast<int64>(Row) * TexturePitch + TexelRect.Min.Y, Width);
+		}
+		StagingRow += Height;
+		NumUploadedBytes += Width * Height;
+	}
+
+	Texture->UpdateTextureRegions(0, TexelRects.Num(), Regions, StagingPitch, sizeof(uint8), StagingData,
+		[](uint8* SrcData, const FUpdateTextureRegion2D* SrcRegions)
+		{
+			FMemory::Free(SrcData);
+			delete[] SrcRegions;
+		});
+	return NumUploadedBytes;
+}
+
+const FVisionRayTable& AFogOfWar::GetOrBuildRayTable(float GridSpaceRadius, int32 LocalAreaTilesResolution)
 {
-	TArray<uint8> HeightmapDataBuffer;
-	HeightmapDataBuffer.SetNum(Tiles.Num());
+	const TPair<float, int32> Key(GridSpaceRadius, LocalAreaTilesResolution);
+	{
+		FReadScopeLock ReadLock(RayTablesLock);
+		if (const TSharedRef<const FVisionRayTable>* Table = RayTables.Find(Key))
+		{
+			return Table->Get();
+		}
+	}
 
-	for (int TileIndex = 0; TileIndex < Tiles.Num(); TileIndex++)
+	FWriteScopeLock WriteLock(RayTablesLock);
+	if (const TSharedRef<const FVisionRayTable>* Table = RayTables.Find(Key))
 	{
-		const FTile& Tile = Tiles[TileIndex];
-		HeightmapDataBuffer[TileIndex] = FMath::RoundToInt(FMath::Clamp(FMath::GetRangePct(DebugHeightmapLowestZ, DebugHeightmapHightestZ, Tile.Height), 0.0f, 1.0f) * 0xFF);
+		return Table->Get();
 	}
 
-	void* TextureData = Texture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE);
-	FMemory::Memcpy(TextureData, HeightmapDataBuffer.GetData(), sizeof(HeightmapDataBuffer[0]) * HeightmapDataBuffer.Num());
+	DECLARE_SCOPE_CYCLE_COUNTER(TEXT("Build ray table"), STAT_FogOfWarBuildRayTable, STATGROUP_FogOfWar);
+	TSharedRef<const FVisionRayTable> Table = FVisionRayTable::Build(GridSpaceRadius, LocalAreaTilesResolution);
+	UE_LOG(LogFogOfWar, Log, TEXT("Built vision ray table for radius %.2f tiles: %d nodes, %llu bytes."), GridSpaceRadius, Table->Nodes.Num(), (uint64)Table->GetAllocatedSize());
+	return RayTables.Add(Key, Table).Get();
+}
+
+#if WITH_EDITORONLY_DATA
+void AFogOfWar::WriteHeightmapDataToTexture(UTexture2D* Texture)
+{
+	uint8* TextureData = static_cast<uint8*>(Texture->GetPlatformData()->Mips[0].BulkData.Lock(LOCK_READ_WRITE));
+	for (int I = 0; I < GridResolution.X; I++)
+	{
+		for (int J = 0; J < GridResolution.Y; J++)
+		{
+			TextureData[GetGlobalIndex({ I, J })] = FMath::RoundToInt(FMath::Clamp(FMath::GetRangePct(DebugHeightmapLowestZ, DebugHeightmapHightestZ, GetTileHeight({ I, J })), 0.0f, 1.0f) * 0xFF);
+		}
+	}
 	Texture->GetPlatformData()->Mips[0].BulkData.Unlock();
 	// TODO: likely a better version exists
 	Texture->UpdateResource();
 }
 #endif
-
-bool AFogOfWar::IsBlockingVision(float ObserverHeight, float PotentialObstacleHeight)
-{
-	return PotentialObstacleHeight - ObserverHeight > VisionBlockingDeltaHeightThreshold;
-}
\ No newline at end of file
@@ -0,0 +1,168 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarFootprintCache.h"
+#include "FogOfWar.h"
+#include "Misc/ScopeRWLock.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footprint cache hits"), STAT_FogOfWarFootprintCacheHits, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footprint cache misses"), STAT_FogOfWarFootprintCacheMisses, STATGROUP_FogOfWar);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Footprint cache hit rate (%)"), STAT_FogOfWarFootprintCacheHitRate, STATGROUP_FogOfWar);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Footprint cache entries"), STAT_FogOfWarFootprintCacheEntries, STATGROUP_FogOfWar);
+DECLARE_MEMORY_STAT(TEXT("Footprint cache memory"), STAT_FogOfWarFootprintCacheMemory, STATGROUP_FogOfWar);
+
+bool FVisionFootprintCache::Find(const FVisionFootprintCacheKey& Key, TArray<uint32>& OutVisibleBits)
+{
+	FReadScopeLock ReadLock(Lock);
+
+	const int32* EntryIndex = Lookup.Find(Key);
+	if (!EntryIndex)
+	{
+		FPlatformAtomics::InterlockedIncrement(&FrameMisses);
+		return false;
+	}
+
+	FPlatformAtomics::InterlockedIncrement(&FrameHits);
+	const FEntry& Entry = Entries[*EntryIndex];
+	// readers only mark the entry, the eviction order is kept by the writers
+	FPlatformAtomics::AtomicStore_Relaxed(&Entry.bReferenced, int8(1));
+	OutVisibleBits = Entry.VisibleBits;
+	return true;
+}
+
+void FVisionFootprintCache::Add(const FVisionFootprintCacheKey& Key, const FIntRect& LocalAreaRect, const TArray<uint32>& VisibleBits, int32 MaxEntries)
+{
+	if (MaxEntries <= 0)
+	{
+		return;
+	}
+
+	FWriteScopeLock WriteLock(Lock);
+
+	// another thread may have computed the same footprint in the meantime
+	if (Lookup.Contains(Key))
+	{
+		return;
+	}
+
+	while (Lookup.Num() >= MaxEntries)
+	{
+		EvictOne();
+	}
+
+	FEntry Entry;
+	Entry.Key = Key;
+	Entry.LocalAreaRect = LocalAreaRect;
+	Entry.VisibleBits = VisibleBits;
+	VisibleBitsAllocatedSize += Entry.VisibleBits.GetAllocatedSize();
+
+	const int32 EntryIndex = Entries.Add(MoveTemp(Entry));
+	Lookup.Add(Key, EntryIndex);
+}
+
+int32 FVisionFootprintCache::InvalidateRegion(const FIntRect& TileRect)
+{
+	FWriteScopeLock WriteLock(Lock);
+
+	TArray<int32, TInlineAllocator<64>> EntriesToRemove;
+	for (auto It = Entries.CreateConstIterator(); It; ++It)
+	{
+		if (It->LocalAreaRect.Intersect(TileRect))
+		{
+			EntriesToRemove.Add(It.GetIndex());
+		}
+	}
+
+	for (const int32 EntryIndex : EntriesToRemove)
+	{
+		RemoveEntry(EntryIndex);
+	}
+	return EntriesToRemove.Num();
+}
+
+void FVisionFootprintCache::Empty()
+{
+	FWriteScopeLock WriteLock(Lock);
+
+	Entries.Empty();
+	Lookup.Empty();
+	ClockHand = 0;
+	VisibleBitsAllocatedSize = 0;
+}
+
+int32 FVisionFootprintCache::Num() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return Lookup.Num();
+}
+
+SIZE_T FVisionFootprintCache::GetAllocatedSize() const
+{
+	FReadScopeLock ReadLock(Lock);
+	return Entries.GetAllocatedSize() + Lookup.GetAllocatedSize() + VisibleBitsAllocatedSize;
+}
+
+double FVisionFootprintCache::GetTotalHitRate() const
+{
+	FReadScopeLock ReadLock(Lock);
+	const uint64 Hits = TotalHits + static_cast<uint32>(FPlatformAtomics::AtomicRead_Relaxed(&FrameHits));
+	const uint64 TotalLookups = Hits + TotalMisses + static_cast<uint32>(FPlatformAtomics::AtomicRead_Relaxed(&FrameMisses));
+	return TotalLookups > 0 ? static_cast<double>(Hits) / TotalLookups : 0.0;
+}
+
+void FVisionFootprintCache::PublishStats()
+{
+	uint32 Hits;
+	uint32 Misses;
+	{
+		FWriteScopeLock WriteLock(Lock);
+		Hits = static_cast<uint32>(FPlatformAtomics::InterlockedExchange(&FrameHits, 0));
+		Misses = static_cast<uint32>(FPlatformAtomics::InterlockedExchange(&FrameMisses, 0));
+		TotalHits += Hits;
+		TotalMisses += Misses;
+	}
+
+	INC_DWORD_STAT_BY(STAT_FogOfWarFootprintCacheHits, Hits);
+	INC_DWORD_STAT_BY(STAT_FogOfWarFootprintCacheMisses, Misses);
+	if (Hits + Misses > 0)
+	{
+		INC_FLOAT_STAT_BY(STAT_FogOfWarFootprintCacheHitRate, 100.0f * Hits / (Hits + Misses));
+	}
+	SET_DWORD_STAT(STAT_FogOfWarFootprintCacheEntries, Num());
+	SET_MEMORY_STAT(STAT_FogOfWarFootprintCacheMemory, GetAllocatedSize());
+}
+
+void FVisionFootprintCache::EvictOne()
+{
+	// Two sweeps at most: the first one may only clear the reference flags.
+	const int32 MaxIndex = Entries.GetMaxIndex();
+	for (int32 Step = 0; Step < 2 * MaxIndex; ++Step)
+	{
+		if (ClockHand >= MaxIndex)
+		{
+			ClockHand = 0;
+		}
+
+		const int32 EntryIndex = ClockHand++;
+		if (!Entries.IsAllocated(EntryIndex))
+		{
+			continue;
+		}
+
+		FEntry& Entry = Entries[EntryIndex];
+		if (Entry.bReferenced)
+		{
+			Entry.bReferenced = 0;
+			continue;
+		}
+
+		RemoveEntry(EntryIndex);
+		return;
+	}
+}
+
+void FVisionFootprintCache::RemoveEntry(int32 EntryIndex)
+{
+	VisibleBitsAllocatedSize -= Entries[EntryIndex].VisibleBits.GetAllocatedSize();
+	Lookup.Remove(Entries[EntryIndex].Key);
+	Entries.RemoveAt(EntryIndex);
+}
@@ -0,0 +1,225 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarHeightfieldAsset.h"
+#include "FogOfWarTileGrid.h"
+#include "Async/ParallelFor.h"
+#include "Misc/Compression.h"
+#include "IO/IoDispatcher.h"
+#include "Async/MappedFileHandle.h"
+
+namespace
+{
+	/// @brief 每个分块压缩数据前的1字节头，标明分块是否被压缩（不值得压缩的分块原样存储）。
+	enum class EChunkEncoding : uint8
+	{
+		Raw,
+		Zlib
+	};
+}
+
+UFogOfWarHeightfieldAsset::UFogOfWarHeightfieldAsset()
+{
+	// keep the payload out of the export so cooked builds can memory map it instead of copying
+	HeightData.SetBulkDataFlags(BULKDATA_Force_NOT_InlinePayload | BULKDATA_MemoryMappedPayload);
+}
+
+void UFogOfWarHeightfieldAsset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	if (Ar.IsSaving())
+	{
+		FormatVersion = CurrentFormatVersion;
+	}
+	Ar << FormatVersion;
+	Ar << ChunkOffsets;
+	HeightData.Serialize(Ar, this);
+}
+
+FIntPoint UFogOfWarHeightfieldAsset::GetNumChunks() const
+{
+	return FIntPoint(FMath::DivideAndRoundUp(GridResolution.X, ChunkSize), FMath::DivideAndRoundUp(GridResolution.Y, ChunkSize));
+}
+
+#if WITH_EDITOR
+void UFogOfWarHeightfieldAsset::Bake(TConstArrayView<float> Heights, FIntPoint InGridResolution, FVector2D InGridBottomLeftWorldLocation, float InTileSize, uint32 InTerrainSignature)
+{
+	check(Heights.Num() == static_cast<int64>(InGridResolution.X) * InGridResolution.Y);
+
+	GridResolution = InGridResolution;
+	GridBottomLeftWorldLocation = InGridBottomLeftWorldLocation;
+	TileSize = InTileSize;
+	TerrainSignature = InTerrainSignature;
+
+	float MaxHeight = -MAX_flt;
+	MinHeight = MAX_flt;
+	for (const float Height : Heights)
+	{
+		if (FMath::IsFinite(Height))
+		{
+			MinHeight = FMath::Min(MinHeight, Height);
+			MaxHeight = FMath::Max(MaxHeight, Height);
+		}
+	}
+	if (MinHeight > MaxHeight)
+	{
+		MinHeight = MaxHeight = 0.0f;
+	}
+	HeightStep = FMath::Max((MaxHeight - MinHeight) / (NoHitQuantizedHeight - 1), UE_KINDA_SMALL_NUMBER);
+
+	const FIntPoint NumChunks = GetNumChunks();
+	TArray<uint8> Payload;
+	TArray<uint16> ChunkHeights;
+	TArray<uint8> CompressedChunk;
+	ChunkOffsets.Reset(NumChunks.X * NumChunks.Y + 1);
+
+	for (int32 ChunkI = 0; ChunkI < NumChunks.X; ChunkI++)
+	{
+		for (int32 ChunkJ = 0; ChunkJ < NumChunks.Y; ChunkJ++)
+		{
+			const FIntPoint ChunkMinIJ(ChunkI * ChunkSize, ChunkJ * ChunkSize);
+			const FIntPoint ChunkMaxIJ = (ChunkMinIJ + FIntPoint(ChunkSize)).ComponentMin(GridResolution);
+
+			// each row is delta coded, neighbouring terrain heights are close so the deltas compress well
+			ChunkHeights.Reset();
+			for (int32 I = ChunkMinIJ.X; I < ChunkMaxIJ.X; I++)
+			{
+				uint16 PreviousQuantized = 0;
+				for (int32 J = ChunkMinIJ.Y; J < ChunkMaxIJ.Y; J++)
+				{
+					const float Height = Heights[static_cast<int64>(I) * GridResolution.Y + J];
+					const uint16 Quantized = FMath::IsFinite(Height)
+						? static_cast<uint16>(FMath::Clamp(FMath::RoundToInt32((Height - MinHeight) / HeightStep), 0, NoHitQuantizedHeight - 1))
+						: NoHitQuantizedHeight;
+					ChunkHeights.Add(static_cast<uint16>(Quantized - PreviousQuantized));
+					PreviousQuantized = Quantized;
+				}
+			}
+
+			const int32 UncompressedSize = ChunkHeights.Num() * sizeof(uint16);
+			int32 ChunkCompressedSize = FCompression::CompressMemoryBound(NAME_Zlib, UncompressedSize);
+			CompressedChunk.SetNumUninitialized(ChunkCompressedSize);
+
+			ChunkOffsets.Add(Payload.Num());
+			if (FCompression::CompressMemory(NAME_Zlib, CompressedChunk.GetData(), ChunkCompressedSize, ChunkHeights.GetData(), UncompressedSize) && ChunkCompressedSize < UncompressedSize)
+			{
+				Payload.Add(static_cast<uint8>(EChunkEncoding::Zlib));
+				Payload.Append(CompressedChunk.GetData(), ChunkCompressedSize);
+			}
+			else
+			{
+				Payload.Add(static_cast<uint8>(EChunkEncoding::Raw));
+				Payload.Append(reinterpret_cast<const uint8*>(ChunkHeights.GetData()), UncompressedSize);
+			}
+		}
+	}
+	ChunkOffsets.Add(Payload.Num());
+	CompressedSize = Payload.Num();
+
+	HeightData.Lock(LOCK_READ_WRITE);
+	FMemory::Memcpy(HeightData.Realloc(Payload.Num()), Payload.GetData(), Payload.Num());
+	HeightData.Unlock();
+
+	FormatVersion = CurrentFormatVersion;
+	MarkPackageDirty();
+}
+#endif
+
+bool UFogOfWarHeightfieldAsset::IsCompatible(FIntPoint InGridResolution, FVector2D InGridBottomLeftWorldLocation, float InTileSize) const
+{
+	const FIntPoint NumChunks = GetNumChunks();
+	return FormatVersion == CurrentFormatVersion
+		&& GridResolution == InGridResolution
+		&& GridBottomLeftWorldLocation.Equals(InGridBottomLeftWorldLocation)
+		&& FMath::IsNearlyEqual(TileSize, InTileSize)
+		&& ChunkOffsets.Num() == NumChunks.X * NumChunks.Y + 1;
+}
+
+bool UFogOfWarHeightfieldAsset::LoadTileHeights(FFogOfWarTileGrid& OutTileGrid) const
+{
+	const int64 PayloadSize = HeightData.GetBulkDataSize();
+	if (ChunkOffsets.IsEmpty() || ChunkOffsets.Last() != PayloadSize)
+	{
+		return false;
+	}
+
+	// cooked payloads are decoded straight from the mapped package file, nothing is copied into memory first
+	if (HeightData.IsUsingIODispatcher() && FPlatformProperties::SupportsMemoryMappedFiles() && !HeightData.IsBulkDataLoaded())
+	{
+		TIoStatusOr<FIoMappedRegion> MappedRegionStatus = FIoDispatcher::Get().OpenMapped(HeightData.CreateChunkId(), FIoReadOptions(HeightData.GetBulkDataOffsetInFile(), PayloadSize));
+		if (MappedRegionStatus.IsOk())
+		{
+			FIoMappedRegion MappedRegion = MappedRegionStatus.ConsumeValueOrDie();
+			const bool bDecoded = DecodeChunks(MappedRegion.MappedFileRegion->GetMappedPtr(), PayloadSize, OutTileGrid);
+			delete MappedRegion.MappedFileRegion;
+			delete MappedRegion.MappedFileHandle;
+			return bDecoded;
+		}
+	}
+
+	// editor builds, loose files and platforms without memory mapping read the payload
+	const uint8* Payload = static_cast<const uint8*>(HeightData.LockReadOnly());
+	const bool bDecoded = Payload && DecodeChunks(Payload, PayloadSize, OutTileGrid);
+	HeightData.Unlock();
+	return bDecoded;
+}
+
+bool UFogOfWarHeightfieldAsset::DecodeChunks(const uint8* Payload, int64 PayloadSize, FFogOfWarTileGrid& OutTileGrid) const
+{
+	const FIntPoint NumChunks = GetNumChunks();
+	std::atomic<bool> bAllChunksDecoded = true;
+
+	ParallelFor(TEXT("FogOfWar.LoadTileHeights"), NumChunks.X * NumChunks.Y, 1, [&](int32 ChunkIndex)
+	{
+		const FIntPoint ChunkMinIJ(ChunkIndex / NumChunks.Y * ChunkSize, ChunkIndex % NumChunks.Y * ChunkSize);
+		const FIntPoint ChunkMaxIJ = (ChunkMinIJ + FIntPoint(ChunkSize)).ComponentMin(GridResolution);
+		const FIntPoint ChunkExtent = ChunkMaxIJ - ChunkMinIJ;
+
+		const int64 ChunkOffset = ChunkOffsets[ChunkIndex];
+		const int64 ChunkEnd = ChunkOffsets[ChunkIndex + 1];
+		if (ChunkOffset < 0 || ChunkEnd > PayloadSize || ChunkEnd <= ChunkOffset)
+		{
+			bAllChunksDecoded = false;
+			return;
+		}
+
+		const EChunkEncoding Encoding = static_cast<EChunkEncoding>(Payload[ChunkOffset]);
+		const uint8* ChunkData = Payload + ChunkOffset + 1;
+		const int32 ChunkDataSize = static_cast<int32>(ChunkEnd - ChunkOffset - 1);
+		const int32 UncompressedSize = ChunkExtent.X * ChunkExtent.Y * sizeof(uint16);
+
+		TArray<uint16, TInlineAllocator<ChunkSize * ChunkSize>> ChunkHeights;
+		ChunkHeights.SetNumUninitialized(ChunkExtent.X * ChunkExtent.Y);
+		bool bDecoded = false;
+		if (Encoding == EChunkEncoding::Zlib)
+		{
+			bDecoded = FCompression::UncompressMemory(NAME_Zlib, ChunkHeights.GetData(), UncompressedSize, ChunkData, ChunkDataSize);
+		}
+		else if (Encoding == EChunkEncoding::Raw && ChunkDataSize == UncompressedSize)
+		{
+			FMemory::Memcpy(ChunkHeights.GetData(), ChunkData, UncompressedSize);
+			bDecoded = true;
+		}
+
+		if (!bDecoded)
+		{
+			bAllChunksDecoded = false;
+			return;
+		}
+
+		for (int32 RowOffset = 0; RowOffset < ChunkExtent.X; RowOffset++)
+		{
+			const uint16* Row = &ChunkHeights[RowOffset * ChunkExtent.Y];
+			uint16 Quantized = 0;
+			for (int32 J = 0; J < ChunkExtent.Y; J++)
+			{
+				Quantized += Row[J];
+				OutTileGrid.SetTileHeight(ChunkMinIJ + FIntPoint(RowOffset, J), Quantized == NoHitQuantizedHeight
+					? -std::numeric_limits<float>::infinity()
+					: MinHeight + Quantized * HeightStep);
+			}
+		}
+	});
+
+	return bAllChunksDecoded;
+}
@@ -0,0 +1,166 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarRayTable.h"
+
+SIZE_T FVisionRayTable::GetAllocatedSize() const
+{
+	SIZE_T Size = sizeof(*this) + Nodes.GetAllocatedSize() + SpiralOrders.GetAllocatedSize();
+	for (const TPair<FIntPoint, TArray<FVisionRayTarget>>& SpiralOrder : SpiralOrders)
+	{
+		Size += SpiralOrder.Value.GetAllocatedSize();
+	}
+	return Size;
+}
+
+void FVisionRayTable::TraceDDAPath(FIntPoint TargetOffset, TArray<FIntPoint>& OutPath)
+{
+	OutPath.Reset();
+
+	// Keep in sync with FFogOfWarMassHelpers::ComputeVisibilityDDA, the float stepping has to match exactly.
+	const FIntPoint Direction = FIntPoint::ZeroValue - TargetOffset;
+	if (FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) == 0)
+	{
+		OutPath.Add(FIntPoint::ZeroValue);
+		return;
+	}
+
+	const FIntPoint DirectionSign = { Direction.X >= 0 ? 1 : -1, Direction.Y >= 0 ? 1 : -1 };
+	const float S_x = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.Y) / Direction.X));
+	const float S_y = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.X) / Direction.Y));
+	float NextAccumulatedDxLength = 0.5 * S_x;
+	float NextAccumulatedDyLength = 0.5 * S_y;
+
+	const int DDASafetyIterations = FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + 1;
+	FIntPoint CurrentOffset = TargetOffset;
+
+	for (int DDASafetyCounter = 0; DDASafetyCounter < DDASafetyIterations; DDASafetyCounter++)
+	{
+		OutPath.Add(CurrentOffset);
+		if (CurrentOffset == FIntPoint::ZeroValue) break;
+
+		if (NextAccumulatedDxLength < NextAccumulatedDyLength)
+		{
+			NextAccumulatedDxLength += S_x;
+			CurrentOffset.X += DirectionSign.X;
+		}
+		else
+		{
+			NextAccumulatedDyLength += S_y;
+			CurrentOffset.Y += DirectionSign.Y;
+		}
+	}
+	checkSlow(OutPath.Last() == FIntPoint::ZeroValue);
+}
+
+TSharedRef<const FVisionRayTable> FVisionRayTable::Build(float GridSpaceRadius, int32 LocalAreaTilesResolution)
+{
+	TSharedRef<FVisionRayTable> Table = MakeShared<FVisionRayTable>();
+
+	const float GridSpaceRadiusSqr = FMath::Square(GridSpaceRadius);
+	const auto MakeNode = [LocalAreaTilesResolution](FIntPoint Offset, int32 Parent)
+	{
+		FVisionRayNode Node;
+		Node.Offset = Offset;
+		Node.LocalIndexDelta = Offset.X * LocalAreaTilesResolution + Offset.Y;
+		Node.Parent = Parent;
+		return Node;
+	};
+
+	// the local area is walked in exactly the same spiral as the per-tile DDA, so the results match bit by bit
+	TArray<FIntPoint> SpiralLocalIJs;
+	SpiralLocalIJs.Reserve(LocalAreaTilesResolution * LocalAreaTilesResolution);
+	if (LocalAreaTilesResolution > 0)
+	{
+		enum class EDirection { Right, Up, Left, Down };
+		const FIntPoint DirectionDeltas[] = { {0, 1}, {1, 0}, {0, -1}, {-1, 0} };
+
+		EDirection CurrentDirection = EDirection::Right;
+		bool Clock = true;
+		int CurrentStepSize = LocalAreaTilesResolution;
+		int LeftToSpend = CurrentStepSize;
+		FIntPoint CurrentLocalIJ = FIntPoint(0, 0) - DirectionDeltas[static_cast<int>(CurrentDirection)];
+
+		while (true)
+		{
+			CurrentLocalIJ += DirectionDeltas[static_cast<int>(CurrentDirection)];
+			LeftToSpend--;
+			SpiralLocalIJs.Add(CurrentLocalIJ);
+
+			if (LeftToSpend == 0)
+			{
+				if (Clock)
+				{
+					if (CurrentStepSize == 1) break;
+					CurrentStepSize--;
+				}
+				Clock ^= 1;
+				CurrentDirection = static_cast<EDirection>((static_cast<int>(CurrentDirection) + 1) % 4);
+				LeftToSpend = CurrentStepSize;
+			}
+		}
+	}
+
+	// rays are inserted from the origin outwards, so rays sharing their origin side are stored once
+	Table->Nodes.Add(MakeNode(FIntPoint::ZeroValue, INDEX_NONE));
+	TMap<FIntVector, int32> ChildrenLookup;
+	TMap<FIntPoint, int32> TargetNodes;
+	TArray<FIntPoint> Path;
+
+	const auto FindOrAddTargetNode = [&](FIntPoint TargetOffset)
+	{
+		if (const int32* ExistingNode = TargetNodes.Find(TargetOffset))
+		{
+			return *ExistingNode;
+		}
+
+		TraceDDAPath(TargetOffset, Path);
+		int32 NodeIndex = RootNodeIndex;
+		for (int32 PathIndex = Path.Num() - 2; PathIndex >= 0; PathIndex--)
+		{
+			const FIntPoint Offset = Path[PathIndex];
+			const FIntVector ChildKey(NodeIndex, Offset.X, Offset.Y);
+			if (const int32* ChildIndex = ChildrenLookup.Find(ChildKey))
+			{
+				NodeIndex = *ChildIndex;
+			}
+			else
+			{
+				const int32 NewNodeIndex = Table->Nodes.Add(MakeNode(Offset, NodeIndex));
+				ChildrenLookup.Add(ChildKey, NewNodeIndex);
+				NodeIndex = NewNodeIndex;
+			}
+		}
+		TargetNodes.Add(TargetOffset, NodeIndex);
+		return NodeIndex;
+	};
+
+	// depending on the sub-tile location of the unit, the origin lands on one of (at most) two local coordinates per axis
+	const int32 MinOriginLocal = FMath::FloorToInt32(GridSpaceRadius);
+	for (int32 OriginLocalX = MinOriginLocal; OriginLocalX <= MinOriginLocal + 1; OriginLocalX++)
+	{
+		for (int32 OriginLocalY = MinOriginLocal; OriginLocalY <= MinOriginLocal + 1; OriginLocalY++)
+		{
+			const FIntPoint OriginLocalIJ(OriginLocalX, OriginLocalY);
+			if (OriginLocalX >= LocalAreaTilesResolution || OriginLocalY >= LocalAreaTilesResolution)
+			{
+				continue;
+			}
+
+			TArray<FVisionRayTarget>& Targets = Table->SpiralOrders.Emplace_GetRef(OriginLocalIJ, TArray<FVisionRayTarget>()).Value;
+			for (const FIntPoint& LocalIJ : SpiralLocalIJs)
+			{
+				const FIntPoint Offset = LocalIJ - OriginLocalIJ;
+				if (Offset == FIntPoint::ZeroValue || FMath::Square(Offset.X) + FMath::Square(Offset.Y) > GridSpaceRadiusSqr)
+				{
+					continue;
+				}
+
+				Targets.Add({ Offset, FindOrAddTargetNode(Offset) });
+			}
+			Targets.Shrink();
+		}
+	}
+
+	Table->Nodes.Shrink();
+	return Table;
+}
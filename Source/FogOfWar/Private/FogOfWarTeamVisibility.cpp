@@ -0,0 +1,381 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarTeamVisibility.h"
+#include "Misc/ScopeLock.h"
+
+FTeamRelationshipResolver::FIsAllyDelegate FTeamRelationshipResolver::IsAllyDelegate;
+
+bool FTeamRelationshipResolver::IsAlly(int32 ObserverTeam, int32 TargetTeam)
+{
+	if (IsAllyDelegate.IsBound())
+	{
+		return IsAllyDelegate.Execute(ObserverTeam, TargetTeam);
+	}
+	return FOGOFWAR_IS_ALLY(ObserverTeam, TargetTeam);
+}
+
+uint8 FTeamRelationshipResolver::ComputeAllyMask(int32 ObserverTeam)
+{
+	uint8 AllyMask = 1u << ObserverTeam;
+	for (int32 TargetTeam = 0; TargetTeam < FogOfWarMaxTeams; TargetTeam++)
+	{
+		if (TargetTeam != ObserverTeam && IsAlly(ObserverTeam, TargetTeam))
+		{
+			AllyMask |= 1u << TargetTeam;
+		}
+	}
+	return AllyMask;
+}
+
+FFogOfWarTeamVisibility::~FFogOfWarTeamVisibility()
+{
+	Reset();
+}
+
+void FFogOfWarTeamVisibility::Initialize(FIntPoint InGridResolution)
+{
+	Reset();
+
+	GridResolution = InGridResolution;
+	NumChunks = FFogOfWarTileLayout::GetNumChunks(GridResolution);
+	const int32 NumChunksTotal = NumChunks.X * NumChunks.Y;
+
+	for (TArray<uint16*>& Chunks : TeamChunks)
+	{
+		Chunks.Init(nullptr, NumChunksTotal);
+	}
+	for (TArray<uint32*>& ExploredChunks : TeamExploredChunks)
+	{
+		ExploredChunks.Init(nullptr, NumChunksTotal);
+	}
+	DirtyChunks.Init(0, NumChunksTotal);
+	ExploredDirtyChunks.Init(0, NumChunksTotal);
+	MaskDirtyChunks.Init(0, NumChunksTotal);
+	MaskChunks.Init(nullptr, NumChunksTotal);
+}
+
+void FFogOfWarTeamVisibility::Reset()
+{
+	ClearCounters();
+
+	for (int32 TeamIndex = 0; TeamIndex < FogOfWarMaxTeams; TeamIndex++)
+	{
+		ResetExplored(TeamIndex);
+	}
+
+	FMemory::Memzero(DirtyChunks.GetData(), DirtyChunks.Num());
+	bHasDirtyChunks = 0;
+
+	for (int32 ChunkIndex = 0; ChunkIndex < MaskChunks.Num(); ChunkIndex++)
+	{
+		uint8*& MaskChunk = MaskChunks[ChunkIndex];
+		if (MaskChunk)
+		{
+			FMemory::Free(MaskChunk);
+			MaskChunk = nullptr;
+			MaskDirtyChunks[ChunkIndex] = 1;
+		}
+	}
+	NumAllocatedMaskChunks = 0;
+}
+
+void FFogOfWarTeamVisibility::ClearCounters()
+{
+	for (TArray<uint16*>& Chunks : TeamChunks)
+	{
+		for (int32 ChunkIndex = 0; ChunkIndex < Chunks.Num(); ChunkIndex++)
+		{
+			uint16*& Chunk = Chunks[ChunkIndex];
+			if (Chunk)
+			{
+				FMemory::Free(Chunk);
+				Chunk = nullptr;
+				MarkChunkDirty(ChunkIndex, false);
+			}
+		}
+	}
+	NumAllocatedChunks = 0;
+
+	FScopeLock ScopeLock(&OverflowLock);
+	OverflowCounters.Reset();
+}
+
+void FFogOfWarTeamVisibility::ReserveChunk(int32 TeamIndex, int32 ChunkIndex)
+{
+	checkSlow(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams);
+	if (!TeamChunks[TeamIndex][ChunkIndex])
+	{
+		AllocateChunk(TeamIndex, ChunkIndex, false);
+		MarkChunkDirty(ChunkIndex, false);
+	}
+}
+
+void FFogOfWarTeamVisibility::ResetExplored(int32 TeamIndex)
+{
+	for (int32 ChunkIndex = 0; ChunkIndex < TeamExploredChunks[TeamIndex].Num(); ChunkIndex++)
+	{
+		uint32*& ExploredChunk = TeamExploredChunks[TeamIndex][ChunkIndex];
+		if (!ExploredChunk)
+		{
+			continue;
+		}
+
+		// Increment only marks tiles on their 0 to 1 transition and expects the explored chunk of a counted chunk to
+		// exist, so counted chunks keep it, holding exactly the tiles that are in view right now.
+		if (const uint16* Chunk = TeamChunks[TeamIndex][ChunkIndex])
+		{
+			FMemory::Memzero(ExploredChunk, sizeof(uint32) * ExploredWordsPerChunk);
+			for (int32 OffsetInChunk = 0; OffsetInChunk < TilesPerChunk; OffsetInChunk++)
+			{
+				ExploredChunk[OffsetInChunk >> 5] |= Chunk[OffsetInChunk] != 0 ? 1u << (OffsetInChunk & 31) : 0u;
+			}
+		}
+		else
+		{
+			FMemory::Free(ExploredChunk);
+			ExploredChunk = nullptr;
+			NumAllocatedExploredChunks--;
+		}
+		ExploredDirtyChunks[ChunkIndex] = 1;
+	}
+}
+
+bool FFogOfWarTeamVisibility::ConsumeExploredDirtyChunks(TArray<FIntRect>& OutTileRects)
+{
+	return ConsumeDirtyChunks(ExploredDirtyChunks, OutTileRects);
+}
+
+bool FFogOfWarTeamVisibility::ConsumeMaskDirtyChunks(TArray<FIntRect>& OutTileRects)
+{
+	return ConsumeDirtyChunks(MaskDirtyChunks, OutTileRects);
+}
+
+bool FFogOfWarTeamVisibility::ConsumeDirtyChunks(TArray<int8>& DirtyFlags, TArray<FIntRect>& OutTileRects) const
+{
+	OutTileRects.Reset();
+	for (int32 ChunkIndex = 0; ChunkIndex < DirtyFlags.Num(); ChunkIndex++)
+	{
+		if (DirtyFlags[ChunkIndex])
+		{
+			DirtyFlags[ChunkIndex] = 0;
+			OutTileRects.Add(GetChunkTileRect(ChunkIndex));
+		}
+	}
+	return !OutTileRects.IsEmpty();
+}
+
+FIntRect FFogOfWarTeamVisibility::GetChunkTileRect(int32 ChunkIndex) const
+{
+	return FFogOfWarTileLayout::GetChunkTileRect(ChunkIndex, NumChunks, GridResolution);
+}
+
+uint16* FFogOfWarTeamVisibility::AllocateChunk(int32 TeamIndex, int32 ChunkIndex, bool bAtomic)
+{
+	// the explored bits outlive the counters, so they may already be there from an earlier visit
+	if (!TeamExploredChunks[TeamIndex][ChunkIndex])
+	{
+		uint32* NewExploredChunk = static_cast<uint32*>(FMemory::MallocZeroed(sizeof(uint32) * ExploredWordsPerChunk));
+		if (bAtomic)
+		{
+			if (FPlatformAtomics::InterlockedCompareExchangePointer(reinterpret_cast<void**>(&TeamExploredChunks[TeamIndex][ChunkIndex]), NewExploredChunk, nullptr))
+			{
+				FMemory::Free(NewExploredChunk);
+			}
+			else
+			{
+				FPlatformAtomics::InterlockedIncrement(&NumAllocatedExploredChunks);
+			}
+		}
+		else
+		{
+			TeamExploredChunks[TeamIndex][ChunkIndex] = NewExploredChunk;
+			NumAllocatedExploredChunks++;
+		}
+	}
+
+	uint16* NewChunk = static_cast<uint16*>(FMemory::MallocZeroed(sizeof(uint16) * TilesPerChunk));
+	if (bAtomic)
+	{
+		// another worker may have allocated the same chunk in the meantime, in which case ours is dropped
+		void* ExistingChunk = FPlatformAtomics::InterlockedCompareExchangePointer(reinterpret_cast<void**>(&TeamChunks[TeamIndex][ChunkIndex]), NewChunk, nullptr);
+		if (ExistingChunk)
+		{
+			FMemory::Free(NewChunk);
+			return static_cast<uint16*>(ExistingChunk);
+		}
+		FPlatformAtomics::InterlockedIncrement(&NumAllocatedChunks);
+	}
+	else
+	{
+		TeamChunks[TeamIndex][ChunkIndex] = NewChunk;
+		NumAllocatedChunks++;
+	}
+	return NewChunk;
+}
+
+int32 FFogOfWarTeamVisibility::ResolveDirtyChunks()
+{
+	if (!bHasDirtyChunks)
+	{
+		return 0;
+	}
+	bHasDirtyChunks = 0;
+
+	int32 NumResolvedChunks = 0;
+	uint8 NewMasks[TilesPerChunk];
+	for (int32 ChunkIndex = 0; ChunkIndex < DirtyChunks.Num(); ChunkIndex++)
+	{
+		if (!DirtyChunks[ChunkIndex])
+		{
+			continue;
+		}
+		DirtyChunks[ChunkIndex] = 0;
+		NumResolvedChunks++;
+
+		const FIntRect ChunkTileRect = GetChunkTileRect(ChunkIndex);
+		const FIntPoint ChunkMinIJ = ChunkTileRect.Min;
+		const FIntPoint ChunkMaxIJ = ChunkTileRect.Max;
+
+		FMemory::Memzero(NewMasks, sizeof(NewMasks));
+		bool bAnyTeamVisible = false;
+		for (int32 TeamIndex = 0; TeamIndex < FogOfWarMaxTeams; TeamIndex++)
+		{
+			uint16*& Chunk = TeamChunks[TeamIndex][ChunkIndex];
+			if (!Chunk)
+			{
+				continue;
+			}
+
+			const uint8 TeamBit = 1u << TeamIndex;
+			bool bAnyVisible = false;
+			for (int32 I = ChunkMinIJ.X; I < ChunkMaxIJ.X; I++)
+			{
+				for (int32 J = ChunkMinIJ.Y; J < ChunkMaxIJ.Y; J++)
+				{
+					if (Chunk[GetOffsetInChunk({ I, J })] != 0)
+					{
+						NewMasks[GetMaskOffsetInChunk({ I, J })] |= TeamBit;
+						bAnyVisible = true;
+					}
+				}
+			}
+
+			// nothing of this team is in view here any more
+			if (!bAnyVisible)
+			{
+				FMemory::Free(Chunk);
+				Chunk = nullptr;
+				NumAllocatedChunks--;
+			}
+			bAnyTeamVisible |= bAnyVisible;
+		}
+
+		// only chunks whose visibility really changed are reported, counter churn alone is not
+		uint8*& MaskChunk = MaskChunks[ChunkIndex];
+		if (!bAnyTeamVisible)
+		{
+			if (MaskChunk)
+			{
+				FMemory::Free(MaskChunk);
+				MaskChunk = nullptr;
+				NumAllocatedMaskChunks--;
+				MaskDirtyChunks[ChunkIndex] = 1;
+			}
+		}
+		else if (!MaskChunk)
+		{
+			MaskChunk = static_cast<uint8*>(FMemory::Malloc(TilesPerChunk));
+			FMemory::Memcpy(MaskChunk, NewMasks, TilesPerChunk);
+			NumAllocatedMaskChunks++;
+			MaskDirtyChunks[ChunkIndex] = 1;
+		}
+		else if (FMemory::Memcmp(MaskChunk, NewMasks, TilesPerChunk) != 0)
+		{
+			FMemory::Memcpy(MaskChunk, NewMasks, TilesPerChunk);
+			MaskDirtyChunks[ChunkIndex] = 1;
+		}
+	}
+	return NumResolvedChunks;
+}
+
+void FFogOfWarTeamVisibility::IncrementOverflow(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk)
+{
+	FScopeLock ScopeLock(&OverflowLock);
+
+	volatile int16* Counter = reinterpret_cast<volatile int16*>(&TeamChunks[TeamIndex][ChunkIndex][OffsetInChunk]);
+	const uint64 Key = GetOverflowKey(TeamIndex, ChunkIndex, OffsetInChunk);
+	while (true)
+	{
+		const uint16 OldCounter = static_cast<uint16>(FPlatformAtomics::AtomicRead(Counter));
+		if (OldCounter == OverflowCounter)
+		{
+			OverflowCounters.FindChecked(Key)++;
+			return;
+		}
+
+		// the lock does not stop the fast path from moving the counter, so every transition is a compare-exchange
+		const uint16 NewCounter = OldCounter + 1;
+		if (static_cast<uint16>(FPlatformAtomics::InterlockedCompareExchange(Counter, static_cast<int16>(NewCounter), static_cast<int16>(OldCounter))) == OldCounter)
+		{
+			if (NewCounter == OverflowCounter)
+			{
+				OverflowCounters.Add(Key, OverflowCounter);
+			}
+			return;
+		}
+	}
+}
+
+void FFogOfWarTeamVisibility::DecrementOverflow(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk)
+{
+	FScopeLock ScopeLock(&OverflowLock);
+
+	volatile int16* Counter = reinterpret_cast<volatile int16*>(&TeamChunks[TeamIndex][ChunkIndex][OffsetInChunk]);
+	const uint64 Key = GetOverflowKey(TeamIndex, ChunkIndex, OffsetInChunk);
+	while (true)
+	{
+		// another worker may have taken the counter off the sentinel while this one waited for the lock
+		const uint16 OldCounter = static_cast<uint16>(FPlatformAtomics::AtomicRead(Counter));
+		if (OldCounter == OverflowCounter)
+		{
+			// the fast path never moves a counter sitting on the sentinel, so the lock covers this branch
+			int32& OverflowedCounter = OverflowCounters.FindChecked(Key);
+			if (--OverflowedCounter < OverflowCounter)
+			{
+				OverflowCounters.Remove(Key);
+				FPlatformAtomics::AtomicStore(Counter, static_cast<int16>(OverflowCounter - 1));
+			}
+			return;
+		}
+
+		checkSlow(OldCounter > 0);
+		if (static_cast<uint16>(FPlatformAtomics::InterlockedCompareExchange(Counter, static_cast<int16>(OldCounter - 1), static_cast<int16>(OldCounter))) == OldCounter)
+		{
+			return;
+		}
+	}
+}
+
+int32 FFogOfWarTeamVisibility::GetOverflowCounter(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk) const
+{
+	FScopeLock ScopeLock(&OverflowLock);
+	const int32* OverflowedCounter = OverflowCounters.Find(GetOverflowKey(TeamIndex, ChunkIndex, OffsetInChunk));
+	return OverflowedCounter ? *OverflowedCounter : OverflowCounter;
+}
+
+SIZE_T FFogOfWarTeamVisibility::GetAllocatedSize() const
+{
+	SIZE_T Size = OverflowCounters.GetAllocatedSize() + DirtyChunks.GetAllocatedSize() + ExploredDirtyChunks.GetAllocatedSize() + MaskDirtyChunks.GetAllocatedSize() + MaskChunks.GetAllocatedSize()
+		+ static_cast<SIZE_T>(NumAllocatedChunks) * TilesPerChunk * sizeof(uint16)
+		+ static_cast<SIZE_T>(NumAllocatedMaskChunks) * TilesPerChunk
+		+ static_cast<SIZE_T>(NumAllocatedExploredChunks) * ExploredWordsPerChunk * sizeof(uint32);
+	for (const TArray<uint16*>& Chunks : TeamChunks)
+	{
+		Size += Chunks.GetAllocatedSize();
+	}
+	for (const TArray<uint32*>& ExploredChunks : TeamExploredChunks)
+	{
+		Size += ExploredChunks.GetAllocatedSize();
+	}
+	return Size;
+}
@@ -0,0 +1,125 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarTileGrid.h"
+
+FFogOfWarTileGrid::~FFogOfWarTileGrid()
+{
+	Reset();
+}
+
+void FFogOfWarTileGrid::Initialize(FIntPoint InGridResolution, float MinHeight, float MaxHeight)
+{
+	Reset();
+
+	GridResolution = InGridResolution;
+	NumChunks = FFogOfWarTileLayout::GetNumChunks(GridResolution);
+
+	// the quantized range is symmetric around the middle of the map's height range, MIN_int16 is reserved for no hit
+	HeightOffset = (MinHeight + MaxHeight) * 0.5f;
+	HeightStep = FMath::Max((MaxHeight - MinHeight) / (2 * MAX_int16), UE_KINDA_SMALL_NUMBER);
+	InvHeightStep = 1.0f / HeightStep;
+
+	ChunkDirectory.Init(FindOrAddSharedChunk(NoHitHeight), NumChunks.X * NumChunks.Y);
+}
+
+void FFogOfWarTileGrid::Reset()
+{
+	for (FChunk* Chunk : ChunkDirectory)
+	{
+		if (!Chunk->bShared)
+		{
+			delete Chunk;
+		}
+	}
+	ChunkDirectory.Reset();
+	NumResidentChunks = 0;
+
+	for (const TPair<int16, FChunk*>& SharedChunk : SharedChunks)
+	{
+		delete SharedChunk.Value;
+	}
+	SharedChunks.Reset();
+}
+
+FFogOfWarTileGrid::FChunk* FFogOfWarTileGrid::MakeChunkUnique(int32 ChunkIndex, FChunk* SharedChunk)
+{
+	FChunk* NewChunk = new FChunk(*SharedChunk);
+	NewChunk->bShared = false;
+
+	// another worker may have copied the same chunk in the meantime, in which case ours is dropped
+	void* ExistingChunk = FPlatformAtomics::InterlockedCompareExchangePointer(reinterpret_cast<void**>(&ChunkDirectory[ChunkIndex]), NewChunk, SharedChunk);
+	if (ExistingChunk != SharedChunk)
+	{
+		delete NewChunk;
+		return static_cast<FChunk*>(ExistingChunk);
+	}
+	FPlatformAtomics::InterlockedIncrement(&NumResidentChunks);
+	return NewChunk;
+}
+
+FFogOfWarTileGrid::FChunk* FFogOfWarTileGrid::FindOrAddSharedChunk(int16 QuantizedHeight)
+{
+	if (FChunk* const* SharedChunk = SharedChunks.Find(QuantizedHeight))
+	{
+		return *SharedChunk;
+	}
+
+	FChunk* SharedChunk = new FChunk();
+	SharedChunk->bShared = true;
+	for (int16& Height : SharedChunk->Heights)
+	{
+		Height = QuantizedHeight;
+	}
+	return SharedChunks.Add(QuantizedHeight, SharedChunk);
+}
+
+int32 FFogOfWarTileGrid::Compact(const FIntRect& TileRect)
+{
+	const FIntPoint MinChunk = TileRect.Min.ComponentMax(FIntPoint::ZeroValue) / ChunkSize;
+	const FIntPoint MaxChunk = FIntPoint(FMath::DivideAndRoundUp(TileRect.Max.X, ChunkSize), FMath::DivideAndRoundUp(TileRect.Max.Y, ChunkSize)).ComponentMin(NumChunks);
+
+	int32 NumReleasedChunks = 0;
+	for (int32 ChunkI = MinChunk.X; ChunkI < MaxChunk.X; ChunkI++)
+	{
+		for (int32 ChunkJ = MinChunk.Y; ChunkJ < MaxChunk.Y; ChunkJ++)
+		{
+			const int32 ChunkIndex = ChunkI * NumChunks.Y + ChunkJ;
+			FChunk* Chunk = ChunkDirectory[ChunkIndex];
+			if (Chunk->bShared)
+			{
+				continue;
+			}
+
+			// tiles of border chunks that lie outside of the grid are never read, so they are not compared
+			const FIntRect ChunkTileRect = FFogOfWarTileLayout::GetChunkTileRect(ChunkIndex, NumChunks, GridResolution);
+			const int16 FirstHeight = Chunk->Heights[0];
+			bool bUniform = true;
+			for (int32 I = ChunkTileRect.Min.X; I < ChunkTileRect.Max.X && bUniform; I++)
+			{
+				for (int32 J = ChunkTileRect.Min.Y; J < ChunkTileRect.Max.Y; J++)
+				{
+					if (Chunk->Heights[GetOffsetInChunk({ I, J })] != FirstHeight)
+					{
+						bUniform = false;
+						break;
+					}
+				}
+			}
+
+			if (bUniform)
+			{
+				ChunkDirectory[ChunkIndex] = FindOrAddSharedChunk(FirstHeight);
+				delete Chunk;
+				NumResidentChunks--;
+				NumReleasedChunks++;
+			}
+		}
+	}
+	return NumReleasedChunks;
+}
+
+SIZE_T FFogOfWarTileGrid::GetAllocatedSize() const
+{
+	return ChunkDirectory.GetAllocatedSize() + SharedChunks.GetAllocatedSize()
+		+ static_cast<SIZE_T>(NumResidentChunks + SharedChunks.Num()) * sizeof(FChunk);
+}
@@ -0,0 +1,127 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#include "FogOfWarTileLayout.h"
+#include "FogOfWar.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+namespace
+{
+	/**
+	 * @brief 在合成网格上模拟视野计算：对圆盘内每个瓦片沿DDA射线走回原点读取高度，可见时增加计数。
+	 * @return 访问过的瓦片数量。
+	 */
+	template<typename IndexFunc>
+	int64 RunVisionPass(const TArray<int16>& Heights, TArray<uint16>& Counters, const TArray<FIntPoint>& Origins, FIntPoint GridResolution, int32 Radius, IndexFunc GetIndex)
+	{
+		const int32 RadiusSqr = Radius * Radius;
+		int64 NumVisitedTiles = 0;
+
+		for (const FIntPoint& Origin : Origins)
+		{
+			const int16 ObserverHeight = Heights[GetIndex(Origin)];
+			for (int32 DX = -Radius; DX <= Radius; DX++)
+			{
+				for (int32 DY = -Radius; DY <= Radius; DY++)
+				{
+					const FIntPoint Target = Origin + FIntPoint(DX, DY);
+					if (DX * DX + DY * DY > RadiusSqr || Target.X < 0 || Target.Y < 0 || Target.X >= GridResolution.X || Target.Y >= GridResolution.Y)
+					{
+						continue;
+					}
+
+					// same stepping as the DDA kernel, from the target towards the origin
+					bool bBlocked = false;
+					const int32 NumSteps = FMath::Max(FMath::Abs(DX), FMath::Abs(DY));
+					for (int32 Step = NumSteps; Step > 0; Step--)
+					{
+						const FIntPoint IJ(Origin.X + DX * Step / NumSteps, Origin.Y + DY * Step / NumSteps);
+						NumVisitedTiles++;
+						if (Heights[GetIndex(IJ)] - ObserverHeight > 600)
+						{
+							bBlocked = true;
+							break;
+						}
+					}
+
+					if (!bBlocked)
+					{
+						Counters[GetIndex(Target)]++;
+					}
+				}
+			}
+		}
+		return NumVisitedTiles;
+	}
+
+	FAutoConsoleCommand BenchmarkTileLayoutCommand(
+		TEXT("FogOfWar.BenchmarkTileLayout"),
+		TEXT("Compares row-major, blocked row-major and blocked Morton tile layouts for the vision hot loops. Usage: FogOfWar.BenchmarkTileLayout [GridSize=4096] [Radius=32] [Observers=2000]"),
+		FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+		{
+			const int32 GridSize = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), FFogOfWarTileLayout::ChunkSize) : 4096;
+			const float Radius = Args.Num() > 1 ? FMath::Max(FCString::Atof(*Args[1]), 1.0f) : 32.0f;
+			const int32 NumObservers = Args.Num() > 2 ? FMath::Max(FCString::Atoi(*Args[2]), 1) : 2000;
+			FFogOfWarTileLayout::RunBenchmark(FIntPoint(GridSize), Radius, NumObservers);
+		}));
+}
+
+void FFogOfWarTileLayout::RunBenchmark(FIntPoint GridResolution, float GridSpaceRadius, int32 NumObservers)
+{
+	const FIntPoint NumChunks = GetNumChunks(GridResolution);
+	const int32 NumBlockedTiles = NumChunks.X * NumChunks.Y * TilesPerChunk;
+	const int32 Radius = FMath::CeilToInt32(GridSpaceRadius);
+
+	FRandomStream RandomStream(1337);
+	TArray<FIntPoint> Origins;
+	Origins.Reserve(NumObservers);
+	for (int32 ObserverIndex = 0; ObserverIndex < NumObservers; ObserverIndex++)
+	{
+		Origins.Emplace(RandomStream.RandRange(0, GridResolution.X - 1), RandomStream.RandRange(0, GridResolution.Y - 1));
+	}
+
+	// every layout stores the same synthetic terrain, so all of them do exactly the same amount of work
+	TArray<int16> TerrainHeights;
+	TerrainHeights.SetNumUninitialized(GridResolution.X * GridResolution.Y);
+	for (int16& Height : TerrainHeights)
+	{
+		Height = static_cast<int16>(RandomStream.RandRange(0, 1000));
+	}
+
+	const auto RunLayout = [&](const TCHAR* LayoutName, int32 NumTiles, auto GetIndex)
+	{
+		TArray<int16> Heights;
+		Heights.SetNumZeroed(NumTiles);
+		TArray<uint16> Counters;
+		Counters.SetNumZeroed(NumTiles);
+		for (int32 I = 0; I < GridResolution.X; I++)
+		{
+			for (int32 J = 0; J < GridResolution.Y; J++)
+			{
+				Heights[GetIndex(FIntPoint(I, J))] = TerrainHeights[I * GridResolution.Y + J];
+			}
+		}
+
+		const double StartSeconds = FPlatformTime::Seconds();
+		const int64 NumVisitedTiles = RunVisionPass(Heights, Counters, Origins, GridResolution, Radius, GetIndex);
+		const double ElapsedSeconds = FPlatformTime::Seconds() - StartSeconds;
+
+		UE_LOG(LogFogOfWar, Log, TEXT("  %-20s %8.2f ms, %7.1f M tile reads/s"), LayoutName, ElapsedSeconds * 1000.0, NumVisitedTiles / FMath::Max(ElapsedSeconds, UE_SMALL_NUMBER) / 1.0e6);
+	};
+
+	UE_LOG(LogFogOfWar, Log, TEXT("Tile layout benchmark: %dx%d grid, radius %.1f, %d observers (active layout: %s)"),
+		GridResolution.X, GridResolution.Y, GridSpaceRadius, NumObservers, FOGOFWAR_MORTON_TILE_LAYOUT ? TEXT("blocked Morton") : TEXT("blocked row-major"));
+
+	RunLayout(TEXT("row-major"), GridResolution.X * GridResolution.Y, [GridResolution](FIntPoint IJ)
+	{
+		return IJ.X * GridResolution.Y + IJ.Y;
+	});
+	RunLayout(TEXT("blocked row-major"), NumBlockedTiles, [NumChunks](FIntPoint IJ)
+	{
+		return GetChunkIndex(IJ, NumChunks.Y) * TilesPerChunk + GetRowMajorOffsetInChunk(IJ);
+	});
+	RunLayout(TEXT("blocked Morton"), NumBlockedTiles, [NumChunks](FIntPoint IJ)
+	{
+		return GetChunkIndex(IJ, NumChunks.Y) * TilesPerChunk + GetMortonOffsetInChunk(IJ);
+	});
+}
@@ -8,249 +8,717 @@
 #include "MassExecutionContext.h"
 #include "Kismet/GameplayStatics.h"
 #include "Containers/StringView.h"
+#include "Async/ParallelFor.h"
+#include "Algo/Sort.h"
+#include "Algo/Count.h"
+#include "Algo/Partition.h"
+#include "MassCommands.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
 #include "MassRepresentationProcessor.h" // 包含 UMassVisibilityProcessor 的定义
 #include "MassRepresentationFragments.h" // 包含 FMassVisibilityFragment 的定义
 
 //----------------------------------------------------------------------//
 // FFogOfWarMassHelpers
 //----------------------------------------------------------------------//
-void FFogOfWarMassHelpers::ProcessEntityChunk(FMassExecutionContext& Context, AFogOfWar* FogOfWar)
+EMassLOD::Type FFogOfWarMassHelpers::GetVisionLOD(const FMassExecutionContext& Context, TConstArrayView<FMassRepresentationLODFragment> LODList, int32 EntityIndex)
 {
+	const EMassLOD::Type LOD = LODList.IsEmpty() ? EMassLOD::High : LODList[EntityIndex].LOD.GetValue();
+	// culled units keep revealing fog, just less often
+	if (Context.DoesArchetypeHaveTag<FMassVisibilityCulledByDistanceTag>() || Context.DoesArchetypeHaveTag<FMassVisibilityCulledByFrustumTag>())
+	{
+		return FMath::Max(LOD, EMassLOD::Low);
+	}
+	return LOD;
+}
+
+bool FFogOfWarMassHelpers::IsVisionUpdateDue(const AFogOfWar* FogOfWar, FMassEntityHandle Entity, EMassLOD::Type LOD)
+{
+	if (!FogOfWar->bVisionLOD)
+	{
+		return true;
+	}
+
+	int32 UpdatePeriod = 1;
+	switch (LOD)
+	{
+	case EMassLOD::High:	UpdatePeriod = FogOfWar->VisionUpdatePeriodHigh; break;
+	case EMassLOD::Medium:	UpdatePeriod = FogOfWar->VisionUpdatePeriodMedium; break;
+	case EMassLOD::Low:		UpdatePeriod = FogOfWar->VisionUpdatePeriodLow; break;
+	default:				UpdatePeriod = FogOfWar->VisionUpdatePeriodOff; break;
+	}
+
+	// entities of the same period are spread over all of its frames
+	return UpdatePeriod <= 1 || (GFrameCounter + static_cast<uint64>(Entity.Index)) % UpdatePeriod == 0;
+}
+
+void FFogOfWarMassHelpers::GetLocalViewLocations(const UWorld* World, TArray<FVector, TInlineAllocator<4>>& OutViewLocations)
+{
+	OutViewLocations.Reset();
+	if (!World)
+	{
+		return;
+	}
+
+	for (FConstPlayerControllerIterator Iterator = World->GetPlayerControllerIterator(); Iterator; ++Iterator)
+	{
+		const APlayerController* PlayerController = Iterator->Get();
+		if (PlayerController && PlayerController->IsLocalController())
+		{
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			OutViewLocations.Add(ViewLocation);
+		}
+	}
+}
+
+double FFogOfWarMassHelpers::GetDistanceToNearestView(const FVector& Location, TConstArrayView<FVector> ViewLocations)
+{
+	double MinDistSquared = ViewLocations.IsEmpty() ? 0.0 : MAX_dbl;
+	for (const FVector& ViewLocation : ViewLocations)
+	{
+		MinDistSquared = FMath::Min(MinDistSquared, FVector::DistSquared2D(Location, ViewLocation));
+	}
+	return FMath::Sqrt(MinDistSquared);
+}
+
+void FFogOfWarMassHelpers::UpdateEntityVision(AFogOfWar* FogOfWar, const FVector& Location, const FMassVisionFragment& Vision, FVisionUnitData& CachedVisionData, bool bAtomic)
+{
+	FVisionUnitData VisionUnitData;
+	ComputeEntityFootprint(FogOfWar, Location, Vision, VisionUnitData);
+	ApplyEntityFootprint(FogOfWar, CachedVisionData, MoveTemp(VisionUnitData), bAtomic);
+}
+
+void FFogOfWarMassHelpers::ComputeEntityFootprint(AFogOfWar* FogOfWar, const FVector& Location, const FMassVisionFragment& Vision, FVisionUnitData& OutVisionUnitData)
+{
+	const float SightRadius = Vision.SightRadius;
 	// Subsystem is now accessed via its static Get() method.
 	const float VisionTileSize = UMinimapDataSubsystem::Get()->VisionTileSize;
+
+	// Create current VisionUnitData
+	FVisionUnitData VisionUnitData = {
+		.LocalAreaTilesResolution = FMath::CeilToInt32(SightRadius * 2 / VisionTileSize) + 1,
+		.GridSpaceRadius = SightRadius / VisionTileSize,
+	};
+	VisionUnitData.TeamIndex = FMath::Min<uint8>(Vision.TeamIndex, FogOfWarMaxTeams - 1);
+
+	const FVector2f OriginGridLocation = UMinimapDataSubsystem::ConvertWorldSpaceLocationToVisionGridSpace_Static(FVector2D(Location));
+	const FIntPoint OriginGridLocationRounded = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation + VisionUnitData.GridSpaceRadius);
+	const FIntPoint OriginGridLocationRounded2 = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation - VisionUnitData.GridSpaceRadius);
+
+	checkSlow(OriginGridLocationRounded.X - OriginGridLocationRounded2.X + 1 <= VisionUnitData.LocalAreaTilesResolution);
+	checkSlow(OriginGridLocationRounded.Y - OriginGridLocationRounded2.Y + 1 <= VisionUnitData.LocalAreaTilesResolution);
+	checkSlow(OriginGridLocationRounded.X - OriginGridLocationRounded2.X + 1 + 2 > VisionUnitData.LocalAreaTilesResolution);
+	checkSlow(OriginGridLocationRounded.Y - OriginGridLocationRounded2.Y + 1 + 2 > VisionUnitData.LocalAreaTilesResolution);
+
+	const FIntPoint OriginGlobalIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation);
 	
-	const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
-	const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
-	const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+	if (!UMinimapDataSubsystem::IsVisionGridIJValid_Static(OriginGlobalIJ))
+	{
+		UE_LOG(LogFogOfWar, Verbose, TEXT("Vision actor is outside the grid. Skipping."));
+		OutVisionUnitData = MoveTemp(VisionUnitData);
+		return;
+	}
+
+	if (VisionUnitData.LocalAreaTilesResolution == 0)
+	{
+		OutVisionUnitData = MoveTemp(VisionUnitData);
+		return;
+	}
+
+	VisionUnitData.CachedOriginGlobalIndex = UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(OriginGlobalIJ);
+	VisionUnitData.CachedObserverHeight = Location.Z;
+	VisionUnitData.LocalAreaCachedMinIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation - VisionUnitData.GridSpaceRadius);
+	const FIntPoint OriginLocalIJ = VisionUnitData.GlobalToLocal(OriginGlobalIJ);
 
-	for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+	const bool bUseFootprintCache = FogOfWar->IsFootprintCacheEnabled();
+	FVisionFootprintCacheKey FootprintCacheKey;
+	if (bUseFootprintCache)
+	{
+		FootprintCacheKey.OriginGlobalIndex = VisionUnitData.CachedOriginGlobalIndex;
+		FootprintCacheKey.OriginLocalIJ = OriginLocalIJ;
+		FootprintCacheKey.HeightBucket = FogOfWar->GetVisionHeightBucket(Location.Z);
+		FootprintCacheKey.GridSpaceRadius = VisionUnitData.GridSpaceRadius;
+		FootprintCacheKey.Kernel = static_cast<uint8>(FogOfWar->VisionKernel);
+	}
+
+	if (!bUseFootprintCache || !FogOfWar->FootprintCache.Find(FootprintCacheKey, VisionUnitData.LocalAreaVisibleBits))
+	{
+		AcquireScratchStates(VisionUnitData);
+		VisionUnitData.GetLocalTileState(OriginLocalIJ) = ETileState::Visible;
+
+		switch (FogOfWar->VisionKernel)
+		{
+		case EFogOfWarVisionKernel::Shadowcasting:
+			ComputeVisibilityShadowcasting(FogOfWar, Location.Z, OriginGlobalIJ, OriginLocalIJ, VisionUnitData);
+			break;
+		case EFogOfWarVisionKernel::PrecomputedDDA:
+			ComputeVisibilityRayTable(FogOfWar, Location.Z, OriginGlobalIJ, OriginLocalIJ, VisionUnitData);
+			break;
+		case EFogOfWarVisionKernel::DDA:
+		default:
+			ComputeVisibilityDDA(FogOfWar, Location.Z, OriginGlobalIJ, OriginLocalIJ, VisionUnitData);
+			break;
+		}
+
+		PackVisibleTiles(VisionUnitData, OriginGlobalIJ);
+		ReleaseScratchStates(VisionUnitData);
+
+		if (bUseFootprintCache)
+		{
+			const FIntRect LocalAreaRect(VisionUnitData.LocalAreaCachedMinIJ, VisionUnitData.LocalAreaCachedMinIJ + FIntPoint(VisionUnitData.LocalAreaTilesResolution));
+			FogOfWar->FootprintCache.Add(FootprintCacheKey, LocalAreaRect, VisionUnitData.LocalAreaVisibleBits, FogOfWar->FootprintCacheMaxEntries);
+		}
+	}
+
+	VisionUnitData.bHasCachedData = true;
+	OutVisionUnitData = MoveTemp(VisionUnitData);
+}
+
+void FFogOfWarMassHelpers::ApplyEntityFootprint(AFogOfWar* FogOfWar, FVisionUnitData& CachedVisionData, FVisionUnitData&& VisionUnitData, bool bAtomic)
+{
+	// a footprint can only be diffed against one that was counted for the same team
+	if (CachedVisionData.bHasCachedData && VisionUnitData.bHasCachedData
+		&& FogOfWar->FootprintUpdateMode == EFogOfWarFootprintUpdateMode::Delta && CachedVisionData.TeamIndex == VisionUnitData.TeamIndex)
 	{
-		const FVector& Location = TransformList[EntityIndex].GetTransform().GetLocation();
-		const float SightRadius = VisionList[EntityIndex].SightRadius;
-		FMassPreviousVisionFragment& PreviousVisionFragment = PreviousVisionList[EntityIndex];
+		ApplyFootprintDelta(FogOfWar, CachedVisionData, VisionUnitData, bAtomic);
+	}
+	else
+	{
+		if (CachedVisionData.bHasCachedData)
+		{
+			RemoveFootprintFromCounters(FogOfWar, CachedVisionData, bAtomic);
+		}
+		if (VisionUnitData.bHasCachedData)
+		{
+			AddFootprintToCounters(FogOfWar, VisionUnitData, bAtomic);
+		}
+	}
+
+	CachedVisionData = MoveTemp(VisionUnitData);
+}
+
+
+namespace
+{
+	/// 每个线程复用的草稿缓冲区，避免每个单位每次计算都分配一次三态数组。
+	thread_local TArray<ETileState> ScratchTileStatesPool;
+}
+
+void FFogOfWarMassHelpers::AcquireScratchStates(FVisionUnitData& VisionUnitData)
+{
+	VisionUnitData.LocalAreaTilesScratchStates = MoveTemp(ScratchTileStatesPool);
+	VisionUnitData.LocalAreaTilesScratchStates.Init(ETileState::Unknown, VisionUnitData.GetNumLocalTiles());
+}
 
-		// Reset previous vision contribution
-		if (PreviousVisionFragment.PreviousVisionData.bHasCachedData)
+void FFogOfWarMassHelpers::ReleaseScratchStates(FVisionUnitData& VisionUnitData)
+{
+	ScratchTileStatesPool = MoveTemp(VisionUnitData.LocalAreaTilesScratchStates);
+	VisionUnitData.LocalAreaTilesScratchStates.Empty();
+}
+
+void FFogOfWarMassHelpers::PackVisibleTiles(FVisionUnitData& VisionUnitData, FIntPoint OriginGlobalIJ)
+{
+	const float GridSpaceRadiusSqr = FMath::Square(VisionUnitData.GridSpaceRadius);
+	const int32 NumLocalTiles = VisionUnitData.GetNumLocalTiles();
+	// distances are taken between local coordinates, which stay small however large the grid is
+	const FIntPoint OriginLocalIJ = VisionUnitData.GlobalToLocal(OriginGlobalIJ);
+
+	VisionUnitData.LocalAreaVisibleBits.Init(0u, FMath::DivideAndRoundUp(NumLocalTiles, FVisionUnitData::BitsPerWord));
+	uint32* Words = VisionUnitData.LocalAreaVisibleBits.GetData();
+
+	int32 LocalIndex = 0;
+	for (int I = 0; I < VisionUnitData.LocalAreaTilesResolution; I++)
+	{
+		for (int J = 0; J < VisionUnitData.LocalAreaTilesResolution; J++, LocalIndex++)
 		{
-			for (int I = 0; I < PreviousVisionFragment.PreviousVisionData.LocalAreaTilesResolution; I++)
+			if (VisionUnitData.GetLocalTileState(LocalIndex) != ETileState::Visible)
 			{
-				for (int J = 0; J < PreviousVisionFragment.PreviousVisionData.LocalAreaTilesResolution; J++)
+				continue;
+			}
+
+			const FIntPoint GlobalIJ = VisionUnitData.LocalToGlobal({ I, J });
+			if (UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
+			{
+				const int32 DistToTileSqr = FMath::Square(I - OriginLocalIJ.X) + FMath::Square(J - OriginLocalIJ.Y);
+				if (DistToTileSqr <= GridSpaceRadiusSqr)
 				{
-					if (PreviousVisionFragment.PreviousVisionData.GetLocalTileState({ I, J }) == ETileState::Visible)
-					{
-						const FIntPoint GlobalIJ = PreviousVisionFragment.PreviousVisionData.LocalToGlobal({ I, J });
-						if (UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
-						{
-							FTile& GlobalTile = FogOfWar->GetGlobalTile(GlobalIJ);
-							checkSlow(GlobalTile.VisibilityCounter > 0);
-							GlobalTile.VisibilityCounter--;
-						}
-					}
+					Words[LocalIndex / FVisionUnitData::BitsPerWord] |= 1u << (LocalIndex % FVisionUnitData::BitsPerWord);
 				}
 			}
-			PreviousVisionFragment.PreviousVisionData.bHasCachedData = false;
-		}
-
-		// Create current VisionUnitData
-		int LocalAreaTilesResolution = FMath::CeilToInt32(SightRadius * 2 / VisionTileSize) + 1;
-		TArray<ETileState> LocalAreaTilesStates;
-		LocalAreaTilesStates.Init(ETileState::NotVisible, LocalAreaTilesResolution * LocalAreaTilesResolution);
-		
-		FVisionUnitData VisionUnitData = {
-			.LocalAreaTilesResolution = LocalAreaTilesResolution,
-			.GridSpaceRadius = SightRadius / VisionTileSize,
-			.LocalAreaTilesCachedStates = MoveTemp(LocalAreaTilesStates),
-		};
+		}
+	}
+}
 
-		const FVector2f OriginGridLocation = UMinimapDataSubsystem::ConvertWorldSpaceLocationToVisionGridSpace_Static(FVector2D(Location));
-		const FIntPoint OriginGridLocationRounded = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation + VisionUnitData.GridSpaceRadius);
-		const FIntPoint OriginGridLocationRounded2 = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation - VisionUnitData.GridSpaceRadius);
+void FFogOfWarMassHelpers::AddFootprintToCounters(AFogOfWar* FogOfWar, const FVisionUnitData& VisionUnitData, bool bAtomic)
+{
+	VisionUnitData.ForEachVisibleLocalIndex([&](int32 LocalIndex)
+	{
+		FogOfWar->IncrementVisibilityCounter(VisionUnitData.TeamIndex, VisionUnitData.LocalToGlobal(VisionUnitData.GetLocalIJ(LocalIndex)), bAtomic);
+	});
+}
 
-		checkSlow(OriginGridLocationRounded.X - OriginGridLocationRounded2.X + 1 <= VisionUnitData.LocalAreaTilesResolution);
-		checkSlow(OriginGridLocationRounded.Y - OriginGridLocationRounded2.Y + 1 <= VisionUnitData.LocalAreaTilesResolution);
-		checkSlow(OriginGridLocationRounded.X - OriginGridLocationRounded2.X + 1 + 2 > VisionUnitData.LocalAreaTilesResolution);
-		checkSlow(OriginGridLocationRounded.Y - OriginGridLocationRounded2.Y + 1 + 2 > VisionUnitData.LocalAreaTilesResolution);
+void FFogOfWarMassHelpers::RemoveFootprintFromCounters(AFogOfWar* FogOfWar, const FVisionUnitData& VisionUnitData, bool bAtomic)
+{
+	VisionUnitData.ForEachVisibleLocalIndex([&](int32 LocalIndex)
+	{
+		FogOfWar->DecrementVisibilityCounter(VisionUnitData.TeamIndex, VisionUnitData.LocalToGlobal(VisionUnitData.GetLocalIJ(LocalIndex)), bAtomic);
+	});
+}
 
-		VisionUnitData.LocalAreaTilesCachedStates.Init(ETileState::Unknown, VisionUnitData.LocalAreaTilesCachedStates.Num());
-		const FIntPoint OriginGlobalIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation);
-		
-		if (!UMinimapDataSubsystem::IsVisionGridIJValid_Static(OriginGlobalIJ))
+namespace
+{
+	/// 从扁平位集中读取一个全局行片段（最多32列），不在局部区域内的部分视为0。
+	uint32 ReadFootprintRowBits(const FVisionUnitData& VisionUnitData, int32 GlobalI, int32 GlobalJ, int32 NumColumns)
+	{
+		const int32 LocalI = GlobalI - VisionUnitData.LocalAreaCachedMinIJ.X;
+		if (LocalI < 0 || LocalI >= VisionUnitData.LocalAreaTilesResolution)
 		{
-			UE_LOG(LogFogOfWar, Verbose, TEXT("Vision actor is outside the grid. Skipping."));
-			PreviousVisionFragment.PreviousVisionData = MoveTemp(VisionUnitData);
-			continue; // Use continue to skip this entity and proceed with the next in the chunk
+			return 0u;
 		}
 
-		if (VisionUnitData.LocalAreaTilesResolution == 0)
+		const int32 FirstLocalJ = GlobalJ - VisionUnitData.LocalAreaCachedMinIJ.Y;
+		const int32 MinLocalJ = FMath::Max(FirstLocalJ, 0);
+		const int32 MaxLocalJ = FMath::Min(FirstLocalJ + NumColumns, VisionUnitData.LocalAreaTilesResolution);
+		if (MinLocalJ >= MaxLocalJ)
 		{
-			PreviousVisionFragment.PreviousVisionData = MoveTemp(VisionUnitData);
-			return;
+			return 0u;
 		}
 
-		VisionUnitData.CachedOriginGlobalIndex = UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(OriginGlobalIJ);
-		VisionUnitData.LocalAreaCachedMinIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation - VisionUnitData.GridSpaceRadius);
-		const FIntPoint OriginLocalIJ = VisionUnitData.GlobalToLocal(OriginGlobalIJ);
+		const int32 BitPosition = VisionUnitData.GetLocalIndex({ LocalI, MinLocalJ });
+		const int32 WordIndex = BitPosition / FVisionUnitData::BitsPerWord;
+		const int32 BitOffset = BitPosition % FVisionUnitData::BitsPerWord;
+		const TArray<uint32>& Words = VisionUnitData.LocalAreaVisibleBits;
 
-		VisionUnitData.GetLocalTileState(OriginLocalIJ) = ETileState::Visible;
+		uint64 Bits = Words[WordIndex];
+		if (WordIndex + 1 < Words.Num())
+		{
+			Bits |= static_cast<uint64>(Words[WordIndex + 1]) << FVisionUnitData::BitsPerWord;
+		}
 
-		const float GridSpaceRadiusSqr = FMath::Square(VisionUnitData.GridSpaceRadius);
+		const int32 NumBits = MaxLocalJ - MinLocalJ;
+		const uint64 Mask = (uint64(1) << NumBits) - 1;
+		return static_cast<uint32>(((Bits >> BitOffset) & Mask) << (MinLocalJ - FirstLocalJ));
+	}
+}
+
+void FFogOfWarMassHelpers::ApplyFootprintDelta(AFogOfWar* FogOfWar, const FVisionUnitData& PreviousVisionUnitData, const FVisionUnitData& VisionUnitData, bool bAtomic)
+{
+	checkSlow(PreviousVisionUnitData.TeamIndex == VisionUnitData.TeamIndex);
+
+	const FIntPoint PreviousMin = PreviousVisionUnitData.LocalAreaCachedMinIJ;
+	const FIntPoint PreviousMax = PreviousMin + PreviousVisionUnitData.LocalAreaTilesResolution;
+	const FIntPoint CurrentMin = VisionUnitData.LocalAreaCachedMinIJ;
+	const FIntPoint CurrentMax = CurrentMin + VisionUnitData.LocalAreaTilesResolution;
+
+	// footprints that do not overlap at all gain nothing from the comparison
+	if (PreviousMax.X <= CurrentMin.X || CurrentMax.X <= PreviousMin.X || PreviousMax.Y <= CurrentMin.Y || CurrentMax.Y <= PreviousMin.Y)
+	{
+		RemoveFootprintFromCounters(FogOfWar, PreviousVisionUnitData, bAtomic);
+		AddFootprintToCounters(FogOfWar, VisionUnitData, bAtomic);
+		return;
+	}
 
-		// going in spiral
+	// walk the union of both local areas row by row, 32 columns at a time, and touch only the tiles whose bit differs
+	const FIntPoint UnionMin(FMath::Min(PreviousMin.X, CurrentMin.X), FMath::Min(PreviousMin.Y, CurrentMin.Y));
+	const FIntPoint UnionMax(FMath::Max(PreviousMax.X, CurrentMax.X), FMath::Max(PreviousMax.Y, CurrentMax.Y));
+
+	for (int32 GlobalI = UnionMin.X; GlobalI < UnionMax.X; GlobalI++)
+	{
+		for (int32 GlobalJ = UnionMin.Y; GlobalJ < UnionMax.Y; GlobalJ += FVisionUnitData::BitsPerWord)
 		{
-#if DO_GUARD_SLOW
-			int SafetyIterations = VisionUnitData.LocalAreaTilesCachedStates.Num();
-			TArray<bool> IsTileVisited;
-			IsTileVisited.Init(false, VisionUnitData.LocalAreaTilesCachedStates.Num());
-#endif
+			const int32 NumColumns = FMath::Min<int32>(FVisionUnitData::BitsPerWord, UnionMax.Y - GlobalJ);
+			const uint32 PreviousBits = ReadFootprintRowBits(PreviousVisionUnitData, GlobalI, GlobalJ, NumColumns);
+			const uint32 CurrentBits = ReadFootprintRowBits(VisionUnitData, GlobalI, GlobalJ, NumColumns);
+			const uint32 ChangedBits = PreviousBits ^ CurrentBits;
+			if (ChangedBits == 0)
+			{
+				continue;
+			}
 
-			enum class EDirection { Right, Up, Left, Down };
-			const FIntPoint DirectionDeltas[] = { {0, 1}, {1, 0}, {0, -1}, {-1, 0} };
+			for (uint32 Bits = ChangedBits & CurrentBits; Bits != 0; Bits &= Bits - 1)
+			{
+				FogOfWar->IncrementVisibilityCounter(VisionUnitData.TeamIndex, { GlobalI, GlobalJ + static_cast<int32>(FMath::CountTrailingZeros(Bits)) }, bAtomic);
+			}
+			for (uint32 Bits = ChangedBits & PreviousBits; Bits != 0; Bits &= Bits - 1)
+			{
+				FogOfWar->DecrementVisibilityCounter(PreviousVisionUnitData.TeamIndex, { GlobalI, GlobalJ + static_cast<int32>(FMath::CountTrailingZeros(Bits)) }, bAtomic);
+			}
+		}
+	}
+}
+
+void FFogOfWarMassHelpers::RebuildCountersFromFootprints(AFogOfWar* FogOfWar, TConstArrayView<const FVisionUnitData*> Footprints, bool bParallel)
+{
+	FFogOfWarTeamVisibility& TeamVisibility = FogOfWar->TeamVisibility;
+	const FIntPoint GridResolution = TeamVisibility.GetGridResolution();
+	TeamVisibility.ClearCounters();
 
-			EDirection CurrentDirection = EDirection::Right;
-			bool Clock = true;
-			int CurrentStepSize = VisionUnitData.LocalAreaTilesResolution;
-			int LeftToSpend = CurrentStepSize;
-			FIntPoint CurrentLocalIJ = FIntPoint(0, 0) - DirectionDeltas[static_cast<int>(CurrentDirection)];
+	// (chunk index, footprint index) pairs, sorted so every chunk becomes one contiguous range owned by one task
+	TArray<uint64> ChunkFootprints;
+	ChunkFootprints.Reserve(Footprints.Num() * 4);
+	for (int32 FootprintIndex = 0; FootprintIndex < Footprints.Num(); FootprintIndex++)
+	{
+		const FVisionUnitData& Footprint = *Footprints[FootprintIndex];
+		const FIntPoint MinIJ = Footprint.LocalAreaCachedMinIJ.ComponentMax(FIntPoint::ZeroValue);
+		const FIntPoint MaxIJ = (Footprint.LocalAreaCachedMinIJ + FIntPoint(Footprint.LocalAreaTilesResolution)).ComponentMin(GridResolution) - FIntPoint(1);
+		if (MinIJ.X > MaxIJ.X || MinIJ.Y > MaxIJ.Y)
+		{
+			continue;
+		}
 
-			while (true)
+		for (int32 ChunkI = MinIJ.X >> FFogOfWarTileLayout::ChunkSizeLog2; ChunkI <= MaxIJ.X >> FFogOfWarTileLayout::ChunkSizeLog2; ChunkI++)
+		{
+			for (int32 ChunkJ = MinIJ.Y >> FFogOfWarTileLayout::ChunkSizeLog2; ChunkJ <= MaxIJ.Y >> FFogOfWarTileLayout::ChunkSizeLog2; ChunkJ++)
 			{
-				checkSlow(LeftToSpend > 0);
-				CurrentLocalIJ += DirectionDeltas[static_cast<int>(CurrentDirection)];
-				LeftToSpend--;
+				const int32 ChunkIndex = TeamVisibility.GetChunkIndex(FIntPoint(ChunkI, ChunkJ) * FFogOfWarTileLayout::ChunkSize);
+				TeamVisibility.ReserveChunk(Footprint.TeamIndex, ChunkIndex);
+				ChunkFootprints.Add((static_cast<uint64>(ChunkIndex) << 32) | static_cast<uint32>(FootprintIndex));
+			}
+		}
+	}
+	Algo::Sort(ChunkFootprints);
 
+	TArray<int32> ChunkRangeStarts;
+	for (int32 Index = 0; Index < ChunkFootprints.Num(); Index++)
+	{
+		if (Index == 0 || (ChunkFootprints[Index] >> 32) != (ChunkFootprints[Index - 1] >> 32))
+		{
+			ChunkRangeStarts.Add(Index);
+		}
+	}
+	const int32 NumChunkRanges = ChunkRangeStarts.Num();
+	ChunkRangeStarts.Add(ChunkFootprints.Num());
+
+	ParallelFor(TEXT("FogOfWar.RebuildCounters"), NumChunkRanges, 1, [&](int32 RangeIndex)
+	{
+		const int32 ChunkIndex = static_cast<int32>(ChunkFootprints[ChunkRangeStarts[RangeIndex]] >> 32);
+		const FIntRect ChunkTileRect = TeamVisibility.GetChunkTileRect(ChunkIndex);
+
+		for (int32 Index = ChunkRangeStarts[RangeIndex]; Index < ChunkRangeStarts[RangeIndex + 1]; Index++)
+		{
+			const FVisionUnitData& Footprint = *Footprints[static_cast<int32>(ChunkFootprints[Index] & MAX_uint32)];
+			const FIntPoint MinIJ = ChunkTileRect.Min.ComponentMax(Footprint.LocalAreaCachedMinIJ);
+			const FIntPoint MaxIJ = ChunkTileRect.Max.ComponentMin(Footprint.LocalAreaCachedMinIJ + FIntPoint(Footprint.LocalAreaTilesResolution));
+
+			for (int32 GlobalI = MinIJ.X; GlobalI < MaxIJ.X; GlobalI++)
+			{
+				for (int32 GlobalJ = MinIJ.Y; GlobalJ < MaxIJ.Y; GlobalJ += FVisionUnitData::BitsPerWord)
 				{
-					checkSlow(VisionUnitData.IsLocalIJValid(CurrentLocalIJ));
+					const int32 NumColumns = FMath::Min<int32>(FVisionUnitData::BitsPerWord, MaxIJ.Y - GlobalJ);
+					for (uint32 Bits = ReadFootprintRowBits(Footprint, GlobalI, GlobalJ, NumColumns); Bits != 0; Bits &= Bits - 1)
+					{
+						TeamVisibility.IncrementInOwnedChunk(Footprint.TeamIndex, ChunkIndex, { GlobalI, GlobalJ + static_cast<int32>(FMath::CountTrailingZeros(Bits)) });
+					}
+				}
+			}
+		}
+	}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+void FFogOfWarMassHelpers::ComputeVisibilityDDA(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData)
+{
+	const float GridSpaceRadiusSqr = FMath::Square(VisionUnitData.GridSpaceRadius);
+
+	// going in spiral
+#if DO_GUARD_SLOW
+	int SafetyIterations = VisionUnitData.GetNumLocalTiles();
+	TArray<bool> IsTileVisited;
+	IsTileVisited.Init(false, VisionUnitData.GetNumLocalTiles());
+#endif
+
+	enum class EDirection { Right, Up, Left, Down };
+	const FIntPoint DirectionDeltas[] = { {0, 1}, {1, 0}, {0, -1}, {-1, 0} };
+
+	EDirection CurrentDirection = EDirection::Right;
+	bool Clock = true;
+	int CurrentStepSize = VisionUnitData.LocalAreaTilesResolution;
+	int LeftToSpend = CurrentStepSize;
+	FIntPoint CurrentLocalIJ = FIntPoint(0, 0) - DirectionDeltas[static_cast<int>(CurrentDirection)];
+
+	while (true)
+	{
+		checkSlow(LeftToSpend > 0);
+		CurrentLocalIJ += DirectionDeltas[static_cast<int>(CurrentDirection)];
+		LeftToSpend--;
+
+		{
+			checkSlow(VisionUnitData.IsLocalIJValid(CurrentLocalIJ));
 
 #if DO_GUARD_SLOW
-						SafetyIterations--;
-						IsTileVisited[VisionUnitData.GetLocalIndex(CurrentLocalIJ)] = true;
+				SafetyIterations--;
+				IsTileVisited[VisionUnitData.GetLocalIndex(CurrentLocalIJ)] = true;
 #endif
 
-					const FIntPoint GlobalIJ = VisionUnitData.LocalToGlobal(CurrentLocalIJ);
+			const FIntPoint GlobalIJ = VisionUnitData.LocalToGlobal(CurrentLocalIJ);
 
-					if (UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
+			if (UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
+			{
+				const int32 DistToTileSqr = FMath::Square(CurrentLocalIJ.X - OriginLocalIJ.X) + FMath::Square(CurrentLocalIJ.Y - OriginLocalIJ.Y);
+				if (DistToTileSqr <= GridSpaceRadiusSqr)
+				{
+					TArray<int> CurrentDDALocalIndexesStack;
+					int LocalIndex = VisionUnitData.GetLocalIndex(CurrentLocalIJ);
+					if (VisionUnitData.GetLocalTileState(LocalIndex) == ETileState::Unknown)
 					{
-						int DistToTileSqr = FMath::Square(OriginGlobalIJ.X - GlobalIJ.X) + FMath::Square(OriginGlobalIJ.Y - GlobalIJ.Y);
-						if (DistToTileSqr <= GridSpaceRadiusSqr)
+						const FIntPoint Direction = OriginLocalIJ - CurrentLocalIJ;
+						checkSlow(FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) != 0);
+						const FIntPoint DirectionSign = { Direction.X >= 0 ? 1 : -1, Direction.Y >= 0 ? 1 : -1 };
+						const float S_x = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.Y) / Direction.X));
+						const float S_y = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.X) / Direction.Y));
+						float NextAccumulatedDxLength = 0.5 * S_x;
+						float NextAccumulatedDyLength = 0.5 * S_y;
+
+						bool bIsBlocking = false;
+						const int DDASafetyIterations = FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + 1;
+						checkSlow(DDASafetyIterations < 10000);
+						int DDASafetyCounter;
+
+						FIntPoint CurrentDDALocalIJ = CurrentLocalIJ;
+						int CurrentDDALocalIndex = LocalIndex;
+
+						for (DDASafetyCounter = 0; DDASafetyCounter < DDASafetyIterations; DDASafetyCounter++)
 						{
-							TArray<int> CurrentDDALocalIndexesStack;
-							int LocalIndex = VisionUnitData.GetLocalIndex(CurrentLocalIJ);
-							if (VisionUnitData.GetLocalTileState(LocalIndex) == ETileState::Unknown)
+							CurrentDDALocalIndexesStack.Push(CurrentDDALocalIndex);
+							if (CurrentDDALocalIJ == OriginLocalIJ) break;
+
+							auto CurrentHeight = FogOfWar->GetTileHeight(VisionUnitData.LocalToGlobal(CurrentDDALocalIJ));
+							if (FogOfWar->IsBlockingVision(ObserverHeight, CurrentHeight))
+							{
+								bIsBlocking = true;
+								break;
+							}
+
+							if (NextAccumulatedDxLength < NextAccumulatedDyLength)
 							{
-								const FIntPoint Direction = OriginLocalIJ - CurrentLocalIJ;
-								checkSlow(FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) != 0);
-								const FIntPoint DirectionSign = { Direction.X >= 0 ? 1 : -1, Direction.Y >= 0 ? 1 : -1 };
-								const float S_x = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.Y) / Direction.X));
-								const float S_y = FMath::Sqrt(FMath::Square(1.0) + FMath::Square(static_cast<float>(Direction.X) / Direction.Y));
-								float NextAccumulatedDxLength = 0.5 * S_x;
-								float NextAccumulatedDyLength = 0.5 * S_y;
-
-								bool bIsBlocking = false;
-								const int DDASafetyIterations = FMath::Abs(Direction.X) + FMath::Abs(Direction.Y) + 1;
-								checkSlow(DDASafetyIterations < 10000);
-								int DDASafetyCounter;
-
-								FIntPoint CurrentDDALocalIJ = CurrentLocalIJ;
-								int CurrentDDALocalIndex = LocalIndex;
-
-								for (DDASafetyCounter = 0; DDASafetyCounter < DDASafetyIterations; DDASafetyCounter++)
-								{
-									CurrentDDALocalIndexesStack.Push(CurrentDDALocalIndex);
-									if (CurrentDDALocalIJ == OriginLocalIJ) break;
-
-									auto CurrentHeight = FogOfWar->GetGlobalTile(VisionUnitData.LocalToGlobal(CurrentDDALocalIJ)).Height;
-									if (FogOfWar->IsBlockingVision(Location.Z, CurrentHeight))
-									{
-										bIsBlocking = true;
-										break;
-									}
-
-									if (NextAccumulatedDxLength < NextAccumulatedDyLength)
-									{
-										NextAccumulatedDxLength += S_x;
-										CurrentDDALocalIJ.X += DirectionSign.X;
-									}
-									else
-									{
-										NextAccumulatedDyLength += S_y;
-										CurrentDDALocalIJ.Y += DirectionSign.Y;
-									}
-									checkSlow(VisionUnitData.IsLocalIJValid(CurrentDDALocalIJ));
-									checkSlow(UMinimapDataSubsystem::IsVisionGridIJValid_Static(VisionUnitData.LocalToGlobal(CurrentDDALocalIJ)));
-									CurrentDDALocalIndex = VisionUnitData.GetLocalIndex(CurrentDDALocalIJ);
-								}
-								checkSlow(DDASafetyCounter < DDASafetyIterations);
-
-								if (bIsBlocking)
-								{
-									while (!CurrentDDALocalIndexesStack.IsEmpty())
-									{
-										int LocalIndexFromStack = CurrentDDALocalIndexesStack.Pop(EAllowShrinking::No);
-										auto& TileState = VisionUnitData.GetLocalTileState(LocalIndexFromStack);
-										if (TileState != ETileState::Visible) TileState = ETileState::NotVisible;
-									}
-								}
-								else
-								{
-									while (!CurrentDDALocalIndexesStack.IsEmpty())
-									{
-										int LocalIndexFromStack = CurrentDDALocalIndexesStack.Pop(EAllowShrinking::No);
-										VisionUnitData.GetLocalTileState(LocalIndexFromStack) = ETileState::Visible;
-									}
-								}
+								NextAccumulatedDxLength += S_x;
+								CurrentDDALocalIJ.X += DirectionSign.X;
 							}
-							checkSlow(VisionUnitData.GetLocalTileState(CurrentLocalIJ) != ETileState::Unknown);
+							else
+							{
+								NextAccumulatedDyLength += S_y;
+								CurrentDDALocalIJ.Y += DirectionSign.Y;
+							}
+							checkSlow(VisionUnitData.IsLocalIJValid(CurrentDDALocalIJ));
+							checkSlow(UMinimapDataSubsystem::IsVisionGridIJValid_Static(VisionUnitData.LocalToGlobal(CurrentDDALocalIJ)));
+							CurrentDDALocalIndex = VisionUnitData.GetLocalIndex(CurrentDDALocalIJ);
 						}
-					}
-				}
+						checkSlow(DDASafetyCounter < DDASafetyIterations);
 
-				if (LeftToSpend == 0)
-				{
-					if (Clock)
-					{
-						if (CurrentStepSize == 1) break;
-						CurrentStepSize--;
+						if (bIsBlocking)
+						{
+							while (!CurrentDDALocalIndexesStack.IsEmpty())
+							{
+								int LocalIndexFromStack = CurrentDDALocalIndexesStack.Pop(EAllowShrinking::No);
+								auto& TileState = VisionUnitData.GetLocalTileState(LocalIndexFromStack);
+								if (TileState != ETileState::Visible) TileState = ETileState::NotVisible;
+							}
+						}
+						else
+						{
+							while (!CurrentDDALocalIndexesStack.IsEmpty())
+							{
+								int LocalIndexFromStack = CurrentDDALocalIndexesStack.Pop(EAllowShrinking::No);
+								VisionUnitData.GetLocalTileState(LocalIndexFromStack) = ETileState::Visible;
+							}
+						}
 					}
-					Clock ^= 1;
-					CurrentDirection = static_cast<EDirection>((static_cast<int>(CurrentDirection) + 1) % 4);
-					LeftToSpend = CurrentStepSize;
+					checkSlow(VisionUnitData.GetLocalTileState(CurrentLocalIJ) != ETileState::Unknown);
 				}
 			}
+		}
+
+		if (LeftToSpend == 0)
+		{
+			if (Clock)
+			{
+				if (CurrentStepSize == 1) break;
+				CurrentStepSize--;
+			}
+			Clock ^= 1;
+			CurrentDirection = static_cast<EDirection>((static_cast<int>(CurrentDirection) + 1) % 4);
+			LeftToSpend = CurrentStepSize;
+		}
+	}
 
 #if DO_GUARD_SLOW
-			check(SafetyIterations == 0);
-			for (auto bVisited : IsTileVisited) check(bVisited);
+	check(SafetyIterations == 0);
+	for (auto bVisited : IsTileVisited) check(bVisited);
 #endif
-		}
+}
+void FFogOfWarMassHelpers::ComputeVisibilityShadowcasting(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData)
+{
+	// Symmetric shadowcasting: each quadrant is scanned row by row moving away from the origin.
+	// A row is the set of tiles at the same depth between a start and an end slope; blocking tiles
+	// narrow the slopes of the following rows, so every tile of the disc is visited exactly once.
+	// Slopes are kept as exact fractions (Numerator / Denominator) to make the result symmetric.
+	struct FRow
+	{
+		int32 Depth;
+		int64 StartSlopeNumerator;
+		int64 StartSlopeDenominator;
+		int64 EndSlopeNumerator;
+		int64 EndSlopeDenominator;
+	};
+
+	const auto FloorDiv = [](int64 A, int64 B) -> int64
+	{
+		checkSlow(B > 0);
+		return A >= 0 ? A / B : -((-A + B - 1) / B);
+	};
 
-		for (int I = 0; I < VisionUnitData.LocalAreaTilesResolution; I++)
+	const float GridSpaceRadiusSqr = FMath::Square(VisionUnitData.GridSpaceRadius);
+	const int32 MaxDepth = FMath::FloorToInt32(VisionUnitData.GridSpaceRadius);
+
+	// quadrant basis: GlobalIJ = Origin + Depth * Forward + Column * Side
+	const FIntPoint Forwards[] = { {1, 0}, {0, 1}, {-1, 0}, {0, -1} };
+	const FIntPoint Sides[] = { {0, 1}, {1, 0}, {0, 1}, {1, 0} };
+
+	enum class ECellKind { None, Floor, Wall };
+
+	TArray<FRow, TInlineAllocator<64>> RowsStack;
+
+	for (int32 Quadrant = 0; Quadrant < 4; Quadrant++)
+	{
+		const FIntPoint Forward = Forwards[Quadrant];
+		const FIntPoint Side = Sides[Quadrant];
+
+		const auto ClassifyAndReveal = [&](int32 Depth, int32 Column, bool bReveal) -> ECellKind
 		{
-			for (int J = 0; J < VisionUnitData.LocalAreaTilesResolution; J++)
+			const FIntPoint Offset = Forward * Depth + Side * Column;
+			const FIntPoint GlobalIJ = OriginGlobalIJ + Offset;
+			if (!UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
 			{
-				const FIntPoint GlobalIJ = VisionUnitData.LocalToGlobal({ I, J });
-				if (UMinimapDataSubsystem::IsVisionGridIJValid_Static(GlobalIJ))
+				// the grid is a rectangle, so tiles outside of it can never shadow tiles inside of it
+				return ECellKind::Floor;
+			}
+
+			const FIntPoint LocalIJ = OriginLocalIJ + Offset;
+			checkSlow(VisionUnitData.IsLocalIJValid(LocalIJ));
+
+			// same semantics as the DDA kernel: a blocking tile hides itself as well as everything behind it
+			if (FogOfWar->IsBlockingVision(ObserverHeight, FogOfWar->GetTileHeight(GlobalIJ)))
+			{
+				return ECellKind::Wall;
+			}
+
+			if (bReveal && FMath::Square(Offset.X) + FMath::Square(Offset.Y) <= GridSpaceRadiusSqr)
+			{
+				VisionUnitData.GetLocalTileState(LocalIJ) = ETileState::Visible;
+			}
+			return ECellKind::Floor;
+		};
+
+		RowsStack.Reset();
+		RowsStack.Push({ 1, -1, 1, 1, 1 });
+
+		while (!RowsStack.IsEmpty())
+		{
+			FRow Row = RowsStack.Pop(EAllowShrinking::No);
+			if (Row.Depth > MaxDepth)
+			{
+				continue;
+			}
+
+			// MinColumn = round_ties_up(Depth * StartSlope), MaxColumn = round_ties_down(Depth * EndSlope)
+			const int64 MinColumn = FloorDiv(2 * Row.Depth * Row.StartSlopeNumerator + Row.StartSlopeDenominator, 2 * Row.StartSlopeDenominator);
+			const int64 MaxColumn = -FloorDiv(-(2 * Row.Depth * Row.EndSlopeNumerator - Row.EndSlopeDenominator), 2 * Row.EndSlopeDenominator);
+
+			ECellKind PreviousKind = ECellKind::None;
+			for (int64 Column = MinColumn; Column <= MaxColumn; Column++)
+			{
+				// a floor tile is revealed only if its center lies inside the row's slopes, which is what makes the algorithm symmetric
+				const bool bIsSymmetric =
+					Column * Row.StartSlopeDenominator >= Row.Depth * Row.StartSlopeNumerator &&
+					Column * Row.EndSlopeDenominator <= Row.Depth * Row.EndSlopeNumerator;
+
+				const ECellKind Kind = ClassifyAndReveal(Row.Depth, static_cast<int32>(Column), bIsSymmetric);
+
+				// slope of the tile's left edge: (2 * Column - 1) / (2 * Depth)
+				if (PreviousKind == ECellKind::Wall && Kind == ECellKind::Floor)
 				{
-					int DistToTileSqr = FMath::Square(OriginGlobalIJ.X - GlobalIJ.X) + FMath::Square(OriginGlobalIJ.Y - GlobalIJ.Y);
-					if (DistToTileSqr <= GridSpaceRadiusSqr)
-					{
-						if (VisionUnitData.GetLocalTileState({ I, J }) == ETileState::Visible)
-						{
-							FTile& GlobalTile = FogOfWar->GetGlobalTile(GlobalIJ);
-							GlobalTile.VisibilityCounter++;
-						}
-					}
+					Row.StartSlopeNumerator = 2 * Column - 1;
+					Row.StartSlopeDenominator = 2 * Row.Depth;
+				}
+				if (PreviousKind == ECellKind::Floor && Kind == ECellKind::Wall)
+				{
+					RowsStack.Push({ Row.Depth + 1, Row.StartSlopeNumerator, Row.StartSlopeDenominator, 2 * Column - 1, 2 * static_cast<int64>(Row.Depth) });
 				}
+				PreviousKind = Kind;
+			}
+
+			if (PreviousKind == ECellKind::Floor)
+			{
+				RowsStack.Push({ Row.Depth + 1, Row.StartSlopeNumerator, Row.StartSlopeDenominator, Row.EndSlopeNumerator, Row.EndSlopeDenominator });
 			}
 		}
+	}
+}
 
-		VisionUnitData.bHasCachedData = true;
-		PreviousVisionFragment.PreviousVisionData = MoveTemp(VisionUnitData);
+void FFogOfWarMassHelpers::ComputeVisibilityRayTable(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData)
+{
+	const FVisionRayTable& RayTable = FogOfWar->GetOrBuildRayTable(VisionUnitData.GridSpaceRadius, VisionUnitData.LocalAreaTilesResolution);
+	const TArray<FVisionRayTarget>* Targets = RayTable.FindSpiralOrder(OriginLocalIJ);
+	if (!Targets)
+	{
+		// the origin landed on an unexpected local coordinate (float rounding at tile borders), no table for it
+		ComputeVisibilityDDA(FogOfWar, ObserverHeight, OriginGlobalIJ, OriginLocalIJ, VisionUnitData);
+		return;
+	}
+
+	const FVisionRayNode* Nodes = RayTable.Nodes.GetData();
+	const int32 OriginLocalIndex = VisionUnitData.GetLocalIndex(OriginLocalIJ);
+
+	for (const FVisionRayTarget& Target : *Targets)
+	{
+		if (!UMinimapDataSubsystem::IsVisionGridIJValid_Static(OriginGlobalIJ + Target.Offset))
+		{
+			continue;
+		}
+
+		const FVisionRayNode& TargetNode = Nodes[Target.NodeIndex];
+		if (VisionUnitData.GetLocalTileState(OriginLocalIndex + TargetNode.LocalIndexDelta) != ETileState::Unknown)
+		{
+			continue;
+		}
+
+		// walk from the target towards the origin until the first blocking tile
+		int32 BlockingNodeIndex = INDEX_NONE;
+		for (int32 NodeIndex = Target.NodeIndex; NodeIndex != FVisionRayTable::RootNodeIndex; NodeIndex = Nodes[NodeIndex].Parent)
+		{
+			if (FogOfWar->IsBlockingVision(ObserverHeight, FogOfWar->GetTileHeight(OriginGlobalIJ + Nodes[NodeIndex].Offset)))
+			{
+				BlockingNodeIndex = NodeIndex;
+				break;
+			}
+		}
+
+		if (BlockingNodeIndex != INDEX_NONE)
+		{
+			for (int32 NodeIndex = Target.NodeIndex; ; NodeIndex = Nodes[NodeIndex].Parent)
+			{
+				ETileState& TileState = VisionUnitData.GetLocalTileState(OriginLocalIndex + Nodes[NodeIndex].LocalIndexDelta);
+				if (TileState != ETileState::Visible) TileState = ETileState::NotVisible;
+				if (NodeIndex == BlockingNodeIndex) break;
+			}
+		}
+		else
+		{
+			for (int32 NodeIndex = Target.NodeIndex; NodeIndex != INDEX_NONE; NodeIndex = Nodes[NodeIndex].Parent)
+			{
+				VisionUnitData.GetLocalTileState(OriginLocalIndex + Nodes[NodeIndex].LocalIndexDelta) = ETileState::Visible;
+			}
+		}
 	}
 }
 
 //----------------------------------------------------------------------//
 //  UInitialVisionProcessor
 //----------------------------------------------------------------------//
+DECLARE_DWORD_COUNTER_STAT(TEXT("Initial vision computes"), STAT_FogOfWarInitialVisionComputes, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Initial vision pending"), STAT_FogOfWarInitialVisionPending, STATGROUP_FogOfWar);
+
 UInitialVisionProcessor::UInitialVisionProcessor()
 	: EntityQuery(*this)
 {
@@ -263,37 +731,120 @@ void UInitialVisionProcessor::ConfigureQueries(const TSharedRef<FMassEntityManag
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddTagRequirement<FMassVisionEntityTag>(EMassFragmentPresence::All);
 	EntityQuery.AddTagRequirement<FMassVisionInitializedTag>(EMassFragmentPresence::None); // Run only on uninitialized entities
 }
 
 void UInitialVisionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	/*if (!FogOfWarActor.Get())
+	if (!FogOfWarActor.Get())
 	{
 		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
 	}
-	if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated() || !UMinimapDataSubsystem::Get() || !UMinimapDataSubsystem::Get()->bIsInitialized)
+	if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated() || !UMinimapDataSubsystem::Get())
 	{
 		return;
 	}
 
-	EntityQuery.ForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+	AFogOfWar* FogOfWar = FogOfWarActor.Get();
+
+	// fragment memory does not move until the deferred commands are flushed, so the work items can point into the chunks
+	const uint32 CurrentFrame = static_cast<uint32>(GFrameCounter);
+	PendingEntities.Reset();
+	EntityQuery.ForEachEntityChunk(Context, [this, CurrentFrame](FMassExecutionContext& Context)
 	{
-		const auto& Entities = Context.GetEntities();
-		for (const FMassEntityHandle& Entity : Entities)
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
+		const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+		const TArrayView<FMassFogOfWarDirtyFragment> DirtyList = Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>();
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
-			Context.Defer().AddTag<FMassVisionInitializedTag>(Entity);
+			// the first frame the entity is seen counts as its spawn frame
+			if (DirtyList[EntityIndex].VisionDirtyFrame == FMassFogOfWarDirtyFragment::UnstampedFrame)
+			{
+				DirtyList[EntityIndex].VisionDirtyFrame = CurrentFrame;
+			}
+			PendingEntities.Add({
+				.Entity = Context.GetEntity(EntityIndex),
+				.Location = TransformList[EntityIndex].GetTransform().GetLocation(),
+				.Vision = &VisionList[EntityIndex],
+				.CachedVisionData = &PreviousVisionList[EntityIndex].PreviousVisionData,
+				.Dirty = &DirtyList[EntityIndex],
+			});
 		}
-	});*/
-}
+	});
+
+	if (PendingEntities.IsEmpty())
+	{
+		BudgetPerFrame = 0;
+		return;
+	}
+
+	// Units whose InitialVisionAmortizationFrames are up go first whatever their distance, so every unit is finished
+	// within that many frames of its spawn. The budget only grows while a backlog exists, which spreads a burst evenly
+	// instead of leaving most of it to its deadline frame.
+	const int32 AmortizationFrames = FMath::Max(FogOfWar->InitialVisionAmortizationFrames, 1);
+	const int32 NumDue = Algo::Partition(PendingEntities.GetData(), PendingEntities.Num(), [CurrentFrame, AmortizationFrames](const FPendingEntity& Pending)
+	{
+		return CurrentFrame - Pending.Dirty->VisionDirtyFrame + 1 >= static_cast<uint32>(AmortizationFrames);
+	});
+	BudgetPerFrame = FMath::Max(BudgetPerFrame, FMath::DivideAndRoundUp(PendingEntities.Num(), AmortizationFrames));
+	const int32 NumToProcess = FMath::Clamp(BudgetPerFrame, NumDue, PendingEntities.Num());
 
+	if (NumToProcess > NumDue && NumToProcess < PendingEntities.Num())
+	{
+		TArray<FVector, TInlineAllocator<4>> ViewLocations;
+		FFogOfWarMassHelpers::GetLocalViewLocations(GetWorld(), ViewLocations);
+		if (!ViewLocations.IsEmpty())
+		{
+			const TArrayView<FPendingEntity> NotDue = MakeArrayView(PendingEntities.GetData() + NumDue, PendingEntities.Num() - NumDue);
+			Algo::SortBy(NotDue, [&ViewLocations](const FPendingEntity& Pending) { return FFogOfWarMassHelpers::GetDistanceToNearestView(Pending.Location, ViewLocations); });
+		}
+	}
+
+	const TArrayView<FPendingEntity> Batch = MakeArrayView(PendingEntities.GetData(), NumToProcess);
+	const bool bParallel = Batch.Num() > 1;
+	ParallelFor(TEXT("FogOfWar.InitialVision"), Batch.Num(), FogOfWar->ParallelVisionMinBatchSize, [FogOfWar, &Batch, bParallel](int32 BatchIndex)
+	{
+		FPendingEntity& Pending = Batch[BatchIndex];
+		FFogOfWarMassHelpers::UpdateEntityVision(FogOfWar, Pending.Location, *Pending.Vision, *Pending.CachedVisionData, bParallel);
+		// the footprint was computed at the current location, a move observed in the meantime is already covered
+		EnumRemoveFlags(Pending.Dirty->Flags, EFogOfWarDirtyFlags::Vision);
+	}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	// one batched command moves every initialized entity out of this query
+	InitializedEntities.Reset(NumToProcess);
+	for (const FPendingEntity& Pending : Batch)
+	{
+		InitializedEntities.Add(Pending.Entity);
+	}
+	Context.Defer().PushCommand<FMassCommandAddTag<FMassVisionInitializedTag>>(InitializedEntities);
+
+	if (NumToProcess == PendingEntities.Num())
+	{
+		BudgetPerFrame = 0;
+	}
 
+	INC_DWORD_STAT_BY(STAT_FogOfWarInitialVisionComputes, NumToProcess);
+	INC_DWORD_STAT_BY(STAT_FogOfWarInitialVisionPending, PendingEntities.Num() - NumToProcess);
+}
 
 //----------------------------------------------------------------------//
 //  UVisionProcessor
 //----------------------------------------------------------------------//
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision queue processed"), STAT_FogOfWarVisionQueueProcessed, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision queue overdue"), STAT_FogOfWarVisionQueueOverdue, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision queue depth"), STAT_FogOfWarVisionQueueDepth, STATGROUP_FogOfWar);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Vision budget utilization (%)"), STAT_FogOfWarVisionBudgetUtilization, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision full rebuilds"), STAT_FogOfWarVisionFullRebuilds, STATGROUP_FogOfWar);
+DECLARE_FLOAT_ACCUMULATOR_STAT(TEXT("Vision full rebuild threshold (%)"), STAT_FogOfWarVisionFullRebuildThreshold, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision cost probes"), STAT_FogOfWarVisionCostProbes, STATGROUP_FogOfWar);
+
 UVisionProcessor::UVisionProcessor()
 	: EntityQuery(*this)
+	, FootprintQuery(*this)
 {
 	bAutoRegisterWithProcessingPhases = true;
 	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
@@ -305,42 +856,462 @@ void UVisionProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& En
     EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
     EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddTagRequirement<FMassLocationChangedTag>(EMassFragmentPresence::All); // Only process entities that have moved
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.SetChunkFilter([](const FMassExecutionContext& Context) { return FFogOfWarMassHelpers::HasDirtyChunk(Context, EFogOfWarDirtyFlags::Vision); }); // Only process chunks with moved entities
+	EntityQuery.AddTagRequirement<FMassVisionInitializedTag>(EMassFragmentPresence::All); // The first footprint comes from UInitialVisionProcessor
+	EntityQuery.AddTagRequirement<FMassStationaryTag>(EMassFragmentPresence::None); // Handled by UStationaryVisionProcessor
+	// Culled entities are not excluded, they are updated less often (see FFogOfWarMassHelpers::IsVisionUpdateDue)
+	EntityQuery.AddRequirement<FMassRepresentationLODFragment>(EMassFragmentAccess::ReadOnly, EMassFragmentPresence::Optional);
 
-	// --- 核心修复 ---
-	// 只处理未被剔除的实体.
-	// 即：实体不能有“被距离剔除”的Tag，也不能有“被视锥体剔除”的Tag。
-	EntityQuery.AddTagRequirement<FMassVisibilityCulledByDistanceTag>(EMassFragmentPresence::None);
-	EntityQuery.AddTagRequirement<FMassVisibilityCulledByFrustumTag>(EMassFragmentPresence::None);
+	// every footprint that was counted, moving or stationary, initialized this frame or earlier
+	FootprintQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadOnly);
 }
 
 void UVisionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	//if (!FogOfWarActor.Get())
-	//{
-	//	FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
-	//}
-	//if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated() || !UMinimapDataSubsystem::Get() || !UMinimapDataSubsystem::Get()->bIsInitialized)
-	//{
-	//	return;
-	//}
+	if (!FogOfWarActor.Get())
+	{
+		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
+	}
+	if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated() || !UMinimapDataSubsystem::Get())
+	{
+		return;
+	}
+
+	if (FogOfWarActor->VisionBudgetMs > 0.0f)
+	{
+		ExecuteBudgeted(Context, FogOfWarActor.Get());
+		return;
+	}
+
+	if (FogOfWarActor->bAdaptiveFullRebuild)
+	{
+		ExecuteAdaptive(Context, FogOfWarActor.Get());
+		return;
+	}
+
+	ExecuteAll(Context, FogOfWarActor.Get());
+}
+
+void UVisionProcessor::GatherDueEntities(FMassExecutionContext& Context, AFogOfWar* FogOfWar)
+{
+	// the flags are consumed up front, vision updates never set them again
+	PendingEntities.Reset();
+	EntityQuery.ForEachEntityChunk(Context, [this, FogOfWar](FMassExecutionContext& Context)
+	{
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
+		const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+
+		const bool bHasDeferredEntities = FFogOfWarMassHelpers::ForEachDueVisionEntity(Context, FogOfWar, 0,
+			[this, &TransformList, &VisionList, &PreviousVisionList](int32 EntityIndex, FMassFogOfWarDirtyFragment& Dirty, uint32)
+		{
+			EnumRemoveFlags(Dirty.Flags, EFogOfWarDirtyFlags::Vision);
+			PendingEntities.Add({
+				.Location = TransformList[EntityIndex].GetTransform().GetLocation(),
+				.Vision = &VisionList[EntityIndex],
+				.CachedVisionData = &PreviousVisionList[EntityIndex].PreviousVisionData,
+				.Dirty = &Dirty,
+			});
+		});
+		if (!bHasDeferredEntities)
+		{
+			EnumRemoveFlags(Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags, EFogOfWarDirtyFlags::Vision);
+		}
+	});
+}
+
+void UVisionProcessor::ExecuteAll(FMassExecutionContext& Context, AFogOfWar* FogOfWar)
+{
+	// gathered over all chunks first, so many small chunks still fill the workers
+	GatherDueEntities(Context, FogOfWar);
+
+	// 并行模式下，多个工作线程可能同时修改同一瓦片的计数器，因此使用原子操作。
+	// 整数加减满足交换律，所以无论执行顺序如何，最终结果都与串行路径完全一致。
+	const bool bParallel = FogOfWar->bParallelVision && PendingEntities.Num() > 1;
+
+	// 视野计算只读取瓦片高度，每个实体只写入自己的 FMassPreviousVisionFragment，因此可以安全地分发到工作线程。
+	ParallelFor(TEXT("FogOfWar.UpdateVision"), PendingEntities.Num(), FogOfWar->ParallelVisionMinBatchSize, [this, FogOfWar, bParallel](int32 Index)
+	{
+		const FPendingEntity& Pending = PendingEntities[Index];
+		FFogOfWarMassHelpers::UpdateEntityVision(FogOfWar, Pending.Location, *Pending.Vision, *Pending.CachedVisionData, bParallel);
+	}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+}
+
+void UVisionProcessor::ExecuteBudgeted(FMassExecutionContext& Context, AFogOfWar* FogOfWar)
+{
+	const double StartSeconds = FPlatformTime::Seconds();
+	const double BudgetSeconds = FogOfWar->VisionBudgetMs / 1000.0;
+	const uint32 MaxStalenessFrames = static_cast<uint32>(FMath::Max(FogOfWar->MaxVisionStalenessFrames, 1));
+
+	TArray<FVector, TInlineAllocator<4>> ViewLocations;
+	FFogOfWarMassHelpers::GetLocalViewLocations(GetWorld(), ViewLocations);
+
+	// fragment memory does not move until the deferred commands are flushed, so the queue can point into the chunks
+	PendingEntities.Reset();
+	EntityQuery.ForEachEntityChunk(Context, [this, FogOfWar, &ViewLocations, MaxStalenessFrames](FMassExecutionContext& Context)
+	{
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
+		const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+		FMassFogOfWarDirtyChunkFragment& ChunkDirty = Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>();
+
+		const bool bHasDeferredEntities = FFogOfWarMassHelpers::ForEachDueVisionEntity(Context, FogOfWar, MaxStalenessFrames,
+			[this, &TransformList, &VisionList, &PreviousVisionList, &ViewLocations, &ChunkDirty, MaxStalenessFrames](int32 EntityIndex, FMassFogOfWarDirtyFragment& Dirty, uint32 AgeFrames)
+		{
+			const FVector Location = TransformList[EntityIndex].GetTransform().GetLocation();
+			const float SightRadius = FMath::Max(VisionList[EntityIndex].SightRadius, 1.0f);
+			const double ViewDistance = FFogOfWarMassHelpers::GetDistanceToNearestView(Location, ViewLocations);
+
+			PendingEntities.Add({
+				.Location = Location,
+				.Vision = &VisionList[EntityIndex],
+				.CachedVisionData = &PreviousVisionList[EntityIndex].PreviousVisionData,
+				.Dirty = &Dirty,
+				.ChunkDirty = &ChunkDirty,
+				.Priority = static_cast<float>((AgeFrames + 1) * SightRadius / FMath::Max(ViewDistance, static_cast<double>(SightRadius))),
+				.bOverdue = AgeFrames + 1 >= MaxStalenessFrames,
+			});
+		});
+
+		// raised again below for every chunk that keeps entities in the queue
+		if (!bHasDeferredEntities)
+		{
+			EnumRemoveFlags(ChunkDirty.Flags, EFogOfWarDirtyFlags::Vision);
+		}
+	});
+
+	const int32 NumPending = PendingEntities.Num();
+	if (NumPending == 0)
+	{
+		return;
+	}
+
+	// overdue entities first, then by descending priority
+	Algo::Sort(PendingEntities, [](const FPendingEntity& A, const FPendingEntity& B)
+	{
+		return A.bOverdue != B.bOverdue ? A.bOverdue : A.Priority > B.Priority;
+	});
+	const int32 NumOverdue = Algo::CountIf(PendingEntities, [](const FPendingEntity& Pending) { return Pending.bOverdue; });
+
+	const bool bParallel = FogOfWar->bParallelVision;
+	const auto ProcessRange = [this, FogOfWar, bParallel](int32 BeginIndex, int32 Num)
+	{
+		ParallelFor(TEXT("FogOfWar.BudgetedVision"), Num, FogOfWar->ParallelVisionMinBatchSize, [this, FogOfWar, BeginIndex, bParallel](int32 Index)
+		{
+			FPendingEntity& Pending = PendingEntities[BeginIndex + Index];
+			FFogOfWarMassHelpers::UpdateEntityVision(FogOfWar, Pending.Location, *Pending.Vision, *Pending.CachedVisionData, bParallel);
+			EnumRemoveFlags(Pending.Dirty->Flags, EFogOfWarDirtyFlags::Vision);
+		}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+	};
+
+	// the staleness guarantee wins over the budget
+	int32 NumProcessed = 0;
+	if (NumOverdue > 0)
+	{
+		ProcessRange(0, NumOverdue);
+		NumProcessed = NumOverdue;
+	}
+
+	// Process the rest in batches sized by the measured cost per entity, so the budget is checked a few times per
+	// frame instead of once per entity.
+	while (NumProcessed < NumPending)
+	{
+		const double RemainingSeconds = BudgetSeconds - (FPlatformTime::Seconds() - StartSeconds);
+		if (RemainingSeconds <= 0.0)
+		{
+			break;
+		}
+
+		const int32 NumFitting = AverageSecondsPerEntity > 0.0 ? FMath::FloorToInt32(FMath::Min(RemainingSeconds / AverageSecondsPerEntity, static_cast<double>(MAX_int32))) : 1;
+		const int32 BatchSize = FMath::Clamp(NumFitting, 1, NumPending - NumProcessed);
+
+		const double BatchStartSeconds = FPlatformTime::Seconds();
+		ProcessRange(NumProcessed, BatchSize);
+		const double SecondsPerEntity = (FPlatformTime::Seconds() - BatchStartSeconds) / BatchSize;
+		AverageSecondsPerEntity = AverageSecondsPerEntity > 0.0 ? FMath::Lerp(AverageSecondsPerEntity, SecondsPerEntity, 0.25) : SecondsPerEntity;
+
+		NumProcessed += BatchSize;
+	}
+
+	for (int32 Index = NumProcessed; Index < NumPending; Index++)
+	{
+		PendingEntities[Index].ChunkDirty->Flags |= EFogOfWarDirtyFlags::Vision;
+	}
+
+	const double ElapsedSeconds = FPlatformTime::Seconds() - StartSeconds;
+	INC_DWORD_STAT_BY(STAT_FogOfWarVisionQueueProcessed, NumProcessed);
+	INC_DWORD_STAT_BY(STAT_FogOfWarVisionQueueOverdue, NumOverdue);
+	INC_DWORD_STAT_BY(STAT_FogOfWarVisionQueueDepth, NumPending - NumProcessed);
+	INC_FLOAT_STAT_BY(STAT_FogOfWarVisionBudgetUtilization, static_cast<float>(ElapsedSeconds / BudgetSeconds * 100.0));
+}
+
+void UVisionProcessor::ExecuteAdaptive(FMassExecutionContext& Context, AFogOfWar* FogOfWar)
+{
+	// gathered over all chunks so both strategies see the whole frame
+	GatherDueEntities(Context, FogOfWar);
+
+	const int32 NumMoved = PendingEntities.Num();
+	if (NumMoved == 0)
+	{
+		return;
+	}
+
+	// the new footprints are needed by both strategies and never touch the counters
+	const bool bParallel = FogOfWar->bParallelVision && NumMoved > 1;
+	NewFootprints.SetNum(NumMoved);
+	ParallelFor(TEXT("FogOfWar.ComputeFootprints"), NumMoved, FogOfWar->ParallelVisionMinBatchSize, [this, FogOfWar](int32 Index)
+	{
+		const FPendingEntity& Pending = PendingEntities[Index];
+		FFogOfWarMassHelpers::ComputeEntityFootprint(FogOfWar, Pending.Location, *Pending.Vision, NewFootprints[Index]);
+	}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+	// only footprints that are counted take part in a rebuild
+	int32 NumFootprints = 0;
+	FootprintQuery.ForEachEntityChunk(Context, [&NumFootprints](FMassExecutionContext& Context)
+	{
+		NumFootprints += Algo::CountIf(Context.GetFragmentView<FMassPreviousVisionFragment>(), [](const FMassPreviousVisionFragment& PreviousVision)
+		{
+			return PreviousVision.PreviousVisionData.HasCachedData();
+		});
+	});
+
+	// Incremental cost grows with the moved units, rebuild cost with all footprints, so the rebuild wins once
+	// NumMoved / NumFootprints exceeds RebuildCost / IncrementalCost.
+	const double Threshold = AverageSecondsPerIncrementalApply > 0.0 && AverageSecondsPerRebuildFootprint > 0.0
+		? AverageSecondsPerRebuildFootprint / AverageSecondsPerIncrementalApply
+		: FogOfWar->FullRebuildInitialThreshold;
+	SET_FLOAT_STAT(STAT_FogOfWarVisionFullRebuildThreshold, static_cast<float>(Threshold * 100.0));
+
+	// A strategy that is never chosen is never measured, so it runs anyway when its cost is unknown or outdated.
+	// Only near the threshold though: far from it a better estimate would not change the choice, and a probe there
+	// would turn a frame with a few moved units into a full rebuild.
+	const double MovedRatio = NumFootprints > 0 ? static_cast<double>(NumMoved) / NumFootprints : 1.0;
+	const bool bRebuildCheaper = MovedRatio >= Threshold;
+	const double ProbeMargin = FMath::Max(FogOfWar->FullRebuildProbeMargin, 1.0f);
+	const bool bNearThreshold = MovedRatio * ProbeMargin >= Threshold && MovedRatio <= Threshold * ProbeMargin;
+	const uint64 ProbeIntervalFrames = static_cast<uint64>(FMath::Max(FogOfWar->FullRebuildProbeIntervalFrames, 0));
+	const auto NeedsProbe = [ProbeIntervalFrames](double AverageSeconds, uint64 MeasuredFrame)
+	{
+		return AverageSeconds <= 0.0 || (ProbeIntervalFrames > 0 && GFrameCounter - MeasuredFrame >= ProbeIntervalFrames);
+	};
+	const bool bProbe = bNearThreshold && (bRebuildCheaper
+		? NeedsProbe(AverageSecondsPerIncrementalApply, IncrementalApplyMeasuredFrame)
+		: NeedsProbe(AverageSecondsPerRebuildFootprint, RebuildMeasuredFrame));
+	if (bProbe)
+	{
+		INC_DWORD_STAT(STAT_FogOfWarVisionCostProbes);
+	}
+
+	const double StartSeconds = FPlatformTime::Seconds();
+	if (bRebuildCheaper != bProbe)
+	{
+		// the previous footprints are dropped together with the counters they were added to
+		for (int32 Index = 0; Index < NumMoved; Index++)
+		{
+			*PendingEntities[Index].CachedVisionData = MoveTemp(NewFootprints[Index]);
+		}
+
+		RebuildFootprints.Reset(NumFootprints);
+		FootprintQuery.ForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+		{
+			for (const FMassPreviousVisionFragment& PreviousVision : Context.GetFragmentView<FMassPreviousVisionFragment>())
+			{
+				if (PreviousVision.PreviousVisionData.HasCachedData())
+				{
+					RebuildFootprints.Add(&PreviousVision.PreviousVisionData);
+				}
+			}
+		});
+		FFogOfWarMassHelpers::RebuildCountersFromFootprints(FogOfWar, RebuildFootprints, FogOfWar->bParallelVision);
+
+		if (!RebuildFootprints.IsEmpty())
+		{
+			const double SecondsPerFootprint = (FPlatformTime::Seconds() - StartSeconds) / RebuildFootprints.Num();
+			AverageSecondsPerRebuildFootprint = AverageSecondsPerRebuildFootprint > 0.0 ? FMath::Lerp(AverageSecondsPerRebuildFootprint, SecondsPerFootprint, 0.25) : SecondsPerFootprint;
+			RebuildMeasuredFrame = GFrameCounter;
+		}
+		INC_DWORD_STAT(STAT_FogOfWarVisionFullRebuilds);
+	}
+	else
+	{
+		ParallelFor(TEXT("FogOfWar.ApplyFootprints"), NumMoved, FogOfWar->ParallelVisionMinBatchSize, [this, FogOfWar, bParallel](int32 Index)
+		{
+			FFogOfWarMassHelpers::ApplyEntityFootprint(FogOfWar, *PendingEntities[Index].CachedVisionData, MoveTemp(NewFootprints[Index]), bParallel);
+		}, bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+		const double SecondsPerApply = (FPlatformTime::Seconds() - StartSeconds) / NumMoved;
+		AverageSecondsPerIncrementalApply = AverageSecondsPerIncrementalApply > 0.0 ? FMath::Lerp(AverageSecondsPerIncrementalApply, SecondsPerApply, 0.25) : SecondsPerApply;
+		IncrementalApplyMeasuredFrame = GFrameCounter;
+	}
+}
+
+//----------------------------------------------------------------------//
+//  UStationaryVisionProcessor
+//----------------------------------------------------------------------//
+DECLARE_DWORD_COUNTER_STAT(TEXT("Stationary vision recomputes"), STAT_FogOfWarStationaryVisionRecomputes, STATGROUP_FogOfWar);
+
+UStationaryVisionProcessor::UStationaryVisionProcessor()
+	: EntityQuery(*this)
+{
+	bAutoRegisterWithProcessingPhases = true;
+	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
+	ExecutionOrder.ExecuteAfter.Add(UInitialVisionProcessor::StaticClass()->GetFName());
+}
+
+void UStationaryVisionProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	// 建筑的视野必须始终生效，因此这里不按距离或视锥体剔除。
+	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddTagRequirement<FMassStationaryTag>(EMassFragmentPresence::All);
+	EntityQuery.AddTagRequirement<FMassVisionInitializedTag>(EMassFragmentPresence::All);
+}
+
+void UStationaryVisionProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	if (!FogOfWarActor.Get())
+	{
+		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
+		// No footprint was computed against an earlier heightfield yet.
+		SyncedHeightfieldRevision = FogOfWarActor.Get() ? FogOfWarActor->GetHeightfieldRevision() : 0;
+	}
+	if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated() || !UMinimapDataSubsystem::Get())
+	{
+		return;
+	}
+
+	AFogOfWar* FogOfWar = FogOfWarActor.Get();
 
-	//EntityQuery.ForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
-	//{
-	//	FFogOfWarMassHelpers::ProcessEntityChunk(Context, FogOfWarActor.Get());
+	const uint32 HeightfieldRevision = FogOfWar->GetHeightfieldRevision();
+	if (SyncedHeightfieldRevision == HeightfieldRevision)
+	{
+		return;
+	}
+
+	const bool bAllDirty = !FogOfWar->GetHeightfieldChangesSince(SyncedHeightfieldRevision, DirtyTileRects);
+	SyncedHeightfieldRevision = HeightfieldRevision;
+
+	uint32 NumRecomputed = 0;
+	EntityQuery.ForEachEntityChunk(Context, [this, FogOfWar, bAllDirty, &NumRecomputed](FMassExecutionContext& Context)
+	{
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
+		const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FVisionUnitData& CachedVisionData = PreviousVisionList[EntityIndex].PreviousVisionData;
+			if (!CachedVisionData.HasCachedData())
+			{
+				continue;
+			}
+
+			// Only the heights inside the local area affect the footprint.
+			const FIntRect LocalAreaRect(CachedVisionData.LocalAreaCachedMinIJ, CachedVisionData.LocalAreaCachedMinIJ + FIntPoint(CachedVisionData.LocalAreaTilesResolution));
+			const bool bAffected = bAllDirty || DirtyTileRects.ContainsByPredicate([&LocalAreaRect](const FIntRect& DirtyTileRect) { return DirtyTileRect.Intersect(LocalAreaRect); });
+			if (!bAffected)
+			{
+				continue;
+			}
+
+			FFogOfWarMassHelpers::UpdateEntityVision(FogOfWar, TransformList[EntityIndex].GetTransform().GetLocation(), VisionList[EntityIndex], CachedVisionData, false);
+			NumRecomputed++;
+		}
+	});
 
-	//	// Remove location changed tag from all entities in the chunk
-	//	const auto& Entities = Context.GetEntities();
-	//	for (const FMassEntityHandle& Entity : Entities)
-	//	{
-	//		Context.Defer().RemoveTag<FMassLocationChangedTag>(Entity);
-	//	}
-	//});
+	INC_DWORD_STAT_BY(STAT_FogOfWarStationaryVisionRecomputes, NumRecomputed);
+}
+
+//----------------------------------------------------------------------//
+//  UVisionRemoveProcessor
+//----------------------------------------------------------------------//
+UVisionRemoveProcessor::UVisionRemoveProcessor()
+	: EntityQuery(*this)
+{
+	ObservedType = FMassPreviousVisionFragment::StaticStruct();
+	Operation = EMassObservedOperation::Remove;
+	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
+}
+
+void UVisionRemoveProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadWrite);
+}
+
+void UVisionRemoveProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	if (!FogOfWarActor.Get())
+	{
+		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
+	}
+	if (!FogOfWarActor.Get() || !FogOfWarActor->IsActivated())
+	{
+		return;
+	}
+
+	EntityQuery.ForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+	{
+		const TArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetMutableFragmentView<FMassPreviousVisionFragment>();
+		for (FMassPreviousVisionFragment& PreviousVisionFragment : PreviousVisionList)
+		{
+			if (PreviousVisionFragment.PreviousVisionData.HasCachedData())
+			{
+				FFogOfWarMassHelpers::RemoveFootprintFromCounters(FogOfWarActor.Get(), PreviousVisionFragment.PreviousVisionData, false);
+				PreviousVisionFragment.PreviousVisionData.bHasCachedData = false;
+			}
+		}
+	});
+}
+
+//----------------------------------------------------------------------//
+//  UFogOfWarDirtyFlagsAddProcessor
+//----------------------------------------------------------------------//
+UFogOfWarDirtyFlagsAddProcessor::UFogOfWarDirtyFlagsAddProcessor()
+	: EntityQuery(*this)
+{
+	ObservedType = FMassFogOfWarDirtyFragment::StaticStruct();
+	Operation = EMassObservedOperation::Add;
+	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
+}
+
+void UFogOfWarDirtyFlagsAddProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
+{
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
+}
+
+void UFogOfWarDirtyFlagsAddProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
+{
+	EntityQuery.ForEachEntityChunk(Context, [](FMassExecutionContext& Context)
+	{
+		EFogOfWarDirtyFlags ChunkFlags = EFogOfWarDirtyFlags::None;
+		for (const FMassFogOfWarDirtyFragment& Dirty : Context.GetFragmentView<FMassFogOfWarDirtyFragment>())
+		{
+			ChunkFlags |= Dirty.Flags;
+		}
+		Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags |= ChunkFlags;
+	});
 }
 
 //----------------------------------------------------------------------//
 //  UDebugStressTestProcessor
 //----------------------------------------------------------------------//
+namespace
+{
+	TAutoConsoleVariable<int32> CVarFogOfWarDebugStressTest(
+		TEXT("FogOfWar.DebugStressTest"),
+		0,
+		TEXT("Forces fog of war updates for every vision unit each frame, on top of the fog actor's debug settings.\n")
+		TEXT(" 0: off (default)\n")
+		TEXT(" 1: recompute the vision of every moving unit\n")
+		TEXT(" 2: update the minimap cell of every unit\n")
+		TEXT(" 3: both"),
+		ECVF_Cheat);
+}
+
 UDebugStressTestProcessor::UDebugStressTestProcessor()
 	: EntityQuery(*this)
 {
@@ -353,12 +1324,15 @@ UDebugStressTestProcessor::UDebugStressTestProcessor()
 void UDebugStressTestProcessor::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
 {
 	EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
 	EntityQuery.AddTagRequirement<FMassVisionEntityTag>(EMassFragmentPresence::All);
 }
 
 void UDebugStressTestProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	/*if (!FogOfWarActor.Get())
+	const int32 ForcedByCVar = CVarFogOfWarDebugStressTest.GetValueOnGameThread();
+	if (!FogOfWarActor.Get())
 	{
 		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
 	}
@@ -367,28 +1341,43 @@ void UDebugStressTestProcessor::Execute(FMassEntityManager& EntityManager, FMass
 		return;
 	}
 
-	const bool bForceVisionUpdate = FogOfWarActor->bDebugStressTestIgnoreCache;
-	const bool bForceMinimapUpdate = FogOfWarActor->bDebugStressTestMinimap;
-
-	if (!bForceVisionUpdate && !bForceMinimapUpdate)
+	EFogOfWarDirtyFlags ForcedFlags = EFogOfWarDirtyFlags::None;
+	if (FogOfWarActor->bDebugStressTestIgnoreCache || (ForcedByCVar & 1) != 0)
+	{
+		ForcedFlags |= EFogOfWarDirtyFlags::Vision;
+	}
+	if (FogOfWarActor->bDebugStressTestMinimap || (ForcedByCVar & 2) != 0)
+	{
+		ForcedFlags |= EFogOfWarDirtyFlags::MinimapCell;
+	}
+	if (ForcedFlags == EFogOfWarDirtyFlags::None)
 	{
 		return;
 	}
 
-	EntityQuery.ForEachEntityChunk(Context, [this, bForceVisionUpdate, bForceMinimapUpdate](FMassExecutionContext& Context)
+	const uint32 CurrentFrame = static_cast<uint32>(GFrameCounter);
+	EntityQuery.ForEachEntityChunk(Context, [ForcedFlags, CurrentFrame](FMassExecutionContext& Context)
 	{
-		const auto& Entities = Context.GetEntities();
-		for (const FMassEntityHandle& Entity : Entities)
+		// stationary units are only refreshed by terrain changes, nothing would consume their vision flag
+		EFogOfWarDirtyFlags ChunkForcedFlags = ForcedFlags;
+		if (Context.DoesArchetypeHaveTag<FMassStationaryTag>())
 		{
-			if (bForceVisionUpdate)
-			{
-				Context.Defer().AddTag<FMassLocationChangedTag>(Entity);
-			}
-			if (bForceMinimapUpdate)
+			EnumRemoveFlags(ChunkForcedFlags, EFogOfWarDirtyFlags::Vision);
+		}
+		if (ChunkForcedFlags == EFogOfWarDirtyFlags::None)
+		{
+			return;
+		}
+
+		for (FMassFogOfWarDirtyFragment& Dirty : Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>())
+		{
+			// same stamping as UMassLocationChangedObserver, pending entities keep their original frame
+			if (EnumHasAnyFlags(ChunkForcedFlags, EFogOfWarDirtyFlags::Vision) && !EnumHasAnyFlags(Dirty.Flags, EFogOfWarDirtyFlags::Vision))
 			{
-				Context.Defer().AddTag<FMinimapCellChangedTag>(Entity);
+				Dirty.VisionDirtyFrame = CurrentFrame;
 			}
+			Dirty.Flags |= ChunkForcedFlags;
 		}
-	});*/
+		Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags |= ChunkForcedFlags;
+	});
 }
-
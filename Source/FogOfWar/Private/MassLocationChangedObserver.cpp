@@ -4,29 +4,145 @@
 #include "MassCommonFragments.h"
 #include "MassFogOfWarFragments.h"
 #include "MassExecutionContext.h"
+#include "FogOfWar.h"
+#include "MassFogOfWarProcessors.h"
+#include "Subsystems/MinimapDataSubsystem.h"
+#include "Kismet/GameplayStatics.h"
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision recomputes requested"), STAT_FogOfWarVisionRecomputesRequested, STATGROUP_FogOfWar);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Vision recomputes skipped"), STAT_FogOfWarVisionRecomputesSkipped, STATGROUP_FogOfWar);
 
 UMassLocationChangedObserver::UMassLocationChangedObserver()
 	: EntityQuery(*this)
 {
 	bAutoRegisterWithProcessingPhases = true;
 	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
+	// the flags are written in place, so they have to be set before the consumer reads them in the same frame
+	ExecutionOrder.ExecuteBefore.Add(UVisionProcessor::StaticClass()->GetFName());
 }
 
 void UMassLocationChangedObserver::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
 {
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
-	// We only want to add the tag to entities that are actually vision providers.
+	EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassPreviousVisionFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
+	// We only want to flag entities that are actually vision providers.
 	EntityQuery.AddTagRequirement<FMassVisionEntityTag>(EMassFragmentPresence::All);
+	// Stationary entities never move; their footprint is refreshed by UStationaryVisionProcessor instead.
+	EntityQuery.AddTagRequirement<FMassStationaryTag>(EMassFragmentPresence::None);
 }
 
 void UMassLocationChangedObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
 {
-	EntityQuery.ForEachEntityChunk(Context, [this](FMassExecutionContext& Context)
+	if (!FogOfWarActor.Get())
+	{
+		FogOfWarActor = Cast<AFogOfWar>(UGameplayStatics::GetActorOfClass(GetWorld(), AFogOfWar::StaticClass()));
+		SyncedHeightfieldRevision = FogOfWarActor.Get() ? FogOfWarActor->GetHeightfieldRevision() : 0;
+	}
+
+	// Without an active fog actor or grid there is nothing to compare against, so every entity is flagged as before.
+	const AFogOfWar* FogOfWar = FogOfWarActor.Get();
+	const bool bCanGate = FogOfWar && FogOfWar->IsActivated() && UMinimapDataSubsystem::Get() && !FogOfWar->bDebugStressTestIgnoreCache;
+
+	// Units standing still keep their footprint, so heightfield changes under them (runtime rescans,
+	// regions coming online during an amortized height scan) must be picked up here.
+	DirtyTileRects.Reset();
+	bAllHeightfieldDirty = false;
+	if (bCanGate && FogOfWar->GetHeightfieldRevision() != SyncedHeightfieldRevision)
 	{
-		const TArrayView<const FMassEntityHandle> Entities = Context.GetEntities();
-		for (const FMassEntityHandle& Entity : Entities)
+		bAllHeightfieldDirty = !FogOfWar->GetHeightfieldChangesSince(SyncedHeightfieldRevision, DirtyTileRects);
+		SyncedHeightfieldRevision = FogOfWar->GetHeightfieldRevision();
+	}
+
+	uint32 NumRequested = 0;
+	uint32 NumSkipped = 0;
+
+	EntityQuery.ForEachEntityChunk(Context, [this, FogOfWar, bCanGate, &NumRequested, &NumSkipped](FMassExecutionContext& Context)
+	{
+		const TConstArrayView<FTransformFragment> TransformList = Context.GetFragmentView<FTransformFragment>();
+		const TConstArrayView<FMassVisionFragment> VisionList = Context.GetFragmentView<FMassVisionFragment>();
+		const TConstArrayView<FMassPreviousVisionFragment> PreviousVisionList = Context.GetFragmentView<FMassPreviousVisionFragment>();
+		const TArrayView<FMassFogOfWarDirtyFragment> DirtyList = Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>();
+		const float VisionTileSize = bCanGate ? UMinimapDataSubsystem::Get()->VisionTileSize : 0.0f;
+		bool bChunkDirty = false;
+
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
 		{
-			Context.Defer().AddTag<FMassLocationChangedTag>(Entity);
+			// still pending from spawn or from a frame where the entity was culled; the entity may have
+			// changed archetype since, so the chunk flag is raised again below
+			if (EnumHasAnyFlags(DirtyList[EntityIndex].Flags, EFogOfWarDirtyFlags::Vision))
+			{
+				bChunkDirty = true;
+				continue;
+			}
+
+			if (bCanGate && !CanVisionChange(*FogOfWar, VisionTileSize, TransformList[EntityIndex].GetTransform().GetLocation(), VisionList[EntityIndex], PreviousVisionList[EntityIndex].PreviousVisionData)
+				&& !IsAffectedByHeightfieldChange(PreviousVisionList[EntityIndex].PreviousVisionData))
+			{
+				NumSkipped++;
+				continue;
+			}
+
+			NumRequested++;
+			DirtyList[EntityIndex].Flags |= EFogOfWarDirtyFlags::Vision;
+			DirtyList[EntityIndex].VisionDirtyFrame = static_cast<uint32>(GFrameCounter);
+			bChunkDirty = true;
+		}
+
+		if (bChunkDirty)
+		{
+			Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags |= EFogOfWarDirtyFlags::Vision;
 		}
 	});
+
+	INC_DWORD_STAT_BY(STAT_FogOfWarVisionRecomputesRequested, NumRequested);
+	INC_DWORD_STAT_BY(STAT_FogOfWarVisionRecomputesSkipped, NumSkipped);
+	TotalVisionRecomputesRequested += NumRequested;
+	TotalVisionRecomputesSkipped += NumSkipped;
+}
+
+bool UMassLocationChangedObserver::IsAffectedByHeightfieldChange(const FVisionUnitData& CachedVisionData) const
+{
+	if (bAllHeightfieldDirty)
+	{
+		return true;
+	}
+
+	const FIntRect LocalAreaRect(CachedVisionData.LocalAreaCachedMinIJ, CachedVisionData.LocalAreaCachedMinIJ + FIntPoint(CachedVisionData.LocalAreaTilesResolution));
+	return DirtyTileRects.ContainsByPredicate([&LocalAreaRect](const FIntRect& DirtyTileRect) { return DirtyTileRect.Intersect(LocalAreaRect); });
+}
+
+bool UMassLocationChangedObserver::CanVisionChange(const AFogOfWar& FogOfWar, float VisionTileSize, const FVector& Location, const FMassVisionFragment& Vision, const FVisionUnitData& CachedVisionData)
+{
+	if (!CachedVisionData.HasCachedData())
+	{
+		return true;
+	}
+
+	// The footprint only depends on the origin tile, the local area placement (the spiral order of the DDA kernels),
+	// the sight radius and the observer height. Sub-tile movement that keeps all of them unchanged yields the same result.
+	// The height is only compared by bucket, so a positive VisionHeightBucketSize accepts footprints up to one bucket stale.
+	const float GridSpaceRadius = Vision.SightRadius / VisionTileSize;
+	if (GridSpaceRadius != CachedVisionData.GridSpaceRadius || Vision.TeamIndex != CachedVisionData.TeamIndex)
+	{
+		return true;
+	}
+
+	const FVector2f OriginGridLocation = UMinimapDataSubsystem::ConvertWorldSpaceLocationToVisionGridSpace_Static(FVector2D(Location));
+	const FIntPoint OriginGlobalIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation);
+	if (!UMinimapDataSubsystem::IsVisionGridIJValid_Static(OriginGlobalIJ) ||
+		UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(OriginGlobalIJ) != CachedVisionData.CachedOriginGlobalIndex)
+	{
+		return true;
+	}
+
+	const FIntPoint LocalAreaMinIJ = UMinimapDataSubsystem::ConvertVisionGridLocationToTileIJ_Static(OriginGridLocation - GridSpaceRadius);
+	if (LocalAreaMinIJ != CachedVisionData.LocalAreaCachedMinIJ)
+	{
+		return true;
+	}
+
+	return !FogOfWar.IsSameVisionHeightBucket(Location.Z, CachedVisionData.CachedObserverHeight);
 }
@@ -2,6 +2,7 @@
 
 #include "MassMinimapProcessors.h"
 #include "MassFogOfWarFragments.h"
+#include "MassFogOfWarProcessors.h"
 #include "Subsystems/MinimapDataSubsystem.h"
 #include "MassCommonFragments.h"
 #include "Kismet/GameplayStatics.h"
@@ -134,7 +135,9 @@ void UMinimapUpdateProcessor::ConfigureQueries(const TSharedRef<FMassEntityManag
 	EntityQuery.AddRequirement<FMassMinimapRepresentationFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassVisionFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassPreviousMinimapCellFragment>(EMassFragmentAccess::ReadWrite);
-	EntityQuery.AddTagRequirement<FMinimapCellChangedTag>(EMassFragmentPresence::All);
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.SetChunkFilter([](const FMassExecutionContext& Context) { return FFogOfWarMassHelpers::HasDirtyChunk(Context, EFogOfWarDirtyFlags::MinimapCell); });
 }
 
 void UMinimapUpdateProcessor::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
@@ -217,11 +220,11 @@ void UMinimapUpdateProcessor::Execute(FMassEntityManager& EntityManager, FMassEx
 		// 	}
 		// }
 
-		// // Consume the tag now that the update is processed.
-		// const TArrayView<const FMassEntityHandle> Entities = Context.GetEntities();
-		// for (const FMassEntityHandle& Entity : Entities)
-		// {
-		// 	Context.Defer().RemoveTag<FMinimapCellChangedTag>(Entity);
-		// }
+		// Consume the flags now that the update is processed.
+		for (FMassFogOfWarDirtyFragment& Dirty : Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>())
+		{
+			EnumRemoveFlags(Dirty.Flags, EFogOfWarDirtyFlags::MinimapCell);
+		}
+		EnumRemoveFlags(Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags, EFogOfWarDirtyFlags::MinimapCell);
 	});
 }
\ No newline at end of file
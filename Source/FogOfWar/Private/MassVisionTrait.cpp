@@ -8,15 +8,22 @@ void UMassVisionTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildConte
 {
 	BuildContext.AddFragment_GetRef<FMassPreviousVisionFragment>();
 
+	// 单位诞生时所有变化标志都已置位，以便更新器在第一帧处理它
+	BuildContext.AddFragment<FMassFogOfWarDirtyFragment>();
+	BuildContext.AddChunkFragment<FMassFogOfWarDirtyChunkFragment>();
+
 	// 根据配置添加视野相关的Fragment和Tag
 	if (SightRadius > 0.0f)
 	{
 		BuildContext.AddTag<FMassVisionEntityTag>();
 		FMassVisionFragment& VisionFragment = BuildContext.AddFragment_GetRef<FMassVisionFragment>();
 		VisionFragment.SightRadius = SightRadius;
+		VisionFragment.TeamIndex = TeamIndex;
 
-		// 【核心修改】单位诞生时，即标记为“已改变”，以便更新器在第一帧处理它
-		BuildContext.AddTag<FMassLocationChangedTag>();
+		if (bStationary)
+		{
+			BuildContext.AddTag<FMassStationaryTag>();
+		}
 	}
 
 	// 根据配置添加小地图表示相关的Fragment和Tag
@@ -28,9 +35,6 @@ void UMassVisionTrait::BuildTemplate(FMassEntityTemplateBuildContext& BuildConte
 		
 		BuildContext.AddFragment<FMassPreviousMinimapCellFragment>(); // Add fragment for the observer
 
-		// 【核心修改】单位诞生时，即标记为“已改变”，以便更新器在第一帧处理它
-		BuildContext.AddTag<FMinimapCellChangedTag>();
-
 		if (bAlwaysVisibleOnMinimap)
 		{
 			BuildContext.AddTag<FMassMinimapVisibleTag>();
@@ -5,12 +5,14 @@
 #include "MassCommonFragments.h"
 #include "MassFogOfWarFragments.h"
 #include "MassExecutionContext.h"
+#include "MassMinimapProcessors.h"
 
 UMinimapCellObserver::UMinimapCellObserver()
 	: EntityQuery(*this)
 {
 	bAutoRegisterWithProcessingPhases = true;
 	ExecutionFlags = (int32)EProcessorExecutionFlags::All;
+	ExecutionOrder.ExecuteBefore.Add(UMinimapUpdateProcessor::StaticClass()->GetFName());
 }
 
 void UMinimapCellObserver::ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager)
@@ -18,6 +20,9 @@ void UMinimapCellObserver::ConfigureQueries(const TSharedRef<FMassEntityManager>
 	EntityQuery.AddRequirement<FTransformFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassPreviousMinimapCellFragment>(EMassFragmentAccess::ReadOnly);
 	EntityQuery.AddRequirement<FMassMinimapRepresentationFragment>(EMassFragmentAccess::ReadOnly);
+	EntityQuery.AddRequirement<FMassFogOfWarDirtyFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddChunkRequirement<FMassFogOfWarDirtyChunkFragment>(EMassFragmentAccess::ReadWrite);
+	EntityQuery.AddTagRequirement<FMassStationaryTag>(EMassFragmentPresence::None); // Stationary entities never change cell
 }
 
 void UMinimapCellObserver::Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context)
@@ -32,6 +37,8 @@ void UMinimapCellObserver::Execute(FMassEntityManager& EntityManager, FMassExecu
 	{
 		const TConstArrayView<FTransformFragment> LocationList = Context.GetFragmentView<FTransformFragment>();
 		const TConstArrayView<FMassPreviousMinimapCellFragment> PrevCellList = Context.GetFragmentView<FMassPreviousMinimapCellFragment>();
+		const TArrayView<FMassFogOfWarDirtyFragment> DirtyList = Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>();
+		bool bChunkDirty = false;
 
 		for (int32 i = 0; i < Context.GetNumEntities(); ++i)
 		{
@@ -42,8 +49,14 @@ void UMinimapCellObserver::Execute(FMassEntityManager& EntityManager, FMassExecu
 
 			if (CurrentMinimapTileIJ != PrevCellCoords)
 			{
-				Context.Defer().AddTag<FMinimapCellChangedTag>(Context.GetEntity(i));
+				DirtyList[i].Flags |= EFogOfWarDirtyFlags::MinimapCell;
 			}
+			bChunkDirty |= EnumHasAnyFlags(DirtyList[i].Flags, EFogOfWarDirtyFlags::MinimapCell);
+		}
+
+		if (bChunkDirty)
+		{
+			Context.GetMutableChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags |= EFogOfWarDirtyFlags::MinimapCell;
 		}
 	});
 }
@@ -11,6 +11,10 @@
 #include "MassRepresentationProcessor.h" // For UMassVisibilityProcessor
 #include "MassLODFragments.h" // For LOD culling tags
 #include "Subsystems/MinimapDataSubsystem.h"
+#include "FogOfWarRayTable.h"
+#include "FogOfWarFootprintCache.h"
+#include "FogOfWarTeamVisibility.h"
+#include "FogOfWarTileGrid.h"
 #include "FogOfWar.generated.h"
 
 /// @file FogOfWar.h
@@ -21,40 +25,83 @@ class UBrushComponent;
 class UTexture2D;
 class UTextureRenderTarget2D;
 class AVolume;
+class UFogOfWarHeightfieldAsset;
 
 /// 声明一个全局的日志分类，用于本模块的日志输出
 DECLARE_LOG_CATEGORY_EXTERN(LogFogOfWar, Log, All)
 
+/// 声明本模块的统计分组，所有战争迷雾相关的性能计数器都归入此分组（stat FogOfWar）
+DECLARE_STATS_GROUP(TEXT("FogOfWar"), STATGROUP_FogOfWar, STATCAT_Advanced);
+
+
 /**
- * @struct FTile
- * @brief 代表战争迷雾网格中的单个瓦片（单元格）。
- * @details 存储了每个网格单元的核心数据。
+ * @enum EFogOfWarVisionKernel
+ * @brief 视野计算所使用的算法（内核）。
  */
-USTRUCT()
-struct FOGOFWAR_API FTile
+UENUM()
+enum class EFogOfWarVisionKernel : uint8
 {
-	GENERATED_BODY()
+	/// @brief 螺旋遍历局部区域，从每个未知瓦片向原点发射一条DDA射线。开销约为O(R^3)。
+	DDA,
+	/// @brief 对称阴影投射（Symmetric Shadowcasting），按象限逐行扫描，每个瓦片只访问一次。开销约为O(R^2)，适用于视野半径很大的单位。
+	Shadowcasting,
+	/// @brief 与DDA结果逐位一致，但射线路径来自按视野半径预计算并共享的查找表，内循环只剩高度比较。
+	PrecomputedDDA
+};
 
-	/// @brief 瓦片中心点的地形高度（Z轴坐标）。
-	/// @details 在初始化时通过射线检测计算得出，用于后续的视野遮挡判断。
-	UPROPERTY()
-	float Height = 0.0f;
+/**
+ * @enum EFogOfWarFootprintUpdateMode
+ * @brief 单位移动后，如何把新视野应用到全局可见性计数上。
+ */
+UENUM()
+enum class EFogOfWarFootprintUpdateMode : uint8
+{
+	/// @brief 先擦除旧视野的全部瓦片，再应用新视野的全部瓦片。
+	EraseAndApply,
+	/// @brief 将新旧视野按位异或，只更新状态真正发生变化的瓦片。结果与EraseAndApply完全一致。
+	Delta
+};
 
-	/// @brief 瓦片的可见性计数器。
-	/// @details 每当有一个视野单位能看到此瓦片时，此计数器加1；当单位移开视野时，减1。
-	/// 只要此值大于0，该瓦片就被认为是当前可见的。这种机制允许多个单位同时观察同一区域。
-	UPROPERTY()
-	int VisibilityCounter = 0;
+/**
+ * @enum EFogOfWarHeightScanMode
+ * @brief 激活时扫描地形高度的方式。
+ */
+UENUM()
+enum class EFogOfWarHeightScanMode : uint8
+{
+	/// @brief 在激活时一次性扫描完整个网格。射线检测按行分发到所有工作线程，但激活会阻塞直到扫描完成。
+	Blocking,
+	/// @brief 每帧并行扫描 HeightScanRowsPerTick 行，游戏在扫描期间继续运行，迷雾按区域逐步生效。
+	/// 尚未扫描的瓦片视为不遮挡视线。
+	Amortized
+};
+
+/**
+ * @enum EFogOfWarRenderMode
+ * @brief 是否创建迷雾的渲染管线。
+ */
+UENUM()
+enum class EFogOfWarRenderMode : uint8
+{
+	/// @brief 专用服务器或无法渲染（例如 -nullrhi）时使用 DataOnly，否则使用 Render。
+	Auto,
+	/// @brief 创建快照纹理、渲染目标和后期处理材质，每帧更新迷雾画面。
+	Render,
+	/// @brief 只维护瓦片高度、可见性计数和查询接口，不分配任何纹理，也不做任何逐帧的纹理工作。
+	DataOnly
 };
 
+/// @brief 地形高度扫描进度的回调，Progress范围为[0, 1]。
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FOnFogOfWarHeightScanProgress, float, Progress);
 
 /**
  * @class AFogOfWar
  * @brief 战争迷雾系统的核心管理器Actor。
  * @details 这是一个应在场景中全局唯一的Actor，负责管理整个战争迷雾系统的所有数据和操作。
  * 主要职责包括：
- * 1. 管理一个二维的FTile网格，存储地形高度和可见性状态。
+ * 1. 管理一个二维的瓦片网格，分别存储地形高度和可见性状态。
  * 2. 提供接口（UpdateVisibilities, ResetCachedVisibilities）给Mass Processors，以响应单位的移动和生成/销毁。
+ *    可见性按队伍分别计数，同盟之间的视野通过队伍位掩码合并。
  * 3. 执行核心的视野计算，使用DDA（数字微分分析器）算法进行高效的视线检查。
  * 4. 管理一个复杂的渲染管线，通过一系列RT（Render Target）和材质，生成最终平滑、带渐隐效果的战争迷雾纹理。
  * 5. 通过后期处理（Post-Process）将战争迷雾效果应用到游戏屏幕上。
@@ -65,6 +112,10 @@ class FOGOFWAR_API AFogOfWar : public AActor
 	GENERATED_BODY()
 
 public:
+	/// @brief 每个轴上支持的最大瓦片数。瓦片索引使用64位计算，视野内的距离只在局部区域坐标中计算，因此真正的限制来自块表和内存。
+	/// 渲染模式下还受最大纹理尺寸限制（通常为16384）。
+	static constexpr int32 MaxGridResolution = 1 << 16;
+
 	AFogOfWar();
 
 public:
@@ -79,6 +130,61 @@ public:
 	UFUNCTION(BlueprintCallable)
 	bool IsLocationVisible(FVector WorldLocation);
 
+	/**
+	 * @brief       检查指定的世界坐标点对某个队伍（及其同盟）当前是否可见。
+	 * @details     只读取上一次 Tick 中刷新过的队伍位掩码，不会刷新计数，因此可以在任意时刻调用，
+	 *              但本帧视野处理器写入的变化要到下一次 Tick 之后才能查询到。
+	 * @param       WorldLocation                  数据类型: FVector
+	 * @details     要检查的点的世界坐标。
+	 * @param       TeamIndex                      数据类型: int32
+	 * @details     观察者队伍的索引，范围为[0, FogOfWarMaxTeams)。
+	 * @return      bool
+	 */
+	bool IsLocationVisible(FVector WorldLocation, int32 TeamIndex) const;
+
+	/// @brief IsLocationVisible(FVector, int32) 的蓝图版本。
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar|Teams")
+	bool IsLocationVisibleForTeam(FVector WorldLocation, int32 TeamIndex) { return IsLocationVisible(WorldLocation, TeamIndex); }
+
+	/**
+	 * @brief       检查指定的世界坐标点是否曾被本地队伍（及其同盟）探索过。
+	 * @details     与 IsLocationVisible 不同，已探索状态是持久的：瓦片一旦被看到过就一直保持已探索。
+	 */
+	UFUNCTION(BlueprintCallable)
+	bool IsLocationExplored(FVector WorldLocation);
+
+	/**
+	 * @brief       检查指定的世界坐标点是否曾被某个队伍（或其同盟）探索过。
+	 * @param       WorldLocation                  数据类型: FVector
+	 * @details     要检查的点的世界坐标。
+	 * @param       TeamIndex                      数据类型: int32
+	 * @details     观察者队伍的索引，范围为[0, FogOfWarMaxTeams)。
+	 * @return      bool
+	 */
+	bool IsLocationExplored(FVector WorldLocation, int32 TeamIndex) const;
+
+	/// @brief IsLocationExplored(FVector, int32) 的蓝图版本。
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar|Teams")
+	bool IsLocationExploredForTeam(FVector WorldLocation, int32 TeamIndex) const { return IsLocationExplored(WorldLocation, TeamIndex); }
+
+	/// @brief 清除某个队伍的已探索记录。
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar|Teams")
+	void ResetExplored(int32 TeamIndex);
+
+	/**
+	 * @brief       获取已探索区域纹理。每个像素对应一个瓦片，本地队伍或其同盟曾经看到过的瓦片为1，否则为0。
+	 * @details     可在后期处理或小地图材质中与可见性纹理组合，实现“黑幕/已探索/可见”三种状态。
+	 */
+	UFUNCTION(BlueprintPure)
+	UTexture2D* GetExploredTexture() const { return ExploredTexture; }
+
+	/**
+	 * @brief       根据 FTeamRelationshipResolver 重新计算每个队伍的同盟掩码。
+	 * @details     在激活时自动调用。运行时结盟或解除同盟后（或重新绑定 IsAllyDelegate 后）需要手动调用。
+	 */
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar|Teams")
+	void RefreshAllyMasks();
+
 	/**
 	 * @brief       获取最终生成的、可用于UI或后期处理的战争迷雾纹理。
 	 * @details     此纹理是经过了插值、超采样和平滑处理后的最终结果。
@@ -104,6 +210,12 @@ public:
 	UFUNCTION(BlueprintCallable)
 	void Activate();
 
+	/**
+	 * @brief       创建瓦片网格、可见性计数和渲染管线，但不注册到GameManager，也不启用Tick。
+	 * @details     由Activate调用；LogRenderModeComparison生成的临时副本只调用这一步，因此不会替换场景中正在使用的迷雾。
+	 */
+	void ActivateWithoutRegistering();
+
 	/**
 	 * @brief       检查战争迷雾系统当前是否已激活。
 	 * @return      bool
@@ -112,6 +224,70 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "FogOfWar")
 	bool IsActivated() const { return bActivated; }
 
+	/**
+	 * @brief       获取地形高度扫描的进度。
+	 * @return      float
+	 * @retval      [0, 1]之间的值，1表示所有瓦片的高度都已扫描完成。
+	 */
+	UFUNCTION(BlueprintPure, Category = "FogOfWar")
+	float GetHeightScanProgress() const { return GridResolution.X > 0 ? static_cast<float>(HeightScanNextRow) / GridResolution.X : 0.0f; }
+
+	/// @brief 检查地形高度扫描是否已完成。
+	UFUNCTION(BlueprintPure, Category = "FogOfWar")
+	bool IsHeightScanComplete() const { return bActivated && HeightScanNextRow >= GridResolution.X; }
+
+	/// @brief 检查是否以不创建渲染管线的纯数据模式运行（激活后有效）。
+	UFUNCTION(BlueprintPure, Category = "FogOfWar")
+	bool IsDataOnly() const { return bDataOnly; }
+
+	/**
+	 * @brief       将战争迷雾各部分的内存占用与平均Tick耗时输出到日志。
+	 * @details     包括瓦片网格的常驻块与虚拟块数量、队伍可见性计数、视野缓存和渲染管线的纹理，便于确认内存与活动区域成正比，
+	 *              以及比较渲染模式与纯数据模式的开销。也可以通过控制台命令 FogOfWar.Report 调用。
+	 */
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar")
+	void LogMemoryReport() const;
+
+	/**
+	 * @brief       用同一份固定负载分别在渲染模式和纯数据模式下运行，并把两者的平均Tick耗时与内存占用并排输出到日志。
+	 * @details     以本Actor为模板生成两个不注册的临时副本分别运行，不会改动本Actor的状态。负载是NumUnits个沿固定路线移动的圆形视野，
+	 *              每帧先擦除再写入计数，然后执行一次Tick；第一帧只用于预热，不计入耗时。只统计游戏线程的耗时，不包括渲染线程和GPU。
+	 *              需要本Actor已激活，并且当前进程可以渲染。也可以通过控制台命令 FogOfWar.CompareRenderModes 调用。
+	 * @param       NumFrames                      数据类型: int32
+	 * @details     每种模式计入耗时的帧数。
+	 * @param       NumUnits                       数据类型: int32
+	 * @details     负载中移动的视野数量。
+	 */
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar")
+	void LogRenderModeComparison(int32 NumFrames = 120, int32 NumUnits = 256);
+
+	/// @brief 渲染管线所有纹理与渲染目标的估计内存（字节）。纯数据模式下为0。
+	SIZE_T GetRenderResourcesSize() const;
+
+	/**
+	 * @brief       在一个 Size x Size 的临时网格上，于远角瓦片 (Size-1, Size-1) 依次用每种视野内核计算并应用一个视野，检查结果。
+	 * @details     检查计数与队伍掩码、视野缓存的命中（第二次计算必须命中第一次写入的条目且不改变计数）、全局索引，
+	 *              以及可以渲染时快照纹理在远角的纹素。检查期间 UMinimapDataSubsystem 的视野网格临时指向测试网格，结束后恢复；
+	 *              临时Actor不注册到GameManager。由控制台命令 FogOfWar.ValidateGridResolution 调用。
+	 * @param       World                          数据类型: UWorld*
+	 * @details     用于生成临时Actor的世界，需要已创建 UMinimapDataSubsystem。
+	 * @param       Size                           数据类型: int32
+	 * @details     测试网格每个轴上的瓦片数量。
+	 * @return      bool
+	 * @retval      true 如果所有检查都通过。
+	 */
+	static bool ValidateFarCornerVision(UWorld* World, int32 Size);
+
+	/**
+	 * @brief       重新扫描指定区域内瓦片的地形高度。
+	 * @details     在运行时放置或摧毁建筑、地形变形后调用。发生变化的瓦片区域会被记录下来，
+	 *              依赖地形高度的视野缓存（例如静止单位的视野）会据此重新计算。
+	 * @param       WorldBounds                    数据类型: FBox
+	 * @details     需要重新扫描的世界空间范围，只使用其XY分量。
+	 */
+	UFUNCTION(BlueprintCallable, Category = "FogOfWar")
+	void RefreshHeightfieldRegion(FBox WorldBounds);
+
 	/**
 	 * @brief       获取网格瓦片的大小。
 	 * @return      float
@@ -126,6 +302,31 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadOnly)
 	TEnumAsByte<ECollisionChannel> HeightScanCollisionChannel = ECC_Camera;
 
+	/// @brief 本地图地形高度的下限。高度扫描的射线在这里结束，瓦片高度按[MinTerrainHeight, MaxTerrainHeight]量化为int16。
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	float MinTerrainHeight = -10000.0f;
+
+	/// @brief 本地图地形高度的上限。高度扫描的射线从这里开始。范围越小，量化后的高度越精确。
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	float MaxTerrainHeight = 10000.0f;
+
+	/// @brief 离线烘焙的地形高度。设置且与当前网格布局一致时，激活时直接加载它而不做射线扫描。
+	/// 在编辑器中点击RefreshVolume会重新烘焙该资产。
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "FogOfWar|Performance")
+	TObjectPtr<UFogOfWarHeightfieldAsset> BakedHeightfield = nullptr;
+
+	/// @brief 激活时扫描地形高度的方式。
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "FogOfWar|Performance")
+	EFogOfWarHeightScanMode HeightScanMode = EFogOfWarHeightScanMode::Blocking;
+
+	/// @brief Amortized模式下每帧扫描的网格行数。每一行的射线检测由一个工作线程任务完成。
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "HeightScanMode == EFogOfWarHeightScanMode::Amortized"))
+	int32 HeightScanRowsPerTick = 64;
+
+	/// @brief 地形高度扫描每推进一批时广播，扫描完成时Progress为1。
+	UPROPERTY(BlueprintAssignable, Category = "FogOfWar")
+	FOnFogOfWarHeightScanProgress OnHeightScanProgress;
+
 	/// @brief 用于应用战争迷雾效果的后期处理组件。
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
 	TObjectPtr<UPostProcessComponent> PostProcess;
@@ -154,6 +355,17 @@ public:
 	UPROPERTY(EditAnywhere, meta = (ClampMin = 0.0f, UIMin = 0.0f))
 	float ApproximateSecondsToAbsorbNewSnapshot = 0.1f;
 
+	/// @brief 是否创建迷雾的渲染管线。
+	/// @details 专用服务器需要权威的可见性（用于网络相关性和防作弊的目标选择），但从不渲染，纯数据模式下不分配任何纹理。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	EFogOfWarRenderMode RenderMode = EFogOfWarRenderMode::Auto;
+
+	/// @brief 迷雾静止时是否跳过渲染管线。
+	/// @details 快照不再变化、且插值已经收敛（剩余差值小于R8渲染目标的半个量化步长）后，插值、最小可见度截断和超采样三个阶段
+	/// 的输出都不会再变化，因此直接跳过，直到下一次快照变化。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bSkipPipelineWhenIdle = true;
+
 	/// @brief 最小可见度阈值。
 	/// @details 在纹理中，任何低于此值的像素将被视为完全不可见（0）。用于消除插值产生的微弱“鬼影”。
 	UPROPERTY(EditAnywhere, meta = (ClampMin = 0.0f, UIMin = 0.0f, ClampMax = 1.0f, UIMax = 1.0f))
@@ -164,10 +376,130 @@ public:
 	UPROPERTY(EditAnywhere, meta = (ClampMin = 0.0f, UIMin = 0.0f, ClampMax = 1.0f, UIMax = 1.0f))
 	float NotVisibleRegionBrightness = 0.1f;
 
+	/// @brief 本地玩家所在的队伍。迷雾纹理显示该队伍及其同盟的视野。
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "FogOfWar|Teams", meta = (ClampMin = 0, ClampMax = 7, UIMin = 0, UIMax = 7))
+	int32 LocalTeamIndex = 0;
+
+	/// @brief 视野计算所使用的算法。
+	/// @details 三种算法产出相同结构的视野缓存（FVisionUnitData）。DDA为默认实现；PrecomputedDDA与DDA结果逐位一致，
+	/// 但射线路径取自按视野半径共享的查找表，适用于大量单位共用少数几种视野半径的场景，每种半径的表在首次使用时构建并常驻内存；
+	/// 对于视野半径很大的单位（如瞭望塔、空中侦察），Shadowcasting要快得多，但遮挡边缘与DDA不完全相同。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	EFogOfWarVisionKernel VisionKernel = EFogOfWarVisionKernel::DDA;
+
+	/// @brief 单位移动后更新全局可见性计数的方式。
+	/// @details Delta模式只写入新旧视野之间发生变化的瓦片，对缓慢移动的单位可显著减少全局写入和缓存未命中。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	EFogOfWarFootprintUpdateMode FootprintUpdateMode = EFogOfWarFootprintUpdateMode::Delta;
+
+	/// @brief 观察者高度的分桶大小（厘米），用于判断单位移动后视野是否可能改变。
+	/// @details 只有当单位所在的视野瓦片、局部区域或高度分桶发生变化时才重新计算视野。为0时要求高度完全相同，此时跳过的重算结果必然不变。
+	/// 大于0时这是一种有意的近似：遮挡判断（IsBlockingVision）使用精确的观察者高度，而单位在同一分桶内最多可以上下移动
+	/// 不到 VisionHeightBucketSize 而不触发重算，因此高度差与 VisionBlockingDeltaHeightThreshold 相差不到这么多的瓦片，
+	/// 其可见性可能保持旧值，直到单位离开该瓦片、局部区域或分桶，或其局部区域内的地形发生变化。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 0.0f, UIMin = 0.0f))
+	float VisionHeightBucketSize = 0.0f;
+
+	/// @brief 是否缓存并复用已计算的视野位集。
+	/// @details 视野结果只取决于原点瓦片、高度分桶和视野半径，站在相同瓦片上的单位（编队、巡逻路线、隘口）可以直接复用。
+	/// 同一高度分桶内的观察者共享同一份结果，因此 VisionHeightBucketSize 为0时缓存不生效；启用缓存需要同时设置分桶大小并接受其近似误差。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bUseFootprintCache = false;
+
+	/// @brief 视野位集缓存的最大条目数。超过后淘汰近期未被访问的条目。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bUseFootprintCache"))
+	int32 FootprintCacheMaxEntries = 4096;
+
+	/// @brief 是否启用多线程视野计算。
+	/// @details 开启后，视野处理器会将实体分发到工作线程并行计算视野，瓦片计数器通过原子操作更新。
+	/// 由于计数器的增减满足交换律，结果与串行路径逐位一致。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bParallelVision = false;
+
+	/// @brief 并行视野计算时，每个工作线程任务至少处理的实体数量。
+	/// @details 值越小，负载越均衡，但任务调度开销越大。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1))
+	int32 ParallelVisionMinBatchSize = 16;
+
+	/// @brief 新生成单位的首次视野计算分摊到的最大帧数。
+	/// @details 为1时同一帧生成的所有单位在当帧完成首次视野计算。大于1时，每个单位最多在其生成后的这么多帧内完成，
+	/// 未到期限的单位中离本地玩家视点最近的优先。首次视野计算总是并行执行，不受 bParallelVision 影响。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1))
+	int32 InitialVisionAmortizationFrames = 1;
+
+	/// @brief 是否按实体的Mass LOD（FMassRepresentationLODFragment）降低移动单位的视野更新频率。
+	/// @details 开启后，被剔除的单位不再冻结视野，而是至少按Low级别的周期继续更新；没有LOD Fragment的单位按High处理。
+	/// 同一周期内的单位按实体索引错开到不同的帧更新。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bVisionLOD = true;
+
+	/// @brief High LOD单位的视野更新周期（帧）。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bVisionLOD"))
+	int32 VisionUpdatePeriodHigh = 1;
+
+	/// @brief Medium LOD单位的视野更新周期（帧）。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bVisionLOD"))
+	int32 VisionUpdatePeriodMedium = 4;
+
+	/// @brief Low LOD单位（以及被距离或视锥体剔除的单位）的视野更新周期（帧）。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bVisionLOD"))
+	int32 VisionUpdatePeriodLow = 16;
+
+	/// @brief Off LOD单位的视野更新周期（帧）。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "bVisionLOD"))
+	int32 VisionUpdatePeriodOff = 16;
+
+	/// @brief 每帧用于移动单位视野更新的时间预算（毫秒）。为0时不限制，所有移动单位在当帧更新。
+	/// @details 大于0时，待更新的单位按优先级（靠近本地玩家视点、视野半径大、等待时间长）排队，超出预算的单位推迟到后续帧。
+	/// 使用 stat FogOfWar 中的队列深度与预算利用率调整此值。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 0.0f, UIMin = 0.0f, Units = "ms"))
+	float VisionBudgetMs = 0.0f;
+
+	/// @brief 启用时间预算时，单位视野更新最多被推迟的帧数。达到此值的单位无论预算是否用尽都会在当帧更新。
+	/// @details 这一上限同样优先于 bVisionLOD：即使LOD的更新周期更长，等待达到此值的单位也会在当帧更新。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1, UIMin = 1, EditCondition = "VisionBudgetMs > 0"))
+	int32 MaxVisionStalenessFrames = 8;
+
+	/// @brief 大部分单位在同一帧移动时，是否改为清空可见性计数后从所有单位的视野位集整体重建。
+	/// @details 逐个单位擦除旧视野、写入新视野时，每个单位都要分散地写两遍全局计数器。整体重建则按计数块并行累加，
+	/// 每个块只由一个线程写入，不需要原子操作。移动单位占全部视野单位的比例超过阈值时使用整体重建，
+	/// 阈值由两种方式实测的耗时自动调整。启用 VisionBudgetMs 时不生效。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bAdaptiveFullRebuild = true;
+
+	/// @brief 两种方式都实测过耗时之前，触发整体重建的移动单位比例。
+	/// @details 尚未测得的方式只在移动比例接近阈值（见 FullRebuildProbeMargin）时被探测，此前一直使用此值。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 0.0f, ClampMax = 1.0f, UIMin = 0.0f, UIMax = 1.0f, EditCondition = "bAdaptiveFullRebuild"))
+	float FullRebuildInitialThreshold = 0.5f;
+
+	/// @brief 一种方式的耗时超过这么多帧没有实测时，即使另一种方式更便宜也执行它一次以更新估计。为0时只在尚未测得时探测。
+	/// @details 只按估计选择时，从未被选中的方式永远测不到耗时，阈值也就无法随单位数量的变化调整。
+	/// 探测只在移动比例接近阈值时进行（见 FullRebuildProbeMargin），远离阈值时选择不会改变，也就不需要更新估计。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 0, UIMin = 0, EditCondition = "bAdaptiveFullRebuild"))
+	int32 FullRebuildProbeIntervalFrames = 600;
+
+	/// @brief 只有当 移动单位比例 与阈值相差不超过这个倍数时才探测另一种方式。
+	/// @details 例如为2时，比例在 阈值/2 到 阈值*2 之间才会探测，按当前估计探测帧最多比所选方式慢约一倍。
+	/// 只有少量单位移动的常见情况下比例远低于阈值，不会为了探测而执行整体重建。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance", meta = (ClampMin = 1.0f, UIMin = 1.0f, EditCondition = "bAdaptiveFullRebuild"))
+	float FullRebuildProbeMargin = 2.0f;
+
+	/// @brief 是否以位压缩格式上传快照纹理。
+	/// @details 快照中每个瓦片只有可见/不可见两种状态，开启后每个纹素存储同一行中相邻的8个瓦片（第k位对应列 8*纹素列+k），
+	/// CPU打包时间和上传带宽约为原来的1/8。需要同时设置 PackedSnapshotInterpolationMaterial，否则回退到每个瓦片一个纹素的格式。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Performance")
+	bool bPackedSnapshot = false;
+
 	/// @brief 用于在时间上平滑视野变化的插值材质。
 	UPROPERTY(EditAnywhere, Category = "FogOfWar|Materials")
 	TObjectPtr<UMaterialInterface> InterpolationMaterial;
 
+	/// @brief 快照为位压缩格式时使用的插值材质。
+	/// @details 与 InterpolationMaterial 相同，但读取 FOW_NewSnapshot 时需要先解包：对瓦片(I, J)，以最近邻方式采样纹素(J/8, I)，
+	/// 取 round(值*255) 的第 J%8 位。FOW_GridResolution 参数给出网格分辨率。
+	UPROPERTY(EditAnywhere, Category = "FogOfWar|Materials", meta = (EditCondition = "bPackedSnapshot"))
+	TObjectPtr<UMaterialInterface> PackedSnapshotInterpolationMaterial;
+
 	/// @brief 在插值之后应用的额外处理材质。
 	UPROPERTY(EditAnywhere, Category = "FogOfWar|Materials")
 	TObjectPtr<UMaterialInterface> AfterInterpolationMaterial;
@@ -246,20 +578,87 @@ public:
 
 	/**
 	 * @brief       计算单个瓦片的地形高度。
-	 * @details     通过从空中向下发射射线来确定瓦片中心点 的Z坐标。
-	 * @param       Tile                           数据类型: FTile&
-	 * @details     要计算高度的瓦片对象。
-	 * @param       TileIJ                         数据类型: FIntVector2
+	 * @details     通过从空中向下发射射线来确定瓦片中心点 的Z坐标，并写入 TileGrid。
+	 * @param       TileIJ                         数据类型: FIntPoint
 	 * @details     瓦片的二维网格坐标。
 	 */
-	void CalculateTileHeight(FTile& Tile, FIntPoint TileIJ);
+	void CalculateTileHeight(FIntPoint TileIJ);
+
+	/**
+	 * @brief       从空中向下发射射线，返回给定位置的地形高度。
+	 * @return      float
+	 * @retval      命中点的Z坐标；未命中时为负无穷。
+	 */
+	float TraceTerrainHeight(FVector2D WorldLocation) const;
+
+	/**
+	 * @brief       并行扫描连续若干行瓦片的地形高度。
+	 * @details     每一行作为一个ParallelFor任务执行。世界的场景查询在内部持有物理场景的读锁，因此可以从工作线程安全调用。
+	 * @param       FirstRow                       数据类型: int32
+	 * @details     第一行（I坐标）。
+	 * @param       NumRows                        数据类型: int32
+	 * @details     要扫描的行数。
+	 */
+	void ScanTileHeights(int32 FirstRow, int32 NumRows);
+
+	/**
+	 * @brief       在Amortized模式下推进一批地形高度扫描，并把扫描完的区域标记为已变化，以便视野据此重新计算。
+	 */
+	void TickHeightScan();
+
+	/**
+	 * @brief       地形高度扫描全部完成后调用。
+	 */
+	void OnHeightScanFinished();
+
+	/**
+	 * @brief       尝试从 BakedHeightfield 加载所有瓦片的高度。
+	 * @return      bool
+	 * @retval      true 如果资产存在、与当前网格布局一致且解码成功。
+	 */
+	bool LoadBakedHeightfield();
+
+	/**
+	 * @brief       在覆盖整个网格的稀疏采样点上追踪地形高度，计算地形的签名。
+	 * @details     烘焙时写入 BakedHeightfield，加载时重新计算并比较，以发现烘焙后被修改过的地形。
+	 *              采样点数量固定（见 UFogOfWarHeightfieldAsset::TerrainSignatureSamplesPerAxis），与网格分辨率无关。
+	 * @return      uint32 采样高度（取整到厘米）的哈希。
+	 */
+	uint32 ComputeTerrainSignature() const;
+
+#if WITH_EDITOR
+	/**
+	 * @brief       扫描编辑器世界中的地形高度并烘焙到 BakedHeightfield。
+	 */
+	void BakeHeightfield();
+#endif
 
 	/**
 	 * @brief       创建一个用于存储当前帧可见性格子快照的2D纹理。
+	 * @details     创建时就初始化渲染资源，之后只通过UploadTextureRegions更新。
 	 * @return      UTexture2D*
 	 */
 	UTexture2D* CreateSnapshotTexture();
 
+	/**
+	 * @brief       创建快照纹理、渲染目标、材质实例并注册后期处理。纯数据模式下不会调用。
+	 */
+	void CreateRenderPipeline();
+
+	/**
+	 * @brief       更新已探索纹理并执行迷雾渲染管线的四个阶段。纯数据模式下不会调用。
+	 * @param       DeltaSeconds                   数据类型: float
+	 * @details     本帧的时间间隔。
+	 */
+	void TickRenderPipeline(float DeltaSeconds);
+
+	/**
+	 * @brief       创建一个位压缩格式的快照纹理，每个纹素存储同一行中相邻的8个瓦片。
+	 * @details     与CreateSnapshotTexture一样，创建时就初始化渲染资源。
+	 * @return      UTexture2D*
+	 */
+	UTexture2D* CreatePackedSnapshotTexture();
+
 	/**
 	 * @brief       创建一个通用的渲染目标（Render Target）2D纹理。
 	 * @return      UTextureRenderTarget2D*
@@ -276,29 +675,104 @@ public:
 #endif
 
 	/**
-	 * @brief       将当前帧的可见性数据（基于VisibilityCounter）写入快照纹理。
+	 * @brief       将本地队伍及其同盟当前帧的可见性数据写入快照纹理。
+	 * @details     只重写并上传位掩码发生变化的块。本地队伍或同盟关系发生变化时整张纹理重建一次。
+	 * 快照为位压缩格式时，每8个瓦片用SIMD比较并提取掩码位打包为一个字节。
 	 * @param       Texture                        数据类型: UTexture2D*
 	 * @details     要写入数据的快照纹理。
+	 * @return      bool
+	 * @retval      true 如果快照内容发生了变化。
+	 */
+	bool WriteVisionDataToTexture(UTexture2D* Texture);
+
+	/**
+	 * @brief       把纹理数据中的若干区域上传到GPU，而不是重新创建整张纹理的资源。
+	 * @details     区域被复制到一块暂存内存中，由渲染线程上传后释放，因此调用后可以立即继续修改纹理数据。纹理还没有渲染资源时不上传任何内容。
+	 * @param       Texture                        数据类型: UTexture2D*
+	 * @details     目标纹理，每个纹素一个字节。
+	 * @param       TextureData                    数据类型: const uint8*
+	 * @details     已写入新内容的纹理数据。
+	 * @param       TexturePitch                   数据类型: int32
+	 * @details     纹理每一行的字节数。
+	 * @param       TexelRects                     数据类型: TConstArrayView<FIntRect>
+	 * @details     要上传的区域，与瓦片坐标的约定相同：X为纹理的行，Y为纹理的列（Min包含、Max不包含）。
+	 * @return      int32 上传的字节数。
+	 */
+	int32 UploadTextureRegions(UTexture2D* Texture, const uint8* TextureData, int32 TexturePitch, TConstArrayView<FIntRect> TexelRects);
+
+	/**
+	 * @brief       将自上次更新以来新探索的区域写入已探索纹理。
+	 * @details     只重写发生变化的块。本地队伍或同盟关系发生变化时整张纹理重建一次。
+	 */
+	void UpdateExploredTexture();
+
+	/**
+	 * @brief       获取指定视野半径的射线查找表，首次使用时构建。
+	 * @details     线程安全，可在并行视野计算中调用。表构建后只读，并被所有相同半径的单位共享。
+	 * @param       GridSpaceRadius                数据类型: float
+	 * @details     网格空间中的视野半径。
+	 * @param       LocalAreaTilesResolution       数据类型: int32
+	 * @details     局部区域网格的边长。
+	 * @return      const FVisionRayTable&
+	 */
+	const FVisionRayTable& GetOrBuildRayTable(float GridSpaceRadius, int32 LocalAreaTilesResolution);
+
+	/**
+	 * @brief       记录一块地形高度发生变化的瓦片区域，并推进地形修订号。
+	 * @param       TileRect                       数据类型: FIntRect
+	 * @details     发生变化的瓦片范围，Min包含、Max不包含。
+	 */
+	void MarkHeightfieldDirty(const FIntRect& TileRect);
+
+	/**
+	 * @brief       获取自某个地形修订号以来发生变化的所有瓦片区域。
+	 * @param       SinceRevision                  数据类型: uint32
+	 * @details     调用方上一次同步时记录的修订号。
+	 * @param       OutTileRects                   数据类型: TArray<FIntRect>&
+	 * @details     输出的变化区域。
+	 * @return      bool
+	 * @retval      false 如果所需的历史记录已被丢弃，调用方应视为整个地形都已变化。
 	 */
-	void WriteVisionDataToTexture(UTexture2D* Texture);
+	bool GetHeightfieldChangesSince(uint32 SinceRevision, TArray<FIntRect>& OutTileRects) const;
+
+	/// @brief 获取当前的地形修订号。每次地形高度发生变化时递增。
+	FORCEINLINE uint32 GetHeightfieldRevision() const { return HeightfieldRevision; }
 	//~ End Core Logic Functions
 
 	//~ Begin Inline Helper Functions
 
-	/// @brief 将二维网格坐标转换为一维数组索引。
-	FORCEINLINE int GetGlobalIndex(FIntPoint IJ) const { return IJ.X * GridResolution.Y + IJ.Y; }
+	/// @brief 将二维网格坐标转换为一维数组索引。使用64位计算，超过46340x46340的网格也不会溢出。
+	FORCEINLINE int64 GetGlobalIndex(FIntPoint IJ) const { return static_cast<int64>(IJ.X) * GridResolution.Y + IJ.Y; }
 
 	/// @brief 将一维数组索引转换为二维网格坐标。
-	FORCEINLINE FIntPoint GetTileIJ(int GlobalIndex) const { return { GlobalIndex / GridResolution.Y, GlobalIndex % GridResolution.Y }; }
+	FORCEINLINE FIntPoint GetTileIJ(int64 GlobalIndex) const { return { static_cast<int32>(GlobalIndex / GridResolution.Y), static_cast<int32>(GlobalIndex % GridResolution.Y) }; }
+
+	/// @brief 根据二维坐标获取瓦片的地形高度。射线未命中的瓦片为负无穷。
+	FORCEINLINE float GetTileHeight(FIntPoint IJ) const { checkSlow(UMinimapDataSubsystem::IsVisionGridIJValid_Static(IJ)); return TileGrid.GetTileHeight(IJ); }
+
+	/// @brief 增加队伍在瓦片上的可见性计数。bAtomic为true时使用原子操作，供并行视野计算使用。
+	FORCEINLINE void IncrementVisibilityCounter(int32 TeamIndex, FIntPoint IJ, bool bAtomic) { TeamVisibility.Increment(TeamIndex, IJ, bAtomic); }
+
+	/// @brief 减少队伍在瓦片上的可见性计数。bAtomic为true时使用原子操作，供并行视野计算使用。
+	FORCEINLINE void DecrementVisibilityCounter(int32 TeamIndex, FIntPoint IJ, bool bAtomic) { TeamVisibility.Decrement(TeamIndex, IJ, bAtomic); }
+
+	/// @brief 获取队伍在瓦片上的可见性计数。
+	FORCEINLINE int32 GetVisibilityCounter(int32 TeamIndex, FIntPoint IJ) const { return TeamVisibility.GetCounter(TeamIndex, IJ); }
 
-	/// @brief 根据一维索引获取瓦片对象引用。
-	FORCEINLINE FTile& GetGlobalTile(int GlobalIndex) { return Tiles[GlobalIndex]; }
+	/// @brief 检查瓦片是否对给定同盟掩码中的任一队伍可见。
+	FORCEINLINE bool IsTileVisibleForAllyMask(FIntPoint IJ, uint8 AllyMask) const { return (TeamVisibility.GetTeamMask(IJ) & AllyMask) != 0; }
 
-	/// @brief 根据二维坐标获取瓦片对象引用。
-	FORCEINLINE FTile& GetGlobalTile(FIntPoint IJ) { checkSlow(UMinimapDataSubsystem::IsVisionGridIJValid_Static(IJ)); return GetGlobalTile(GetGlobalIndex(IJ)); }
+	/// @brief 获取观察者高度所在的分桶。仅在VisionHeightBucketSize大于0时有意义。
+	FORCEINLINE int64 GetVisionHeightBucket(float Height) const { return FMath::FloorToInt64(Height / VisionHeightBucketSize); }
+
+	/// @brief 检查两个观察者高度是否落在同一个高度分桶中。VisionHeightBucketSize为0时要求完全相同。
+	FORCEINLINE bool IsSameVisionHeightBucket(float HeightA, float HeightB) const { return VisionHeightBucketSize > 0.0f ? GetVisionHeightBucket(HeightA) == GetVisionHeightBucket(HeightB) : HeightA == HeightB; }
+
+	/// @brief 检查当前配置下视野位集缓存是否可用。
+	FORCEINLINE bool IsFootprintCacheEnabled() const { return bUseFootprintCache && VisionHeightBucketSize > 0.0f; }
 
 	/// @brief 检查一个潜在的障碍物高度是否足以阻挡来自观察者的视线。
-	FORCEINLINE bool IsBlockingVision(float ObserverHeight, float PotentialObstacleHeight);
+	FORCEINLINE bool IsBlockingVision(float ObserverHeight, float PotentialObstacleHeight) const { return PotentialObstacleHeight - ObserverHeight > VisionBlockingDeltaHeightThreshold; }
 
 	/**
 	 * @brief       执行DDA（数字微分分析器）算法进行视线检查。
@@ -341,6 +815,10 @@ public:
 	UPROPERTY(VisibleInstanceOnly, Category = "FogOfWar|Textures")
 	TObjectPtr<UTexture2D> SnapshotTexture = nullptr;
 
+	/// @brief 已探索区域纹理，值为1代表本地队伍或其同盟曾经看到过该瓦片。
+	UPROPERTY(VisibleInstanceOnly, Category = "FogOfWar|Textures")
+	TObjectPtr<UTexture2D> ExploredTexture = nullptr;
+
 	/// @brief 渲染管线第一阶段的RT。将SnapshotTexture的内容绘制到这里。
 	UPROPERTY(VisibleInstanceOnly, Category = "FogOfWar|Textures")
 	TObjectPtr<UTextureRenderTarget2D> VisibilityTextureRenderTarget = nullptr;
@@ -369,18 +847,66 @@ public:
 	UPROPERTY()
 	TObjectPtr<UMaterialInstanceDynamic> PostProcessingMID;
 
-	/// @brief 存储所有瓦片（FTile）的核心数据数组。
-	TArray<FTile> Tiles;
+	/// @brief 按块稀疏存储的所有瓦片的量化地形高度。
+	FFogOfWarTileGrid TileGrid;
+
+	/// @brief 快照纹理当前对应的同盟掩码。与本地队伍的同盟掩码不一致时需要整张重建。
+	uint8 SnapshotTextureAllyMask = 0;
 
-	/// @brief 用于将可见性数据写入纹理的共享缓冲区，避免重复分配内存。
-	TArray<uint8> TextureDataBuffer;
+	/// @brief 激活时决定的快照纹理是否为位压缩格式。
+	bool bSnapshotPacked = false;
+
+	/// @brief 快照纹理增量更新时复用的块列表。
+	TArray<FIntRect> SnapshotDirtyTileRects;
+
+	/// @brief 已探索纹理当前对应的同盟掩码。与本地队伍的同盟掩码不一致时需要整张重建。
+	uint8 ExploredTextureAllyMask = 0;
+
+	/// @brief 已探索纹理增量更新时复用的块列表。
+	TArray<FIntRect> ExploredDirtyTileRects;
 
 	/// @brief DDA算法使用的栈，用于避免递归并减少内存分配开销。
 	TArray<int> DDALocalIndexesStack;
 
+	/// @brief 按（视野半径，局部区域分辨率）缓存的射线查找表。
+	TMap<TPair<float, int32>, TSharedRef<const FVisionRayTable>> RayTables;
+
+	/// @brief 保护RayTables的读写锁。并行视野计算时多个线程可能同时查询或构建查找表。
+	FRWLock RayTablesLock;
+
+	/// @brief 按队伍存储的可见性计数和每个瓦片的队伍可见性位掩码。
+	FFogOfWarTeamVisibility TeamVisibility;
+
+	/// @brief 每个队伍与之共享视野的队伍位掩码，由 RefreshAllyMasks 计算。
+	uint8 AllyMasks[FogOfWarMaxTeams] = {};
+
+	/// @brief 跨单位、跨帧复用的视野位集缓存。
+	FVisionFootprintCache FootprintCache;
+
+	/// @brief 最近的地形高度变化记录（修订号，瓦片区域），按修订号递增排列。
+	TArray<TPair<uint32, FIntRect>> HeightfieldChanges;
+
+	/// @brief 最多保留的地形高度变化记录数量。更早的记录会被丢弃。
+	static constexpr int32 MaxHeightfieldChangesHistory = 64;
+
+	/// @brief 当前的地形修订号。
+	uint32 HeightfieldRevision = 0;
+
+	/// @brief 下一行待扫描地形高度的网格行。等于GridResolution.X时扫描完成。
+	int32 HeightScanNextRow = 0;
+
+	/// @brief 快照最后一次变化之后，插值渲染目标与快照之间还剩余的最大差值（0到1）。每次插值按吸收率衰减。
+	float PipelineResidual = 1.0f;
+
 	/// @brief 标记是否是第一次Tick。用于执行一些只需要在首次更新时进行的操作。
 	bool bFirstTick = true;
 
+	/// @brief 激活时决定的是否以纯数据模式运行。
+	bool bDataOnly = false;
+
+	/// @brief Tick耗时（秒）的指数移动平均，由 LogMemoryReport 输出。
+	double AverageTickSeconds = 0.0;
+
 	/// @brief 标记系统是否已激活。
 	bool bActivated = false;
 };
\ No newline at end of file
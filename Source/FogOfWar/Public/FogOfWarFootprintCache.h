@@ -0,0 +1,144 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/SparseArray.h"
+#include "HAL/CriticalSection.h"
+
+/**
+ * @file FogOfWarFootprintCache.h
+ * @brief 定义了按（原点瓦片，观察者高度分桶，视野半径）缓存视野位集的近似LRU缓存。
+ */
+
+/**
+ * @struct FVisionFootprintCacheKey
+ * @brief 视野位集缓存的键。
+ * @details 视野计算的结果只取决于原点瓦片、局部区域相对原点的摆放、观察者高度、视野半径和所用内核，
+ * 其中观察者高度按 AFogOfWar::VisionHeightBucketSize 分桶。
+ */
+struct FVisionFootprintCacheKey
+{
+	/// @brief 原点瓦片的全局一维索引。
+	int64 OriginGlobalIndex = INDEX_NONE;
+
+	/// @brief 原点在局部区域中的坐标（由单位的亚瓦片位置决定）。
+	FIntPoint OriginLocalIJ = FIntPoint::ZeroValue;
+
+	/// @brief 观察者高度所在的分桶。
+	int64 HeightBucket = 0;
+
+	/// @brief 网格空间中的视野半径。
+	float GridSpaceRadius = 0.0f;
+
+	/// @brief 计算所用的视野内核（EFogOfWarVisionKernel）。
+	uint8 Kernel = 0;
+
+	bool operator==(const FVisionFootprintCacheKey& Other) const
+	{
+		return OriginGlobalIndex == Other.OriginGlobalIndex && OriginLocalIJ == Other.OriginLocalIJ && HeightBucket == Other.HeightBucket
+			&& GridSpaceRadius == Other.GridSpaceRadius && Kernel == Other.Kernel;
+	}
+
+	friend uint32 GetTypeHash(const FVisionFootprintCacheKey& Key)
+	{
+		uint32 Hash = ::GetTypeHash(Key.OriginGlobalIndex);
+		Hash = HashCombineFast(Hash, ::GetTypeHash(Key.OriginLocalIJ));
+		Hash = HashCombineFast(Hash, ::GetTypeHash(Key.HeightBucket));
+		Hash = HashCombineFast(Hash, ::GetTypeHash(Key.GridSpaceRadius));
+		return HashCombineFast(Hash, ::GetTypeHash(Key.Kernel));
+	}
+};
+
+/**
+ * @class FVisionFootprintCache
+ * @brief 跨单位、跨帧复用已打包视野位集的近似LRU缓存。
+ * @details 编队中的单位、巡逻路线和隘口会让许多单位反复站在相同的瓦片上，此时可以直接复用之前算好的位集。
+ * 所有接口都是线程安全的，可在并行视野计算中调用。地形高度变化时，覆盖到变化区域的条目会被丢弃。
+ *
+ * 并行视野计算中每个实体都会查询一次缓存，因此 Find 只持有读锁，多个工作线程可以同时查询；
+ * 命中时只以原子操作置位条目的访问标志，而不是调整共享的LRU链表。淘汰采用时钟（二次机会）算法：
+ * 时钟指针跳过并清除带有访问标志的条目，淘汰第一个自上次经过后未被访问的条目。
+ */
+class FOGOFWAR_API FVisionFootprintCache
+{
+public:
+	/**
+	 * @brief       查找缓存的视野位集，命中时将其复制到OutVisibleBits并置位访问标志。
+	 * @details     只持有读锁，可被多个线程同时调用。
+	 * @return      bool
+	 * @retval      true 如果命中。
+	 */
+	bool Find(const FVisionFootprintCacheKey& Key, TArray<uint32>& OutVisibleBits);
+
+	/**
+	 * @brief       加入一个新计算出的视野位集。条目数超过MaxEntries时按时钟算法淘汰近期未被访问的条目。
+	 * @param       Key                            数据类型: const FVisionFootprintCacheKey&
+	 * @details     缓存键。
+	 * @param       LocalAreaRect                  数据类型: const FIntRect&
+	 * @details     计算该位集时读取过高度的局部区域（全局瓦片坐标），用于地形变化时的失效判断。
+	 * @param       VisibleBits                    数据类型: const TArray<uint32>&
+	 * @details     打包后的可见位集。
+	 * @param       MaxEntries                     数据类型: int32
+	 * @details     缓存允许的最大条目数。
+	 */
+	void Add(const FVisionFootprintCacheKey& Key, const FIntRect& LocalAreaRect, const TArray<uint32>& VisibleBits, int32 MaxEntries);
+
+	/**
+	 * @brief       丢弃所有局部区域与给定瓦片区域相交的条目。
+	 * @return      int32 被丢弃的条目数。
+	 */
+	int32 InvalidateRegion(const FIntRect& TileRect);
+
+	/// @brief 清空缓存。
+	void Empty();
+
+	/// @brief 当前缓存的条目数。
+	int32 Num() const;
+
+	/// @brief 返回缓存占用的近似内存（字节）。
+	SIZE_T GetAllocatedSize() const;
+
+	/// @brief 累计命中率（0到1）。从未查询过时为0。
+	double GetTotalHitRate() const;
+
+	/// @brief 将本帧的命中、未命中次数以及条目数和内存占用写入 stat FogOfWar，并清零本帧计数。
+	void PublishStats();
+
+private:
+	struct FEntry
+	{
+		FVisionFootprintCacheKey Key;
+		FIntRect LocalAreaRect;
+		TArray<uint32> VisibleBits;
+
+		/// @brief 自时钟指针上次经过以来是否被访问过。持有读锁的 Find 以原子操作置位。
+		mutable int8 bReferenced = 1;
+	};
+
+	/// @brief 按时钟算法淘汰一个条目。必须持有写锁，且缓存不为空。
+	void EvictOne();
+	void RemoveEntry(int32 EntryIndex);
+
+	/// @brief 条目存储。使用稀疏数组保证索引在删除其他条目后保持不变。
+	TSparseArray<FEntry> Entries;
+
+	/// @brief 键到条目索引的映射。
+	TMap<FVisionFootprintCacheKey, int32> Lookup;
+
+	/// @brief 时钟指针，即下一次淘汰开始检查的条目索引。
+	int32 ClockHand = 0;
+
+	/// @brief 所有条目位集占用的内存（字节）。
+	SIZE_T VisibleBitsAllocatedSize = 0;
+
+	/// @brief 本帧的命中、未命中次数。Find 在读锁下以原子操作累加。
+	int32 FrameHits = 0;
+	int32 FrameMisses = 0;
+
+	/// @brief 之前各帧的累计次数，在 PublishStats 中累加。
+	uint64 TotalHits = 0;
+	uint64 TotalMisses = 0;
+
+	mutable FRWLock Lock;
+};
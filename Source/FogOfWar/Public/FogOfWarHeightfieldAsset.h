@@ -0,0 +1,124 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "Serialization/BulkData.h"
+#include "FogOfWarHeightfieldAsset.generated.h"
+
+/**
+ * @file FogOfWarHeightfieldAsset.h
+ * @brief 定义了离线烘焙的地形高度资产。
+ */
+
+class FFogOfWarTileGrid;
+
+/**
+ * @class UFogOfWarHeightfieldAsset
+ * @brief 在编辑器中烘焙、在运行时直接加载的战争迷雾地形高度。
+ * @details 地形在一张地图内是静态的，因此没有必要在每局比赛开始时重新做射线检测。
+ * 高度被量化为uint16，按64x64瓦片分块，每行做差分后单独压缩，存放在不内联的BulkData中。
+ * 烘焙后的Payload在使用IoStore且支持内存映射的平台上直接映射包文件中的区域解码，其余情况下读入内存。
+ * 资产只在网格原点、瓦片大小、网格分辨率与地形签名都与AFogOfWar一致时才会被使用，否则回退到射线扫描。
+ */
+UCLASS(BlueprintType)
+class FOGOFWAR_API UFogOfWarHeightfieldAsset : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/// @brief 二进制格式版本。格式变化时递增，旧版本的资产会被视为无效，需要重新烘焙。
+	static constexpr int32 CurrentFormatVersion = 2;
+
+	/// @brief 分块的边长（瓦片数）。
+	static constexpr int32 ChunkSize = 64;
+
+	/// @brief 表示“射线未命中”（高度为负无穷）的量化值。
+	static constexpr uint16 NoHitQuantizedHeight = MAX_uint16;
+
+	/// @brief 计算地形签名（见 AFogOfWar::ComputeTerrainSignature）时每个轴上的采样点数量。
+	static constexpr int32 TerrainSignatureSamplesPerAxis = 64;
+
+	UFogOfWarHeightfieldAsset();
+
+	//~ Begin UObject Interface
+	virtual void Serialize(FArchive& Ar) override;
+	//~ End UObject Interface
+
+#if WITH_EDITOR
+	/**
+	 * @brief       用扫描得到的瓦片高度重新烘焙资产。
+	 * @param       Heights                        数据类型: TConstArrayView<float>
+	 * @details     按全局一维索引（X*GridResolution.Y+Y）排列的瓦片高度，射线未命中为负无穷。
+	 * @param       InGridResolution               数据类型: FIntPoint
+	 * @details     网格分辨率。
+	 * @param       InGridBottomLeftWorldLocation  数据类型: FVector2D
+	 * @details     网格左下角的世界坐标。
+	 * @param       InTileSize                     数据类型: float
+	 * @details     瓦片大小。
+	 * @param       InTerrainSignature             数据类型: uint32
+	 * @details     烘焙时的地形签名，见 AFogOfWar::ComputeTerrainSignature。
+	 */
+	void Bake(TConstArrayView<float> Heights, FIntPoint InGridResolution, FVector2D InGridBottomLeftWorldLocation, float InTileSize, uint32 InTerrainSignature);
+#endif
+
+	/**
+	 * @brief       检查资产是否与给定的网格布局匹配。
+	 * @return      bool
+	 * @retval      true 如果资产版本有效且网格布局一致。
+	 */
+	bool IsCompatible(FIntPoint InGridResolution, FVector2D InGridBottomLeftWorldLocation, float InTileSize) const;
+
+	/**
+	 * @brief       将烘焙的高度解码到瓦片网格中。各分块并行解压。
+	 * @param       OutTileGrid                    数据类型: FFogOfWarTileGrid&
+	 * @details     已按 GridResolution 初始化的瓦片网格。
+	 * @return      bool
+	 * @retval      true 如果所有分块都解码成功。
+	 */
+	bool LoadTileHeights(FFogOfWarTileGrid& OutTileGrid) const;
+
+	/// @brief 烘焙时的网格分辨率。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	FIntPoint GridResolution = FIntPoint::ZeroValue;
+
+	/// @brief 烘焙时网格左下角的世界坐标。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	FVector2D GridBottomLeftWorldLocation = FVector2D::ZeroVector;
+
+	/// @brief 烘焙时的瓦片大小。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	float TileSize = 0.0f;
+
+	/// @brief 量化值0对应的高度。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	float MinHeight = 0.0f;
+
+	/// @brief 相邻两个量化值之间的高度差。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	float HeightStep = 1.0f;
+
+	/// @brief 烘焙时的地形签名。与加载时重新计算的签名不同说明地形在烘焙后被修改过，资产不再可用。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	uint32 TerrainSignature = 0;
+
+	/// @brief 压缩后Payload的大小（字节），仅用于显示。
+	UPROPERTY(VisibleAnywhere, Category = "FogOfWar")
+	int64 CompressedSize = 0;
+
+private:
+	FIntPoint GetNumChunks() const;
+
+	/// @brief 并行解码所有分块。Payload指向完整的压缩数据（映射的或读入内存的）。
+	bool DecodeChunks(const uint8* Payload, int64 PayloadSize, FFogOfWarTileGrid& OutTileGrid) const;
+
+	/// @brief 读取时得到的格式版本。与 CurrentFormatVersion 不同时资产无效。
+	int32 FormatVersion = 0;
+
+	/// @brief 每个分块在Payload中的起始偏移，最后一个元素是Payload的总大小。
+	TArray<int64> ChunkOffsets;
+
+	/// @brief 所有分块压缩数据的拼接。
+	FByteBulkData HeightData;
+};
@@ -0,0 +1,97 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * @file FogOfWarRayTable.h
+ * @brief 定义了DDA视线检查使用的预计算射线查找表。
+ */
+
+/**
+ * @struct FVisionRayNode
+ * @brief 射线树中的一个节点，对应相对于观察者原点的一个瓦片偏移。
+ * @details 所有射线从原点出发插入同一棵前缀树，因此共享的前缀只存储一次。
+ * 从目标节点沿Parent走回根节点，得到的瓦片序列与DDA从目标瓦片走向原点的序列完全相同。
+ */
+struct FVisionRayNode
+{
+	/// @brief 相对于原点的瓦片偏移。
+	FIntPoint Offset = FIntPoint::ZeroValue;
+
+	/// @brief 相对于原点的局部一维索引偏移（Offset.X * LocalAreaTilesResolution + Offset.Y）。
+	int32 LocalIndexDelta = 0;
+
+	/// @brief 父节点（更靠近原点的瓦片）的索引。根节点为INDEX_NONE。
+	int32 Parent = INDEX_NONE;
+};
+
+/**
+ * @struct FVisionRayTarget
+ * @brief 螺旋遍历顺序中的一个目标瓦片及其射线在树中的终点节点。
+ */
+struct FVisionRayTarget
+{
+	/// @brief 目标瓦片相对于原点的偏移。
+	FIntPoint Offset = FIntPoint::ZeroValue;
+
+	/// @brief 目标瓦片在射线树中的节点索引。
+	int32 NodeIndex = INDEX_NONE;
+};
+
+/**
+ * @struct FVisionRayTable
+ * @brief 针对某个网格空间视野半径预计算的全部DDA射线。
+ * @details 射线路径只取决于目标瓦片相对原点的偏移，因此同一半径的所有单位可以共享一张表。
+ * 表在首次使用时构建，构建完成后只读，可被多个线程同时访问。
+ * 由于原点在局部区域中的位置取决于单位的亚瓦片坐标（每个轴最多两种情况），
+ * 表中为每种原点位置分别保存一份螺旋遍历顺序，以保证结果与逐瓦片DDA逐位一致。
+ */
+struct FOGOFWAR_API FVisionRayTable
+{
+	/// @brief 根节点（原点）的索引。
+	static constexpr int32 RootNodeIndex = 0;
+
+	/// @brief 射线树的所有节点，扁平存储。
+	TArray<FVisionRayNode> Nodes;
+
+	/// @brief 每种原点局部坐标对应的螺旋遍历目标列表。
+	TArray<TPair<FIntPoint, TArray<FVisionRayTarget>>> SpiralOrders;
+
+	/// @brief 查找给定原点局部坐标对应的螺旋遍历目标列表。未找到时返回nullptr。
+	const TArray<FVisionRayTarget>* FindSpiralOrder(FIntPoint OriginLocalIJ) const
+	{
+		for (const TPair<FIntPoint, TArray<FVisionRayTarget>>& SpiralOrder : SpiralOrders)
+		{
+			if (SpiralOrder.Key == OriginLocalIJ)
+			{
+				return &SpiralOrder.Value;
+			}
+		}
+		return nullptr;
+	}
+
+	/// @brief 返回此表占用的近似内存（字节）。
+	SIZE_T GetAllocatedSize() const;
+
+	/**
+	 * @brief       构建一张射线查找表。
+	 * @param       GridSpaceRadius                数据类型: float
+	 * @details     网格空间中的视野半径。
+	 * @param       LocalAreaTilesResolution       数据类型: int32
+	 * @details     局部区域网格的边长。
+	 * @return      TSharedRef<const FVisionRayTable>
+	 */
+	static TSharedRef<const FVisionRayTable> Build(float GridSpaceRadius, int32 LocalAreaTilesResolution);
+
+	/**
+	 * @brief       计算从目标瓦片走向原点的DDA路径。
+	 * @details     与 FFogOfWarMassHelpers::ComputeVisibilityDDA 中的步进逻辑完全一致，包含目标瓦片和原点。
+	 * @param       TargetOffset                   数据类型: FIntPoint
+	 * @details     目标瓦片相对于原点的偏移。
+	 * @param       OutPath                        数据类型: TArray<FIntPoint>&
+	 * @details     输出的偏移序列，第一个元素为目标，最后一个元素为原点(0,0)。
+	 */
+	static void TraceDDAPath(FIntPoint TargetOffset, TArray<FIntPoint>& OutPath);
+};
@@ -0,0 +1,401 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "FogOfWarTileLayout.h"
+
+/**
+ * @file FogOfWarTeamVisibility.h
+ * @brief 定义了按队伍划分的可见性计数存储以及队伍关系（同盟）解析器。
+ */
+
+/// @brief 支持的最大队伍数量。每个瓦片的队伍可见性用一个uint8位掩码表示。
+static constexpr int32 FogOfWarMaxTeams = 8;
+
+/**
+ * @def FOGOFWAR_IS_ALLY
+ * @brief 编译期的默认同盟判断。可在包含本头文件之前（或通过Build.cs的PublicDefinitions）重新定义，
+ * 例如 ((ObserverTeam) & (TargetTeam)) != 0 这样的位运算同盟。
+ */
+#ifndef FOGOFWAR_IS_ALLY
+#define FOGOFWAR_IS_ALLY(ObserverTeam, TargetTeam) ((ObserverTeam) == (TargetTeam))
+#endif
+
+/**
+ * @struct FTeamRelationshipResolver
+ * @brief 决定哪些队伍之间共享视野。
+ * @details 我们不硬编码 TeamA == TeamB：未绑定 IsAllyDelegate 时使用 FOGOFWAR_IS_ALLY，绑定后由委托决定。
+ * 关系只在 AFogOfWar::RefreshAllyMasks 时被查询并折叠成每个队伍一个位掩码，
+ * 之后同盟视野通过 (瓦片队伍掩码 & 同盟掩码) != 0 得到，无需重新计数。
+ */
+struct FOGOFWAR_API FTeamRelationshipResolver
+{
+	DECLARE_DELEGATE_RetVal_TwoParams(bool, FIsAllyDelegate, int32 /*ObserverTeam*/, int32 /*TargetTeam*/);
+
+	/// @brief 可绑定的同盟判断。修改后需要调用 AFogOfWar::RefreshAllyMasks。
+	static FIsAllyDelegate IsAllyDelegate;
+
+	/// @brief 判断TargetTeam的视野是否与ObserverTeam共享。
+	static bool IsAlly(int32 ObserverTeam, int32 TargetTeam);
+
+	/// @brief 计算与ObserverTeam共享视野的所有队伍的位掩码（总是包含ObserverTeam自身）。
+	static uint8 ComputeAllyMask(int32 ObserverTeam);
+};
+
+/**
+ * @class FFogOfWarTeamVisibility
+ * @brief 按队伍存储的可见性计数器，以及每个瓦片一个字节的队伍可见性位掩码，两者都按块稀疏存储。
+ * @details 计数器按 ChunkSize x ChunkSize 的块为每个队伍分别存储，块只在该队伍第一次看到其中的瓦片时才分配，
+ * 块内计数全部归零后会被释放。因此常见的2到8个队伍的场景下，内存开销只与各队伍实际看到过的区域成正比，
+ * 而不会乘以队伍数量。
+ *
+ * 位掩码的第t位表示队伍t至少有一个单位能看到该瓦片。计数器变化时只标记所在的块，
+ * 位掩码在 ResolveDirtyChunks 中按块统一刷新，因此并行视野计算中也不存在位掩码的竞争。
+ * 没有任何队伍能看到的块不分配位掩码，因此即使是16384x16384的网格，内存也只与视野覆盖的区域成正比。
+ *
+ * 此外每个队伍还有一层持久的“已探索”位集（每个瓦片1位，同样按块分配）。计数块归零释放时已探索块保留，
+ * 只有 ResetExplored 会释放它们：此时没有计数块的已探索块被释放，仍有计数的块的已探索块保留并只标记当前可见的瓦片。
+ * Reset（以及 Initialize 和析构）先清空所有计数，因此会释放全部已探索块。
+ * 只有计数器从0变为1（瓦片对该队伍变为可见）时才会写入，不需要任何全图扫描。
+ * 探索只会置位不会清除，因此并行写入时用原子或运算即可保证正确。
+ *
+ * 计数器以uint16存储，块大小因此减半。计数达到 OverflowCounter 后改为记录在溢出表中（需要加锁），
+ * 实际对局中几乎不会出现，因此热路径上只多一次比较。
+ */
+class FOGOFWAR_API FFogOfWarTeamVisibility
+{
+public:
+	/// @brief 计数块的边长（瓦片数）。块内布局见 FFogOfWarTileLayout。
+	static constexpr int32 ChunkSize = FFogOfWarTileLayout::ChunkSize;
+	/// @brief 每个计数块包含的瓦片数量。
+	static constexpr int32 TilesPerChunk = FFogOfWarTileLayout::TilesPerChunk;
+	/// @brief 每个已探索块包含的32位字数量。
+	static constexpr int32 ExploredWordsPerChunk = TilesPerChunk / 32;
+	/// @brief 计数器的哨兵值，表示真实计数记录在溢出表中。小于它的值都是直接存储的计数。
+	static constexpr uint16 OverflowCounter = MAX_uint16;
+
+	FFogOfWarTeamVisibility() = default;
+	~FFogOfWarTeamVisibility();
+	FFogOfWarTeamVisibility(const FFogOfWarTeamVisibility&) = delete;
+	FFogOfWarTeamVisibility& operator=(const FFogOfWarTeamVisibility&) = delete;
+
+	/// @brief 按网格分辨率分配块表与位掩码，并清空所有计数。
+	void Initialize(FIntPoint InGridResolution);
+
+	/// @brief 释放所有计数块并清空位掩码。
+	void Reset();
+
+	/// @brief 增加队伍在某瓦片上的可见性计数。bAtomic为true时使用原子操作，供并行视野计算使用。
+	FORCEINLINE void Increment(int32 TeamIndex, FIntPoint IJ, bool bAtomic)
+	{
+		checkSlow(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams);
+		const int32 ChunkIndex = GetChunkIndex(IJ);
+		uint16* Chunk = TeamChunks[TeamIndex][ChunkIndex];
+		if (UNLIKELY(!Chunk))
+		{
+			Chunk = AllocateChunk(TeamIndex, ChunkIndex, bAtomic);
+		}
+
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		uint16& Counter = Chunk[OffsetInChunk];
+		uint16 OldCounter = Counter;
+		while (true)
+		{
+			// the step onto the sentinel is taken by the slow path, so the fast path never produces it
+			if (UNLIKELY(OldCounter >= OverflowCounter - 1))
+			{
+				IncrementOverflow(TeamIndex, ChunkIndex, OffsetInChunk);
+				break;
+			}
+
+			if (!bAtomic)
+			{
+				Counter = OldCounter + 1;
+				break;
+			}
+
+			const uint16 PreviousCounter = static_cast<uint16>(FPlatformAtomics::InterlockedCompareExchange(reinterpret_cast<volatile int16*>(&Counter), static_cast<int16>(OldCounter + 1), static_cast<int16>(OldCounter)));
+			if (PreviousCounter == OldCounter)
+			{
+				break;
+			}
+			OldCounter = PreviousCounter;
+		}
+
+		if (OldCounter == 0)
+		{
+			MarkExplored(TeamIndex, ChunkIndex, OffsetInChunk, bAtomic);
+		}
+		MarkChunkDirty(ChunkIndex, bAtomic);
+	}
+
+	/// @brief 减少队伍在某瓦片上的可见性计数。bAtomic为true时使用原子操作，供并行视野计算使用。
+	FORCEINLINE void Decrement(int32 TeamIndex, FIntPoint IJ, bool bAtomic)
+	{
+		checkSlow(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams);
+		const int32 ChunkIndex = GetChunkIndex(IJ);
+		uint16* Chunk = TeamChunks[TeamIndex][ChunkIndex];
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		checkSlow(Chunk && Chunk[OffsetInChunk] > 0);
+
+		uint16& Counter = Chunk[OffsetInChunk];
+		uint16 OldCounter = Counter;
+		while (true)
+		{
+			if (UNLIKELY(OldCounter == OverflowCounter))
+			{
+				DecrementOverflow(TeamIndex, ChunkIndex, OffsetInChunk);
+				break;
+			}
+
+			if (!bAtomic)
+			{
+				Counter = OldCounter - 1;
+				break;
+			}
+
+			const uint16 PreviousCounter = static_cast<uint16>(FPlatformAtomics::InterlockedCompareExchange(reinterpret_cast<volatile int16*>(&Counter), static_cast<int16>(OldCounter - 1), static_cast<int16>(OldCounter)));
+			if (PreviousCounter == OldCounter)
+			{
+				break;
+			}
+			OldCounter = PreviousCounter;
+		}
+		MarkChunkDirty(ChunkIndex, bAtomic);
+	}
+
+	/// @brief 获取队伍在某瓦片上的可见性计数。
+	FORCEINLINE int32 GetCounter(int32 TeamIndex, FIntPoint IJ) const
+	{
+		const int32 ChunkIndex = GetChunkIndex(IJ);
+		const uint16* Chunk = TeamChunks[TeamIndex][ChunkIndex];
+		if (!Chunk)
+		{
+			return 0;
+		}
+
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		return Chunk[OffsetInChunk] != OverflowCounter ? Chunk[OffsetInChunk] : GetOverflowCounter(TeamIndex, ChunkIndex, OffsetInChunk);
+	}
+
+	/// @brief 检查队伍是否曾经看到过某瓦片。
+	FORCEINLINE bool IsExplored(int32 TeamIndex, FIntPoint IJ) const
+	{
+		const uint32* ExploredChunk = TeamExploredChunks[TeamIndex][GetChunkIndex(IJ)];
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		return ExploredChunk && ((ExploredChunk[OffsetInChunk >> 5] >> (OffsetInChunk & 31)) & 1u);
+	}
+
+	/// @brief 获取曾经看到过某瓦片的所有队伍的位掩码，只检查AllyMask中的队伍。
+	FORCEINLINE uint8 GetExploredMask(FIntPoint IJ, uint8 AllyMask) const
+	{
+		uint8 ExploredMask = 0;
+		for (uint32 Teams = AllyMask; Teams != 0; Teams &= Teams - 1)
+		{
+			const int32 TeamIndex = FMath::CountTrailingZeros(Teams);
+			ExploredMask |= IsExplored(TeamIndex, IJ) ? uint8(1u << TeamIndex) : uint8(0);
+		}
+		return ExploredMask;
+	}
+
+	/**
+	 * @brief       取出自上次调用以来有新瓦片被探索的块，并清除标记。
+	 * @details     供渲染管线只更新已探索纹理中发生变化的区域。必须在没有视野计算并行执行时调用。
+	 * @param       OutTileRects                   数据类型: TArray<FIntRect>&
+	 * @details     输出的块范围（全局瓦片坐标，Min包含、Max不包含）。
+	 * @return      bool 是否有块发生了变化。
+	 */
+	bool ConsumeExploredDirtyChunks(TArray<FIntRect>& OutTileRects);
+
+	/**
+	 * @brief       取出自上次调用以来队伍可见性位掩码发生过变化的块，并清除标记。
+	 * @details     由 ResolveDirtyChunks 标记，只有位掩码真正改变的块才会被标记，计数变化但可见性不变的块不会。
+	 * 供渲染管线只上传快照纹理中发生变化的区域。必须在没有视野计算并行执行时调用。
+	 * @param       OutTileRects                   数据类型: TArray<FIntRect>&
+	 * @details     输出的块范围（全局瓦片坐标，Min包含、Max不包含）。
+	 * @return      bool 是否有块发生了变化。
+	 */
+	bool ConsumeMaskDirtyChunks(TArray<FIntRect>& OutTileRects);
+
+	/**
+	 * @brief       清除某个队伍的已探索记录（例如重新开局）。
+	 * @details     当前仍对该队伍可见的瓦片保持已探索，仍有计数的块保留其已探索块（只清零并重新标记），
+	 *              没有计数的块的已探索块被释放。
+	 */
+	void ResetExplored(int32 TeamIndex);
+
+	/// @brief 获取某瓦片的队伍可见性位掩码（截至上一次 ResolveDirtyChunks）。
+	FORCEINLINE uint8 GetTeamMask(FIntPoint IJ) const
+	{
+		const uint8* MaskChunk = MaskChunks[GetChunkIndex(IJ)];
+		return MaskChunk ? MaskChunk[GetMaskOffsetInChunk(IJ)] : 0;
+	}
+
+	/**
+	 * @brief       获取从瓦片IJ开始、直到所在块右边界（J方向）为止的一行位掩码。
+	 * @details     位掩码块内总是按行主序排列（与 FOGOFWAR_MORTON_TILE_LAYOUT 无关），便于按纹理的像素行读取。
+	 * @return      const uint8* 整个块都不可见时返回nullptr。
+	 */
+	FORCEINLINE const uint8* GetTeamMaskRow(FIntPoint IJ) const
+	{
+		const uint8* MaskChunk = MaskChunks[GetChunkIndex(IJ)];
+		return MaskChunk ? MaskChunk + GetMaskOffsetInChunk(IJ) : nullptr;
+	}
+
+	/// @brief 是否有计数发生了变化但尚未刷新到位掩码。
+	FORCEINLINE bool HasDirtyChunks() const { return bHasDirtyChunks != 0; }
+
+	/**
+	 * @brief       为所有被标记的块重新计算瓦片位掩码，并释放计数已全部归零的块。
+	 * @details     只在 AFogOfWar::Tick 中调用：它会分配和释放位掩码块，并标记供纹理上传取出的块，在其他时刻调用会与视野处理器和纹理更新竞争。
+	 * @return      int32 刷新的块数量。
+	 */
+	int32 ResolveDirtyChunks();
+
+	/**
+	 * @brief       清空所有队伍的计数并释放计数块，已探索记录保持不变。
+	 * @details     被释放的块会被标记，下一次 ResolveDirtyChunks 时刷新位掩码。用于整体重建计数（见 ReserveChunk 与 IncrementInOwnedChunk）。
+	 *              必须在没有视野计算并行执行时调用。
+	 */
+	void ClearCounters();
+
+	/**
+	 * @brief       为队伍分配（若尚未分配）一个计数块并标记该块。
+	 * @details     整体重建时在单线程中为所有将被写入的块调用，之后才能对该块调用 IncrementInOwnedChunk。
+	 */
+	void ReserveChunk(int32 TeamIndex, int32 ChunkIndex);
+
+	/**
+	 * @brief       在一个已由 ReserveChunk 分配的块内增加计数，不使用原子操作。
+	 * @details     调用者保证同一时间只有一个线程写入该块（所有队伍），因此整体重建可以按块并行，而无需原子操作。
+	 */
+	FORCEINLINE void IncrementInOwnedChunk(int32 TeamIndex, int32 ChunkIndex, FIntPoint IJ)
+	{
+		checkSlow(TeamIndex >= 0 && TeamIndex < FogOfWarMaxTeams);
+		checkSlow(ChunkIndex == GetChunkIndex(IJ) && TeamChunks[TeamIndex][ChunkIndex]);
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		uint16& Counter = TeamChunks[TeamIndex][ChunkIndex][OffsetInChunk];
+		if (UNLIKELY(Counter >= OverflowCounter - 1))
+		{
+			IncrementOverflow(TeamIndex, ChunkIndex, OffsetInChunk);
+			return;
+		}
+
+		if (Counter++ == 0)
+		{
+			MarkExplored(TeamIndex, ChunkIndex, OffsetInChunk, false);
+		}
+	}
+
+	/// @brief 网格分辨率。
+	FORCEINLINE FIntPoint GetGridResolution() const { return GridResolution; }
+
+	/// @brief 瓦片所在计数块的索引。
+	FORCEINLINE int32 GetChunkIndex(FIntPoint IJ) const { return FFogOfWarTileLayout::GetChunkIndex(IJ, NumChunks.Y); }
+
+	/// @brief 计数块覆盖的瓦片范围（全局瓦片坐标，Min包含、Max不包含）。
+	FIntRect GetChunkTileRect(int32 ChunkIndex) const;
+
+	/// @brief 当前已分配的计数块数量（所有队伍合计）。
+	FORCEINLINE int32 GetNumAllocatedChunks() const { return NumAllocatedChunks; }
+
+	/// @brief 返回占用的近似内存（字节）。
+	SIZE_T GetAllocatedSize() const;
+
+private:
+	FORCEINLINE static int32 GetOffsetInChunk(FIntPoint IJ) { return FFogOfWarTileLayout::GetOffsetInChunk(IJ); }
+	FORCEINLINE static int32 GetMaskOffsetInChunk(FIntPoint IJ) { return FFogOfWarTileLayout::GetRowMajorOffsetInChunk(IJ); }
+
+	FORCEINLINE void MarkChunkDirty(int32 ChunkIndex, bool bAtomic)
+	{
+		if (bAtomic)
+		{
+			FPlatformAtomics::AtomicStore_Relaxed(&DirtyChunks[ChunkIndex], int8(1));
+			FPlatformAtomics::AtomicStore_Relaxed(&bHasDirtyChunks, int8(1));
+		}
+		else
+		{
+			DirtyChunks[ChunkIndex] = 1;
+			bHasDirtyChunks = 1;
+		}
+	}
+
+	FORCEINLINE void MarkExplored(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk, bool bAtomic)
+	{
+		uint32& Word = TeamExploredChunks[TeamIndex][ChunkIndex][OffsetInChunk >> 5];
+		const uint32 Bit = 1u << (OffsetInChunk & 31);
+		if (Word & Bit)
+		{
+			return;
+		}
+
+		if (bAtomic)
+		{
+			FPlatformAtomics::InterlockedOr(reinterpret_cast<volatile int32*>(&Word), static_cast<int32>(Bit));
+			FPlatformAtomics::AtomicStore_Relaxed(&ExploredDirtyChunks[ChunkIndex], int8(1));
+		}
+		else
+		{
+			Word |= Bit;
+			ExploredDirtyChunks[ChunkIndex] = 1;
+		}
+	}
+
+	uint16* AllocateChunk(int32 TeamIndex, int32 ChunkIndex, bool bAtomic);
+
+	/// @brief 计数器的慢路径：计数达到或已经超过uint16的直接存储范围。
+	void IncrementOverflow(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk);
+	void DecrementOverflow(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk);
+	int32 GetOverflowCounter(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk) const;
+
+	FORCEINLINE static uint64 GetOverflowKey(int32 TeamIndex, int32 ChunkIndex, int32 OffsetInChunk)
+	{
+		return (static_cast<uint64>(TeamIndex) << 56) | (static_cast<uint64>(ChunkIndex) << 16) | static_cast<uint64>(OffsetInChunk);
+	}
+	bool ConsumeDirtyChunks(TArray<int8>& DirtyFlags, TArray<FIntRect>& OutTileRects) const;
+
+	/// @brief 网格分辨率。
+	FIntPoint GridResolution = FIntPoint::ZeroValue;
+
+	/// @brief 每个轴上的块数量。
+	FIntPoint NumChunks = FIntPoint::ZeroValue;
+
+	/// @brief 每个队伍的块表。未分配的块为nullptr，表示该块内所有计数为0。
+	TArray<uint16*> TeamChunks[FogOfWarMaxTeams];
+
+	/// @brief 计数达到 OverflowCounter 的瓦片的真实计数。
+	TMap<uint64, int32> OverflowCounters;
+
+	/// @brief 保护 OverflowCounters。
+	mutable FCriticalSection OverflowLock;
+
+	/// @brief 每个队伍的已探索位集块表。块与计数块一同分配，计数块释放后仍然保留，
+	/// 只在 ResetExplored 中对没有计数块的块释放（Reset 时全部释放）。
+	TArray<uint32*> TeamExploredChunks[FogOfWarMaxTeams];
+
+	/// @brief 自上次取出以来有新瓦片被探索的块。
+	TArray<int8> ExploredDirtyChunks;
+
+	/// @brief 已分配的已探索块数量。
+	int32 NumAllocatedExploredChunks = 0;
+
+	/// @brief 自上次刷新以来计数发生过变化的块。
+	TArray<int8> DirtyChunks;
+
+	/// @brief 是否存在被标记的块。
+	int8 bHasDirtyChunks = 0;
+
+	/// @brief 位掩码块表。每块 TilesPerChunk 个字节，按行主序排列。为nullptr表示该块内没有任何队伍可见的瓦片。
+	TArray<uint8*> MaskChunks;
+
+	/// @brief 已分配的位掩码块数量。
+	int32 NumAllocatedMaskChunks = 0;
+
+	/// @brief 自上次取出以来位掩码发生过变化的块。
+	TArray<int8> MaskDirtyChunks;
+
+	/// @brief 已分配的计数块数量。
+	int32 NumAllocatedChunks = 0;
+};
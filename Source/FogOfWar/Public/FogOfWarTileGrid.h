@@ -0,0 +1,171 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FogOfWarTileLayout.h"
+
+/**
+ * @file FogOfWarTileGrid.h
+ * @brief 定义了按块稀疏存储、高度量化为int16的瓦片高度网格。
+ */
+
+/**
+ * @class FFogOfWarTileGrid
+ * @brief 按 ChunkSize x ChunkSize 分块、写入时才分配的瓦片高度网格。
+ * @details 网格只保存地形高度这一个平面，可见性计数按队伍单独存储在 FFogOfWarTeamVisibility 中，
+ * 因此视线检查读取高度时不会与计数器的写入争用同一缓存行。
+ *
+ * 高度按每张地图的高度范围量化为int16（精度约为 范围/65534），NoHitHeight 表示射线未命中（负无穷，永不遮挡）。
+ *
+ * 块表中的每一项要么指向一个独占的块，要么指向一个只读的共享块。
+ * 所有瓦片高度相同的块（例如射线未命中的区域或完全平坦的地面）由同一个共享块表示，
+ * 因此内存只与地形真正有起伏的区域成正比。
+ *
+ * 读取永远不需要分支：共享块和独占块的布局相同。写入共享块时先复制出一个独占块（写时复制），
+ * 分配使用原子比较交换，因此可以从并行的高度扫描中调用。Compact 会把重新变得一致的块折叠回共享块。
+ */
+class FOGOFWAR_API FFogOfWarTileGrid
+{
+public:
+	/// @brief 块的边长（瓦片数）。块内布局见 FFogOfWarTileLayout。
+	static constexpr int32 ChunkSize = FFogOfWarTileLayout::ChunkSize;
+	/// @brief 每个块包含的瓦片数量。
+	static constexpr int32 TilesPerChunk = FFogOfWarTileLayout::TilesPerChunk;
+	/// @brief 表示“射线未命中”（高度为负无穷）的量化高度。
+	static constexpr int16 NoHitHeight = MIN_int16;
+
+	FFogOfWarTileGrid() = default;
+	~FFogOfWarTileGrid();
+	FFogOfWarTileGrid(const FFogOfWarTileGrid&) = delete;
+	FFogOfWarTileGrid& operator=(const FFogOfWarTileGrid&) = delete;
+
+	/**
+	 * @brief       按网格分辨率分配块表，所有瓦片初始为射线未命中。
+	 * @param       InGridResolution               数据类型: FIntPoint
+	 * @details     网格分辨率。
+	 * @param       MinHeight                      数据类型: float
+	 * @details     地图的最低地形高度，更低的高度会被截断。
+	 * @param       MaxHeight                      数据类型: float
+	 * @details     地图的最高地形高度，更高的高度会被截断。
+	 */
+	void Initialize(FIntPoint InGridResolution, float MinHeight, float MaxHeight);
+
+	/// @brief 释放所有块。
+	void Reset();
+
+	/// @brief 获取瓦片的地形高度。射线未命中的瓦片为负无穷。
+	FORCEINLINE float GetTileHeight(FIntPoint IJ) const
+	{
+		return DequantizeHeight(GetQuantizedTileHeight(IJ));
+	}
+
+	/// @brief 获取瓦片的量化高度。
+	FORCEINLINE int16 GetQuantizedTileHeight(FIntPoint IJ) const
+	{
+		checkSlow(IJ.X >= 0 && IJ.Y >= 0 && IJ.X < GridResolution.X && IJ.Y < GridResolution.Y);
+		return ChunkDirectory[GetChunkIndex(IJ)]->Heights[GetOffsetInChunk(IJ)];
+	}
+
+	/**
+	 * @brief       设置瓦片高度。写入共享块且高度与之不同时会为该块分配独占的副本。
+	 * @details     可以从多个线程同时调用，但同一瓦片不能被并发写入。不能与 Compact 同时调用。
+	 */
+	FORCEINLINE void SetTileHeight(FIntPoint IJ, float Height)
+	{
+		checkSlow(IJ.X >= 0 && IJ.Y >= 0 && IJ.X < GridResolution.X && IJ.Y < GridResolution.Y);
+		const int16 QuantizedHeight = QuantizeHeight(Height);
+		const int32 ChunkIndex = GetChunkIndex(IJ);
+		const int32 OffsetInChunk = GetOffsetInChunk(IJ);
+		FChunk* Chunk = ChunkDirectory[ChunkIndex];
+		if (Chunk->bShared)
+		{
+			if (Chunk->Heights[OffsetInChunk] == QuantizedHeight)
+			{
+				return;
+			}
+			Chunk = MakeChunkUnique(ChunkIndex, Chunk);
+		}
+		Chunk->Heights[OffsetInChunk] = QuantizedHeight;
+	}
+
+	/// @brief 将高度量化为int16，超出地图高度范围的值会被截断。
+	FORCEINLINE int16 QuantizeHeight(float Height) const
+	{
+		if (!FMath::IsFinite(Height))
+		{
+			return Height > 0.0f ? MAX_int16 : NoHitHeight;
+		}
+		return static_cast<int16>(FMath::Clamp(FMath::RoundToInt32((Height - HeightOffset) * InvHeightStep), MIN_int16 + 1, MAX_int16));
+	}
+
+	/// @brief 将量化高度还原为世界空间高度。
+	FORCEINLINE float DequantizeHeight(int16 QuantizedHeight) const
+	{
+		return QuantizedHeight != NoHitHeight ? HeightOffset + QuantizedHeight * HeightStep : -std::numeric_limits<float>::infinity();
+	}
+
+	/// @brief 相邻两个量化高度之间的差值。
+	FORCEINLINE float GetHeightStep() const { return HeightStep; }
+
+	/**
+	 * @brief       把区域内所有瓦片高度一致的独占块折叠为共享块。
+	 * @details     必须在没有并发读写时调用（例如在AFogOfWar::Tick中）。
+	 * @param       TileRect                       数据类型: const FIntRect&
+	 * @details     要检查的区域（全局瓦片坐标），与之相交的块都会被检查。
+	 * @return      int32 被释放的块数量。
+	 */
+	int32 Compact(const FIntRect& TileRect);
+
+	/// @brief 虚拟块数量（块表的大小）。
+	FORCEINLINE int32 GetNumVirtualChunks() const { return ChunkDirectory.Num(); }
+
+	/// @brief 已分配的独占块数量。
+	FORCEINLINE int32 GetNumResidentChunks() const { return NumResidentChunks; }
+
+	/// @brief 不同的共享块数量。
+	FORCEINLINE int32 GetNumSharedChunks() const { return SharedChunks.Num(); }
+
+	/// @brief 返回占用的近似内存（字节）。
+	SIZE_T GetAllocatedSize() const;
+
+	/// @brief 返回以稠密float数组存储同样网格时所需的内存（字节）。
+	FORCEINLINE SIZE_T GetDenseSize() const { return static_cast<SIZE_T>(GridResolution.X) * GridResolution.Y * sizeof(float); }
+
+private:
+	struct FChunk
+	{
+		/// @brief 是否为只读的共享块。创建后不再改变。
+		bool bShared = false;
+
+		int16 Heights[TilesPerChunk];
+	};
+
+	FORCEINLINE int32 GetChunkIndex(FIntPoint IJ) const { return FFogOfWarTileLayout::GetChunkIndex(IJ, NumChunks.Y); }
+	FORCEINLINE static int32 GetOffsetInChunk(FIntPoint IJ) { return FFogOfWarTileLayout::GetOffsetInChunk(IJ); }
+
+	FChunk* MakeChunkUnique(int32 ChunkIndex, FChunk* SharedChunk);
+	FChunk* FindOrAddSharedChunk(int16 QuantizedHeight);
+
+	/// @brief 网格分辨率。
+	FIntPoint GridResolution = FIntPoint::ZeroValue;
+
+	/// @brief 每个轴上的块数量。
+	FIntPoint NumChunks = FIntPoint::ZeroValue;
+
+	/// @brief 量化高度0对应的世界空间高度（地图高度范围的中点）。
+	float HeightOffset = 0.0f;
+
+	/// @brief 相邻两个量化高度之间的差值，以及它的倒数。
+	float HeightStep = 1.0f;
+	float InvHeightStep = 1.0f;
+
+	/// @brief 块表。每一项都不为空，指向独占块或共享块。
+	TArray<FChunk*> ChunkDirectory;
+
+	/// @brief 按量化高度索引的共享块。
+	TMap<int16, FChunk*> SharedChunks;
+
+	/// @brief 已分配的独占块数量。
+	int32 NumResidentChunks = 0;
+};
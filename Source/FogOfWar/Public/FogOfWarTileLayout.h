@@ -0,0 +1,119 @@
+// Copyright Winyunq, 2025. All Rights Reserved.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * @file FogOfWarTileLayout.h
+ * @brief 定义了瓦片高度平面与可见性计数平面共用的分块内存布局。
+ */
+
+/**
+ * @def FOGOFWAR_MORTON_TILE_LAYOUT
+ * @brief 为1时块内瓦片按Z序（Morton）排列，为0时按行主序排列。可通过Build.cs的PublicDefinitions切换。
+ * @details 两种布局下块本身都是 ChunkSize x ChunkSize 的分块，因此一个视野圆盘只会触及少量块。
+ * 行主序下沿X方向的射线每一步跨越一整行（64个瓦片），Morton序下相邻瓦片在两个方向上都落在同一缓存行附近。
+ * 使用控制台命令 FogOfWar.BenchmarkTileLayout 比较两种布局在当前硬件上的表现。
+ */
+#ifndef FOGOFWAR_MORTON_TILE_LAYOUT
+#define FOGOFWAR_MORTON_TILE_LAYOUT 0
+#endif
+
+/**
+ * @struct FFogOfWarTileLayout
+ * @brief 分块瓦片存储的索引辅助函数。
+ * @details 全局一维索引（X*GridResolution.Y+Y，见 AFogOfWar::GetGlobalIndex）仍是行主序，
+ * 它直接对应纹理的像素顺序；只有高度平面和计数平面使用这里的分块布局。
+ */
+struct FOGOFWAR_API FFogOfWarTileLayout
+{
+	/// @brief 块边长的以2为底的对数。
+	static constexpr int32 ChunkSizeLog2 = 6;
+	/// @brief 块的边长（瓦片数）。
+	static constexpr int32 ChunkSize = 1 << ChunkSizeLog2;
+	/// @brief 每个块包含的瓦片数量。
+	static constexpr int32 TilesPerChunk = ChunkSize * ChunkSize;
+
+	/// @brief 每个轴上的块数量。
+	FORCEINLINE static FIntPoint GetNumChunks(FIntPoint GridResolution)
+	{
+		return FIntPoint(FMath::DivideAndRoundUp(GridResolution.X, ChunkSize), FMath::DivideAndRoundUp(GridResolution.Y, ChunkSize));
+	}
+
+	/// @brief 瓦片所在块的索引。
+	FORCEINLINE static int32 GetChunkIndex(FIntPoint IJ, int32 NumChunksY)
+	{
+		return (IJ.X >> ChunkSizeLog2) * NumChunksY + (IJ.Y >> ChunkSizeLog2);
+	}
+
+	/// @brief 块覆盖的瓦片范围（全局瓦片坐标，Min包含、Max不包含），边缘块会被网格截断。
+	FORCEINLINE static FIntRect GetChunkTileRect(int32 ChunkIndex, FIntPoint NumChunks, FIntPoint GridResolution)
+	{
+		const FIntPoint ChunkMinIJ(ChunkIndex / NumChunks.Y * ChunkSize, ChunkIndex % NumChunks.Y * ChunkSize);
+		return FIntRect(ChunkMinIJ, (ChunkMinIJ + FIntPoint(ChunkSize)).ComponentMin(GridResolution));
+	}
+
+	/// @brief 行主序布局下瓦片在块内的偏移。
+	FORCEINLINE static int32 GetRowMajorOffsetInChunk(FIntPoint IJ)
+	{
+		return ((IJ.X & (ChunkSize - 1)) << ChunkSizeLog2) | (IJ.Y & (ChunkSize - 1));
+	}
+
+	/// @brief Morton布局下瓦片在块内的偏移。Y占据偶数位，X占据奇数位。
+	FORCEINLINE static int32 GetMortonOffsetInChunk(FIntPoint IJ)
+	{
+		return static_cast<int32>((SpreadBits(IJ.X & (ChunkSize - 1)) << 1) | SpreadBits(IJ.Y & (ChunkSize - 1)));
+	}
+
+	/// @brief 当前布局下瓦片在块内的偏移。
+	FORCEINLINE static int32 GetOffsetInChunk(FIntPoint IJ)
+	{
+#if FOGOFWAR_MORTON_TILE_LAYOUT
+		return GetMortonOffsetInChunk(IJ);
+#else
+		return GetRowMajorOffsetInChunk(IJ);
+#endif
+	}
+
+	/// @brief 当前布局下块内偏移对应的块内坐标（0到ChunkSize-1）。
+	FORCEINLINE static FIntPoint GetIJInChunk(int32 OffsetInChunk)
+	{
+#if FOGOFWAR_MORTON_TILE_LAYOUT
+		return FIntPoint(CompactBits(static_cast<uint32>(OffsetInChunk) >> 1), CompactBits(static_cast<uint32>(OffsetInChunk)));
+#else
+		return FIntPoint(OffsetInChunk >> ChunkSizeLog2, OffsetInChunk & (ChunkSize - 1));
+#endif
+	}
+
+	/// @brief 将低ChunkSizeLog2位的每一位之间插入一个0位。
+	FORCEINLINE static constexpr uint32 SpreadBits(uint32 Value)
+	{
+		Value = (Value | (Value << 4)) & 0x0F0Fu;
+		Value = (Value | (Value << 2)) & 0x3333u;
+		Value = (Value | (Value << 1)) & 0x5555u;
+		return Value;
+	}
+
+	/// @brief SpreadBits 的逆运算，取出所有偶数位。
+	FORCEINLINE static constexpr uint32 CompactBits(uint32 Value)
+	{
+		Value &= 0x5555u;
+		Value = (Value | (Value >> 1)) & 0x3333u;
+		Value = (Value | (Value >> 2)) & 0x0F0Fu;
+		Value = (Value | (Value >> 4)) & 0x00FFu;
+		return Value;
+	}
+
+	/**
+	 * @brief       比较行主序、分块行主序和分块Morton三种布局下视野计算的内存访问开销，并输出到日志。
+	 * @details     在合成的高度平面上为随机分布的观察者沿DDA射线读取高度，同时写入计数平面，模拟视野计算的两个热循环。
+	 * @param       GridResolution                 数据类型: FIntPoint
+	 * @details     合成网格的分辨率。
+	 * @param       GridSpaceRadius                数据类型: float
+	 * @details     观察者在网格空间中的视野半径。
+	 * @param       NumObservers                   数据类型: int32
+	 * @details     观察者数量。
+	 */
+	static void RunBenchmark(FIntPoint GridResolution, float GridSpaceRadius, int32 NumObservers);
+};
@@ -15,7 +15,7 @@
 /**
  * @enum ETileState
  * @brief 表示单个瓦片（Tile）的可见性状态。
- * @details 用于在视野计算的缓存中记录每个瓦片是否可见。
+ * @details 仅在视野计算期间作为草稿状态使用，计算完成后只保留“可见”这一位。
  */
 UENUM()
 enum class ETileState : uint8
@@ -52,13 +52,27 @@ struct FOGOFWAR_API FVisionUnitData
 	UPROPERTY()
 	FIntPoint LocalAreaCachedMinIJ = FIntPoint::ZeroValue;
 
-	/// @brief 局部区域内所有瓦片状态的缓存数组。
+	/// @brief 局部区域内可见瓦片的位集，每个瓦片占1位，按局部一维索引排列。
+	/// @details 只记录真正贡献了可见性计数的瓦片（位于全局网格内且在视野圆内），因此擦除时无需重复检查。
+	/// 与每瓦片一个字节的状态数组相比，内存占用约为其1/8。
 	UPROPERTY()
-	TArray<ETileState> LocalAreaTilesCachedStates;
+	TArray<uint32> LocalAreaVisibleBits;
+
+	/// @brief 视野计算期间使用的三态草稿缓冲区。
+	/// @details 仅在计算期间有效。计算完成后打包进LocalAreaVisibleBits并归还给线程本地的复用池，不随Fragment长期保存。
+	TArray<ETileState> LocalAreaTilesScratchStates;
 
 	/// @brief 缓存的原点在全局网格中的一维索引。
 	UPROPERTY()
-	int CachedOriginGlobalIndex = 0;
+	int64 CachedOriginGlobalIndex = 0;
+
+	/// @brief 此视野贡献计入的队伍。
+	UPROPERTY()
+	uint8 TeamIndex = 0;
+
+	/// @brief 计算此缓存时观察者的高度（世界Z坐标）。
+	UPROPERTY()
+	float CachedObserverHeight = 0.0f;
 
 	/// @brief 标记此结构体是否已包含有效的缓存数据。
 	UPROPERTY()
@@ -72,8 +86,29 @@ struct FOGOFWAR_API FVisionUnitData
 	FORCEINLINE FIntPoint GetLocalIJ(int LocalIndex) const { return { LocalIndex / LocalAreaTilesResolution, LocalIndex % LocalAreaTilesResolution }; }
 	/// @brief 检查局部二维坐标是否有效。
 	FORCEINLINE bool IsLocalIJValid(FIntPoint IJ) const { return (IJ.X >= 0) & (IJ.Y >= 0) & (IJ.X < LocalAreaTilesResolution) & (IJ.Y < LocalAreaTilesResolution); }
-	/// @brief 根据局部一维索引获取瓦片状态。
-	FORCEINLINE ETileState& GetLocalTileState(int LocalIndex) { return LocalAreaTilesCachedStates[LocalIndex]; }
+	/// @brief 位集中每个字的位数。
+	static constexpr int32 BitsPerWord = 32;
+	/// @brief 局部区域瓦片总数。
+	FORCEINLINE int32 GetNumLocalTiles() const { return LocalAreaTilesResolution * LocalAreaTilesResolution; }
+	/// @brief 检查局部一维索引对应的瓦片是否在缓存的视野中可见。
+	FORCEINLINE bool IsLocalTileVisible(int LocalIndex) const { return (LocalAreaVisibleBits[LocalIndex / BitsPerWord] >> (LocalIndex % BitsPerWord)) & 1u; }
+	/// @brief 以字为单位遍历所有可见瓦片，跳过全零的字。Function签名为 void(int32 LocalIndex)。
+	template<typename FunctionType>
+	FORCEINLINE void ForEachVisibleLocalIndex(FunctionType&& Function) const
+	{
+		for (int32 WordIndex = 0; WordIndex < LocalAreaVisibleBits.Num(); WordIndex++)
+		{
+			uint32 Word = LocalAreaVisibleBits[WordIndex];
+			while (Word != 0)
+			{
+				const int32 BitIndex = FMath::CountTrailingZeros(Word);
+				Word &= Word - 1;
+				Function(WordIndex * BitsPerWord + BitIndex);
+			}
+		}
+	}
+	/// @brief 根据局部一维索引获取瓦片的草稿状态（仅在视野计算期间有效）。
+	FORCEINLINE ETileState& GetLocalTileState(int LocalIndex) { return LocalAreaTilesScratchStates[LocalIndex]; }
 	/// @brief 根据局部二维坐标获取瓦片状态。
 	FORCEINLINE ETileState& GetLocalTileState(FIntPoint IJ) { checkSlow(IsLocalIJValid(IJ)); return GetLocalTileState(GetLocalIndex(IJ)); }
 	/// @brief 将局部二维坐标转换为全局二维坐标。
@@ -109,7 +144,8 @@ struct FOGOFWAR_API FMassVisionEntityTag : public FMassTag
  * @struct FMassStationaryTag
  * @brief 标记一个实体是固定不动的。
  * @details 拥有此标签的实体被视为静态。系统会在初始化时计算一次其视野，然后缓存结果。
- * 只要该实体不被销毁，其视野贡献将不再重复计算，这是针对建筑等静态单位的关键性能优化。
+ * 此后它们被排除在所有逐帧的视野查询和观察者之外，只有当其局部区域内的地形高度发生变化时才重新计算，
+ * 被销毁时其视野贡献由 UVisionRemoveProcessor 擦除。这是针对建筑等静态单位的关键性能优化。
  */
 USTRUCT()
 struct FOGOFWAR_API FMassStationaryTag : public FMassTag
@@ -130,15 +166,52 @@ struct FOGOFWAR_API FMassMinimapVisibleTag : public FMassTag
 };
 
 /**
- * @struct FMassLocationChangedTag
- * @brief 标记一个实体的位置自上一帧起已发生改变。
- * @details 这是一个由Mass框架的观察器（Observer）动态添加和移除的临时标签。
- * 视野更新处理器（UVisionProcessor）只查询带有此标签的实体，从而确保只为移动中的单位重新计算视野。
+ * @enum EFogOfWarDirtyFlags
+ * @brief 实体上待处理的变化，由观察处理器原地置位、由对应的更新处理器清除。
+ */
+enum class EFogOfWarDirtyFlags : uint8
+{
+	None = 0,
+	/// @brief 视野需要重新计算（新生成、移动到新的视野瓦片或脚下地形发生变化）。
+	Vision = 1 << 0,
+	/// @brief 实体所在的小地图格子发生了变化。
+	MinimapCell = 1 << 1,
+	All = Vision | MinimapCell
+};
+ENUM_CLASS_FLAGS(EFogOfWarDirtyFlags);
+
+/**
+ * @struct FMassFogOfWarDirtyFragment
+ * @brief 存储实体待处理的变化标志。
+ * @details 标志直接写入Fragment而不是以Tag的形式增删，因此每帧的变化检测不会产生任何结构性修改（原型迁移）。
+ * 单位诞生时所有标志均被置位，以便更新处理器在第一帧处理它。
  */
 USTRUCT()
-struct FOGOFWAR_API FMassLocationChangedTag : public FMassTag
+struct FOGOFWAR_API FMassFogOfWarDirtyFragment : public FMassFragment
 {
 	GENERATED_BODY()
+
+	EFogOfWarDirtyFlags Flags = EFogOfWarDirtyFlags::All;
+
+	/// @brief 视野标志被置位时的帧号（GFrameCounter的低32位），用于计算视野更新的等待时间。
+	/// @details 单位诞生时标志已经置位，帧号由 UInitialVisionProcessor 在第一次看到该单位时记录，在此之前为 UnstampedFrame。
+	uint32 VisionDirtyFrame = UnstampedFrame;
+
+	/// @brief 尚未记录帧号时 VisionDirtyFrame 的值。
+	static constexpr uint32 UnstampedFrame = MAX_uint32;
+};
+
+/**
+ * @struct FMassFogOfWarDirtyChunkFragment
+ * @brief 块级的变化标志：块内任意实体的 FMassFogOfWarDirtyFragment 置位时，对应的位也被置位。
+ * @details 更新处理器通过块过滤器（见 FFogOfWarMassHelpers::HasDirtyChunk）跳过没有待处理实体的块，处理完一个块后清除对应的位。
+ */
+USTRUCT()
+struct FOGOFWAR_API FMassFogOfWarDirtyChunkFragment : public FMassChunkFragment
+{
+	GENERATED_BODY()
+
+	EFogOfWarDirtyFlags Flags = EFogOfWarDirtyFlags::All;
 };
 
 /**
@@ -168,6 +241,10 @@ struct FOGOFWAR_API FMassVisionFragment : public FMassFragment
 	/// @details 定义了该实体能够揭示周围区域的最大距离。
 	UPROPERTY(EditAnywhere, Category = "Fog of War", meta = (ClampMin = 0.0f, UIMin = 0.0f))
 	float SightRadius = 1000.0f;
+
+	/// @brief 该实体所属的队伍，视野只计入此队伍（及通过同盟关系共享给其盟友）。
+	UPROPERTY(EditAnywhere, Category = "Fog of War", meta = (ClampMin = 0, ClampMax = 7, UIMin = 0, UIMax = 7))
+	uint8 TeamIndex = 0;
 };
 
 /**
@@ -210,22 +287,10 @@ struct FOGOFWAR_API FMassMinimapRepresentationFragment : public FMassFragment
     float Intensity = 1.0f;
 };
 
-/**
- * @struct FMinimapCellChangedTag
- * @brief [OPTIMIZATION] 标记一个实体的小地图格子坐标自上次检查后已发生改变。
- * @details 这是一个由 UMinimapObserverProcessor 动态添加和移除的临时标签。
- * 小地图数据收集器只查询带有此标签的实体，从而确保只为跨越了格子边界的单位更新数据。
- */
-USTRUCT()
-struct FOGOFWAR_API FMinimapCellChangedTag : public FMassTag
-{
-	GENERATED_BODY()
-};
-
 /**
  * @struct FMassPreviousMinimapCellFragment
  * @brief [OPTIMIZATION] 存储实体在上一帧所在的小地图格子坐标。
- * @details UMinimapObserverProcessor 使用此Fragment来检测单位是否移动到了新的小地图格子。
+ * @details UMinimapCellObserver 使用此Fragment来检测单位是否移动到了新的小地图格子。
  */
 USTRUCT()
 struct FOGOFWAR_API FMassPreviousMinimapCellFragment : public FMassFragment
@@ -5,6 +5,7 @@
 #include "MassExecutionContext.h" // Required for FMassExecutionContext
 #include "MassProcessor.h"
 #include "MassRepresentationFragments.h" // For FMassVisibilityFragment
+#include "MassFogOfWarFragments.h"
 
 #include "MassFogOfWarProcessors.generated.h"
 
@@ -24,23 +25,218 @@ class AFogOfWar;
 struct FOGOFWAR_API FFogOfWarMassHelpers
 {
 	/**
-	 * @brief       处理单个实体块（Entity Chunk）中的所有实体。
-	 * @details     遍历给定执行上下文（Context）中的所有实体，并为每个实体调用AFogOfWar主控Actor的视野更新函数。
+	 * @brief       对块内视野待更新、且按LOD轮到本帧的实体调用 Function。
+	 * @details     UVisionProcessor 的各条执行路径共用的收集步骤。
+	 *              实体的视野标志不在这里清除，由调用者决定何时清除。
+	 *
+	 * @param       MaxStalenessFrames             数据类型: uint32
+	 * @details     等待帧数加1达到此值的实体不受LOD周期的限制（见 FMassFogOfWarDirtyFragment::VisionDirtyFrame）。为0时不检查等待时间。
+	 * @param       Function                       数据类型: void(int32 EntityIndex, FMassFogOfWarDirtyFragment& Dirty, uint32 AgeFrames)
+	 * @details     对每个轮到本帧的实体调用，AgeFrames为视野标志置位以来的帧数。
+	 * @return      bool 是否有实体因LOD周期被推迟（其标志保持置位）。
+	 */
+	template<typename FunctionType>
+	static bool ForEachDueVisionEntity(FMassExecutionContext& Context, const AFogOfWar* FogOfWar, uint32 MaxStalenessFrames, FunctionType&& Function)
+	{
+		const TArrayView<FMassFogOfWarDirtyFragment> DirtyList = Context.GetMutableFragmentView<FMassFogOfWarDirtyFragment>();
+		const TConstArrayView<FMassRepresentationLODFragment> LODList = Context.GetFragmentView<FMassRepresentationLODFragment>();
+		const uint32 CurrentFrame = static_cast<uint32>(GFrameCounter);
+
+		bool bHasDeferredEntities = false;
+		for (int32 EntityIndex = 0; EntityIndex < Context.GetNumEntities(); ++EntityIndex)
+		{
+			FMassFogOfWarDirtyFragment& Dirty = DirtyList[EntityIndex];
+			if (!EnumHasAnyFlags(Dirty.Flags, EFogOfWarDirtyFlags::Vision))
+			{
+				continue;
+			}
+
+			// the staleness limit also overrides the LOD period, which may be longer than MaxStalenessFrames
+			const uint32 AgeFrames = CurrentFrame - Dirty.VisionDirtyFrame;
+			const bool bOverdue = MaxStalenessFrames > 0 && AgeFrames + 1 >= MaxStalenessFrames;
+			if (!bOverdue && !IsVisionUpdateDue(FogOfWar, Context.GetEntity(EntityIndex), GetVisionLOD(Context, LODList, EntityIndex)))
+			{
+				bHasDeferredEntities = true;
+				continue;
+			}
+
+			Function(EntityIndex, Dirty, AgeFrames);
+		}
+		return bHasDeferredEntities;
+	}
+
+	/**
+	 * @brief       块过滤器：块的 FMassFogOfWarDirtyChunkFragment 是否带有给定标志。
+	 * @details     查询必须以 AddChunkRequirement 声明 FMassFogOfWarDirtyChunkFragment。
+	 */
+	static bool HasDirtyChunk(const FMassExecutionContext& Context, EFogOfWarDirtyFlags Flag)
+	{
+		return EnumHasAnyFlags(Context.GetChunkFragment<FMassFogOfWarDirtyChunkFragment>().Flags, Flag);
+	}
+
+	/**
+	 * @brief       块内实体用于视野更新频率的LOD级别。
+	 * @details     取自实体的 FMassRepresentationLODFragment（块中没有时视为High），被距离或视锥体剔除的块至少为Low。
+	 */
+	static EMassLOD::Type GetVisionLOD(const FMassExecutionContext& Context, TConstArrayView<FMassRepresentationLODFragment> LODList, int32 EntityIndex);
+
+	/**
+	 * @brief       实体的视野更新是否轮到本帧。
+	 * @details     周期取自 AFogOfWar::VisionUpdatePeriodHigh 等属性。同一周期内的实体按实体索引错开到不同的帧，
+	 *              避免所有低LOD单位集中在同一帧更新。bVisionLOD 关闭时总是返回true。
+	 */
+	static bool IsVisionUpdateDue(const AFogOfWar* FogOfWar, FMassEntityHandle Entity, EMassLOD::Type LOD);
+
+	/// @brief 收集所有本地玩家的视点位置。没有本地玩家（如专用服务器）时结果为空。
+	static void GetLocalViewLocations(const UWorld* World, TArray<FVector, TInlineAllocator<4>>& OutViewLocations);
+
+	/// @brief 到最近视点的水平距离。没有视点时返回0。
+	static double GetDistanceToNearestView(const FVector& Location, TConstArrayView<FVector> ViewLocations);
+
+	/**
+	 * @brief       为单个视野单位重新计算视野，并把结果应用到全局可见性计数上。
+	 * @details     UVisionProcessor::ExecuteAll 对每个待更新实体调用此函数，也供只需更新部分实体的处理器（如静止单位处理器）直接使用。
 	 *
-	 * @param       Context                        数据类型: FMassExecutionContext&
-	 * @details     Mass执行上下文，包含了当前正在处理的实体块信息。
 	 * @param       FogOfWar                       数据类型: AFogOfWar*
 	 * @details     指向场景中唯一的AFogOfWar主控Actor的指针。
+	 * @param       Location                       数据类型: const FVector&
+	 * @details     视野单位当前的世界坐标。
+	 * @param       Vision                         数据类型: const FMassVisionFragment&
+	 * @details     视野单位的视野半径与所属队伍。
+	 * @param       CachedVisionData               数据类型: FVisionUnitData&
+	 * @details     上一次应用到计数器上的视野缓存，计算完成后被新视野替换。
+	 * @param       bAtomic                        数据类型: bool
+	 * @details     是否使用原子操作（并行视野计算时为true）。
+	 */
+	static void UpdateEntityVision(AFogOfWar* FogOfWar, const FVector& Location, const FMassVisionFragment& Vision, FVisionUnitData& CachedVisionData, bool bAtomic);
+
+	/**
+	 * @brief       只计算视野单位的新视野，不写入可见性计数。
+	 * @details     只读取瓦片高度，可以从多个线程同时调用。单位位于网格外时结果不包含缓存数据（bHasCachedData为false）。
+	 *
+	 * @param       OutVisionUnitData              数据类型: FVisionUnitData&
+	 * @details     输出的新视野。
+	 */
+	static void ComputeEntityFootprint(AFogOfWar* FogOfWar, const FVector& Location, const FMassVisionFragment& Vision, FVisionUnitData& OutVisionUnitData);
+
+	/**
+	 * @brief       把 ComputeEntityFootprint 计算出的新视野应用到可见性计数上，并替换旧的视野缓存。
+	 * @details     Delta模式下同一队伍的新旧视野通过 ApplyFootprintDelta 比较，否则先擦除旧视野再写入新视野。
+	 *
+	 * @param       CachedVisionData               数据类型: FVisionUnitData&
+	 * @details     上一次应用到计数器上的视野缓存，被新视野替换。
+	 * @param       VisionUnitData                 数据类型: FVisionUnitData&&
+	 * @details     新计算出的视野。
+	 * @param       bAtomic                        数据类型: bool
+	 * @details     是否使用原子操作（并行视野计算时为true）。
 	 */
-	static void ProcessEntityChunk(FMassExecutionContext& Context, AFogOfWar* FogOfWar);
+	static void ApplyEntityFootprint(AFogOfWar* FogOfWar, FVisionUnitData& CachedVisionData, FVisionUnitData&& VisionUnitData, bool bAtomic);
+
+	/**
+	 * @brief       清空所有可见性计数，并从给定的视野位集重新累加。
+	 * @details     视野位集先按所覆盖的计数块分桶，然后按块并行光栅化：每个块（包括其所有队伍）只由一个任务写入，
+	 *              因此计数器的写入是连续的且不需要原子操作。Footprints 必须包含所有计入了计数的视野。
+	 *
+	 * @param       Footprints                     数据类型: TConstArrayView<const FVisionUnitData*>
+	 * @details     所有带有缓存数据的视野。
+	 * @param       bParallel                      数据类型: bool
+	 * @details     是否按块分发到工作线程。
+	 */
+	static void RebuildCountersFromFootprints(AFogOfWar* FogOfWar, TConstArrayView<const FVisionUnitData*> Footprints, bool bParallel);
+
+	/**
+	 * @brief       为视野计算准备三态草稿缓冲区。
+	 * @details     缓冲区取自线程本地的复用池，并被初始化为 ETileState::Unknown。必须与 ReleaseScratchStates 成对调用。
+	 */
+	static void AcquireScratchStates(FVisionUnitData& VisionUnitData);
+
+	/**
+	 * @brief       将草稿缓冲区归还给线程本地的复用池。
+	 */
+	static void ReleaseScratchStates(FVisionUnitData& VisionUnitData);
+
+	/**
+	 * @brief       将草稿状态打包为可见位集。
+	 * @details     只有位于全局网格内、处于视野圆内且状态为 Visible 的瓦片会被置位，这正是需要增加可见性计数的瓦片集合。
+	 *
+	 * @param       VisionUnitData                 数据类型: FVisionUnitData&
+	 * @details     已完成计算、草稿缓冲区仍然有效的视野缓存。
+	 * @param       OriginGlobalIJ                 数据类型: FIntPoint
+	 * @details     观察者所在瓦片的全局坐标。
+	 */
+	static void PackVisibleTiles(FVisionUnitData& VisionUnitData, FIntPoint OriginGlobalIJ);
+
+	/**
+	 * @brief       将视野位集中的所有瓦片的可见性计数加1。
+	 * @param       bAtomic                        数据类型: bool
+	 * @details     是否使用原子操作（并行视野计算时为true）。
+	 */
+	static void AddFootprintToCounters(AFogOfWar* FogOfWar, const FVisionUnitData& VisionUnitData, bool bAtomic);
+
+	/**
+	 * @brief       将视野位集中的所有瓦片的可见性计数减1，即“擦除”该单位的视野贡献。
+	 * @param       bAtomic                        数据类型: bool
+	 * @details     是否使用原子操作（并行视野计算时为true）。
+	 */
+	static void RemoveFootprintFromCounters(AFogOfWar* FogOfWar, const FVisionUnitData& VisionUnitData, bool bAtomic);
+
+	/**
+	 * @brief       只对新旧视野之间发生变化的瓦片更新可见性计数。
+	 * @details     按 LocalAreaCachedMinIJ 对齐两个位集，逐行以32列为单位做异或：
+	 *              仅在新视野中的瓦片加1，仅在旧视野中的瓦片减1，两者都可见的瓦片保持不变。
+	 *              对缓慢移动的单位，新旧视野通常重叠90%以上，可大幅减少对全局瓦片的写入。
+	 *
+	 * @param       PreviousVisionUnitData         数据类型: const FVisionUnitData&
+	 * @details     上一次应用到计数器上的视野。
+	 * @param       VisionUnitData                 数据类型: const FVisionUnitData&
+	 * @details     新计算出的视野。
+	 * @param       bAtomic                        数据类型: bool
+	 * @details     是否使用原子操作（并行视野计算时为true）。
+	 */
+	static void ApplyFootprintDelta(AFogOfWar* FogOfWar, const FVisionUnitData& PreviousVisionUnitData, const FVisionUnitData& VisionUnitData, bool bAtomic);
+
+	/**
+	 * @brief       使用DDA内核计算单个视野单位的局部可见性。
+	 * @details     以螺旋顺序遍历局部区域，从每个状态未知的瓦片向原点发射一条DDA射线，并把射线经过的瓦片一并标记。
+	 *
+	 * @param       FogOfWar                       数据类型: AFogOfWar*
+	 * @details     提供瓦片高度与遮挡判断的主控Actor。
+	 * @param       ObserverHeight                 数据类型: float
+	 * @details     观察者的高度（世界Z坐标）。
+	 * @param       OriginGlobalIJ                 数据类型: FIntPoint
+	 * @details     观察者所在瓦片的全局坐标。
+	 * @param       OriginLocalIJ                  数据类型: FIntPoint
+	 * @details     观察者所在瓦片的局部坐标。
+	 * @param       VisionUnitData                 数据类型: FVisionUnitData&
+	 * @details     已初始化局部区域的视野缓存，结果写入其中。
+	 */
+	static void ComputeVisibilityDDA(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData);
+
+	/**
+	 * @brief       使用对称阴影投射内核计算单个视野单位的局部可见性。
+	 * @details     按四个象限逐行扫描视野圆盘，遮挡瓦片会收窄后续行的斜率范围，因此每个瓦片只被访问一次。
+	 *              参数含义与 ComputeVisibilityDDA 相同。
+	 */
+	static void ComputeVisibilityShadowcasting(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData);
+
+	/**
+	 * @brief       使用预计算射线查找表计算单个视野单位的局部可见性。
+	 * @details     结果与 ComputeVisibilityDDA 逐位一致，但射线路径取自 AFogOfWar::GetOrBuildRayTable，
+	 *              内循环只需沿射线树的父节点遍历并比较瓦片高度。参数含义与 ComputeVisibilityDDA 相同。
+	 */
+	static void ComputeVisibilityRayTable(AFogOfWar* FogOfWar, float ObserverHeight, FIntPoint OriginGlobalIJ, FIntPoint OriginLocalIJ, FVisionUnitData& VisionUnitData);
 };
 
 /**
  * @class UInitialVisionProcessor
  * @brief 为新生成的视野单位执行首次视野计算。
  * @details 此处理器在Mass处理流程的同步阶段（Sync）运行。
- * 它查询所有拥有视野能力（FMassVisionEntityTag）但尚未被初始化（无FMassVisionInitializedTag）的实体，
+ * 它查询所有拥有视野能力（FMassVisionEntityTag）但尚未被初始化（无FMassVisionInitializedTag）的实体（包括静止单位），
  * 为它们执行一次视野计算，并添加FMassVisionInitializedTag以防止重复计算。
+ *
+ * 一帧内生成的所有单位被收集到同一个批次中，通过ParallelFor并行计算视野；初始化标签以一条批量命令添加，
+ * 而不是为每个实体各发一条延迟命令。若 AFogOfWar::InitialVisionAmortizationFrames 大于1，
+ * 批次被分摊到多帧完成，离本地玩家视点最近的单位优先；生成已满这么多帧的单位无论远近都在当帧完成。
  */
 UCLASS()
 class FOGOFWAR_API UInitialVisionProcessor : public UMassProcessor
@@ -54,7 +250,8 @@ protected:
 	/**
 	 * @brief       执行处理器逻辑。
 	 * @details     在每一帧（或根据设置的频率）对查询到的实体块执行此函数。
-	 *              它会调用辅助函数ProcessEntityChunk来计算视野，并为处理过的实体添加FMassVisionInitializedTag。
+	 *              它会收集所有待初始化的实体，先选出已到期限的实体，再按本帧预算补上其余实体中最靠近视点的部分，
+	 *              并行计算后为处理过的实体添加FMassVisionInitializedTag。
 	 *
 	 * @param       EntityManager                  数据类型: FMassEntityManager&
 	 * @details     Mass实体管理器，用于与实体系统交互。
@@ -70,14 +267,37 @@ private:
 
 	/// @brief 处理器使用的实体查询对象，在ConfigureQueries时被定义。
 	FMassEntityQuery EntityQuery;
+
+	/// @brief 一个待初始化的实体。指针指向块内的Fragment，只在一次Execute内有效。
+	struct FPendingEntity
+	{
+		FMassEntityHandle Entity;
+		FVector Location = FVector::ZeroVector;
+		const FMassVisionFragment* Vision = nullptr;
+		FVisionUnitData* CachedVisionData = nullptr;
+		FMassFogOfWarDirtyFragment* Dirty = nullptr;
+	};
+
+	/// @brief 本帧收集到的待初始化实体，作为复用的缓冲区。
+	TArray<FPendingEntity> PendingEntities;
+
+	/// @brief 本帧完成初始化的实体，作为复用的缓冲区。
+	TArray<FMassEntityHandle> InitializedEntities;
+
+	/// @brief 当前积压的每帧处理数量，积压清空后归零。
+	int32 BudgetPerFrame = 0;
 };
 
 /**
  * @class UVisionProcessor
  * @brief 为位置发生变化的视野单位更新视野。
  * @details 此处理器在Mass处理流程的同步阶段（Sync）运行。
- * 它只查询那些位置发生了变化（拥有FMassLocationChangedTag）的视野提供者实体。
+ * 它只处理视野标志被 UMassLocationChangedObserver 置位（见 FMassFogOfWarDirtyFragment）的视野提供者实体，
+ * 并通过块过滤器跳过没有待更新实体的块。
  * 这是系统的核心性能优化，确保只有移动中的单位才触发昂贵的视野更新计算。
+ *
+ * 若 AFogOfWar::VisionBudgetMs 大于0，待更新的实体会进入按优先级排序的队列，每帧只在时间预算内处理队首的实体（见 ExecuteBudgeted）。
+ * 否则若 AFogOfWar::bAdaptiveFullRebuild 为true，移动单位足够多时改为整体重建可见性计数（见 ExecuteAdaptive）。
  */
 UCLASS()
 class FOGOFWAR_API UVisionProcessor : public UMassProcessor
@@ -91,7 +311,7 @@ protected:
 	/**
 	 * @brief       执行处理器逻辑。
 	 * @details     在每一帧（或根据设置的频率）对查询到的实体块执行此函数。
-	 *              它会调用辅助函数ProcessEntityChunk来更新移动单位的视野。
+	 *              它会调用 ExecuteAll 来更新移动单位的视野，或按配置交给 ExecuteBudgeted 或 ExecuteAdaptive。
 	 *
 	 * @param       EntityManager                  数据类型: FMassEntityManager&
 	 * @details     Mass实体管理器，用于与实体系统交互。
@@ -102,18 +322,165 @@ protected:
 	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
 
 private:
+	/// @brief 一个待更新的实体。指针指向块内的Fragment，只在一次Execute内有效。
+	struct FPendingEntity
+	{
+		FVector Location = FVector::ZeroVector;
+		const FMassVisionFragment* Vision = nullptr;
+		FVisionUnitData* CachedVisionData = nullptr;
+		FMassFogOfWarDirtyFragment* Dirty = nullptr;
+		FMassFogOfWarDirtyChunkFragment* ChunkDirty = nullptr;
+		float Priority = 0.0f;
+		bool bOverdue = false;
+	};
+
+	/**
+	 * @brief       收集所有块中视野待更新、且按LOD轮到本帧的实体到 PendingEntities，并清除它们的视野标志。
+	 * @details     没有被推迟实体的块，其块标志也一并清除。
+	 */
+	void GatherDueEntities(FMassExecutionContext& Context, AFogOfWar* FogOfWar);
+
+	/**
+	 * @brief       更新所有待更新实体的视野。
+	 * @details     先跨所有块收集待更新实体，再以一次ParallelFor分发，避免许多小块各自只有少量实体时无法并行。
+	 *              若 AFogOfWar::bParallelVision 为true，实体被分发到工作线程，计数器以原子方式更新。
+	 */
+	void ExecuteAll(FMassExecutionContext& Context, AFogOfWar* FogOfWar);
+
+	/**
+	 * @brief       在 AFogOfWar::VisionBudgetMs 的时间预算内按优先级更新待更新实体的视野。
+	 * @details     优先级 = (等待帧数+1) * 视野半径 / max(到最近视点的距离, 视野半径)：
+	 *              视点附近的单位、视野大的单位和等待已久的单位优先。等待达到 AFogOfWar::MaxVisionStalenessFrames 的单位
+	 *              无论预算是否用尽、也无论LOD周期是否轮到都会在本帧更新。未被处理的实体保留标志，下一帧继续排队。
+	 */
+	void ExecuteBudgeted(FMassExecutionContext& Context, AFogOfWar* FogOfWar);
+
+	/**
+	 * @brief       先并行计算所有待更新实体的新视野，再在增量更新与整体重建之间选择较便宜的一种写入计数。
+	 * @details     增量更新的耗时与移动单位数量成正比，整体重建的耗时与全部视野数量成正比，
+	 *              因此当 移动单位数 / 视野总数 超过 (每个视野的重建耗时 / 每个单位的增量耗时) 时整体重建更快。
+	 *              两种耗时在各自执行时以指数移动平均更新；都测得之前使用 AFogOfWar::FullRebuildInitialThreshold。
+	 *              视野总数只计入带有缓存数据的视野。移动比例与阈值相差在 AFogOfWar::FullRebuildProbeMargin 倍以内时，
+	 *              没有被选中的方式在尚未测得、或超过 AFogOfWar::FullRebuildProbeIntervalFrames 帧没有测量时被探测执行一次。
+	 */
+	void ExecuteAdaptive(FMassExecutionContext& Context, AFogOfWar* FogOfWar);
+
 	/// @brief 指向场景中AFogOfWar主控Actor的指针，在Initialize时被缓存。
 	TObjectPtr<AFogOfWar> FogOfWarActor;
 
 	/// @brief 处理器使用的实体查询对象，在ConfigureQueries时被定义。
 	FMassEntityQuery EntityQuery;
+
+	/// @brief 查询所有可能计入了可见性计数的实体（包括静止单位），用于整体重建。
+	FMassEntityQuery FootprintQuery;
+
+	/// @brief 本帧排队的实体，作为复用的缓冲区。
+	TArray<FPendingEntity> PendingEntities;
+
+	/// @brief 单个实体视野更新的平均耗时（秒，含并行加速），用于估算每一批能放进剩余预算的实体数量。
+	double AverageSecondsPerEntity = 0.0;
+
+	/// @brief 与 PendingEntities 一一对应的新视野，作为复用的缓冲区。
+	TArray<FVisionUnitData> NewFootprints;
+
+	/// @brief 整体重建时收集的所有视野，作为复用的缓冲区。
+	TArray<const FVisionUnitData*> RebuildFootprints;
+
+	/// @brief 增量方式下每个移动单位写入计数的平均耗时（秒，含并行加速）。
+	double AverageSecondsPerIncrementalApply = 0.0;
+
+	/// @brief 整体重建时每个视野的平均耗时（秒，含清空、分桶与光栅化）。
+	double AverageSecondsPerRebuildFootprint = 0.0;
+
+	/// @brief 最近一次测量增量方式耗时的帧号（GFrameCounter）。
+	uint64 IncrementalApplyMeasuredFrame = 0;
+
+	/// @brief 最近一次测量整体重建耗时的帧号（GFrameCounter）。
+	uint64 RebuildMeasuredFrame = 0;
+};
+
+/**
+ * @class UStationaryVisionProcessor
+ * @brief 为静止的视野单位（拥有FMassStationaryTag，如建筑）计算视野。
+ * @details 静止单位不参与任何逐帧的视野查询和观察者：它们的首次视野由 UInitialVisionProcessor 计算，
+ * 之后仅当其局部区域内的地形高度发生变化（见 AFogOfWar::RefreshHeightfieldRegion）时才重新计算。
+ * 在地形没有变化的帧里，此处理器不会遍历任何实体。
+ */
+UCLASS()
+class FOGOFWAR_API UStationaryVisionProcessor : public UMassProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UStationaryVisionProcessor();
+
+protected:
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+private:
+	/// @brief 指向场景中AFogOfWar主控Actor的指针，在首次执行时被缓存。
+	TObjectPtr<AFogOfWar> FogOfWarActor;
+
+	/// @brief 查询所有已计算过视野的静止单位，仅在地形发生变化时使用。
+	FMassEntityQuery EntityQuery;
+
+	/// @brief 上一次同步时的地形修订号。
+	uint32 SyncedHeightfieldRevision = 0;
+
+	/// @brief 自上次同步以来发生变化的瓦片区域，作为复用的缓冲区。
+	TArray<FIntRect> DirtyTileRects;
+};
+
+/**
+ * @class UVisionRemoveProcessor
+ * @brief 当视野单位被销毁（或移除FMassPreviousVisionFragment）时，从全局可见性计数中擦除它的视野贡献。
+ */
+UCLASS()
+class FOGOFWAR_API UVisionRemoveProcessor : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UVisionRemoveProcessor();
+
+protected:
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+private:
+	TObjectPtr<AFogOfWar> FogOfWarActor;
+	FMassEntityQuery EntityQuery;
+};
+
+/**
+ * @class UFogOfWarDirtyFlagsAddProcessor
+ * @brief 当实体获得 FMassFogOfWarDirtyFragment（即生成）时，把它的初始标志合并到所在块的 FMassFogOfWarDirtyChunkFragment 上。
+ * @details 新实体可能被放进一个标志已被清除的旧块中，没有这一步它会被块过滤器跳过。
+ * 不经过任何逐帧观察处理器的实体（如静止单位）在小地图上的首次更新依赖于此。
+ */
+UCLASS()
+class FOGOFWAR_API UFogOfWarDirtyFlagsAddProcessor : public UMassObserverProcessor
+{
+	GENERATED_BODY()
+
+public:
+	UFogOfWarDirtyFlagsAddProcessor();
+
+protected:
+	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
+	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
+
+private:
+	FMassEntityQuery EntityQuery;
 };
 
 /**
  * @class UDebugStressTestProcessor
- * @brief 【调试】强制为所有可见单位添加 FMassLocationChangedTag 以进行压力测试。
- * @details 当 AFogOfWar 的 bDebugStressTestIgnoreCache 为 true 时，此处理器会运行。
- * 它在 UVisionProcessor 之前执行，确保所有可见单位都能被后续的视野计算处理器捕获。
+ * @brief 【调试】强制为所有视野单位置位视野或小地图标志以进行压力测试。
+ * @details 当 AFogOfWar 的 bDebugStressTestIgnoreCache 或 bDebugStressTestMinimap 为 true，
+ * 或控制台变量 FogOfWar.DebugStressTest 不为0时，此处理器每帧置位对应的标志，否则直接返回。
+ * 它在 UVisionProcessor 之前执行，确保所有移动单位都能被后续的视野计算处理器捕获。静止单位不会被强制重算视野。
  */
 UCLASS()
 class FOGOFWAR_API UDebugStressTestProcessor : public UMassProcessor
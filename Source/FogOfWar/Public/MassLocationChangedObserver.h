@@ -5,9 +5,21 @@
 #include "MassProcessor.h"
 #include "MassLocationChangedObserver.generated.h"
 
+class AFogOfWar;
+struct FMassVisionFragment;
+struct FVisionUnitData;
+
 /**
- * Observes changes in the FTransformFragment and adds a FMassLocationChangedTag to the entity.
- * This triggers the UVisionProcessor to recalculate vision for the moved entity.
+ * Observes changes in the FTransformFragment and sets EFogOfWarDirtyFlags::Vision on the entity's FMassFogOfWarDirtyFragment
+ * (and its chunk's FMassFogOfWarDirtyChunkFragment) in place, without any structural change.
+ * This triggers the UVisionProcessor to recalculate vision for the moved entity later in the same frame.
+ * Entities whose vision tile, local area, sight radius and height bucket all match the cached
+ * FVisionUnitData are skipped, unless the heightfield under their local area changed since the last frame
+ * (see AFogOfWar::MarkHeightfieldDirty). With AFogOfWar::VisionHeightBucketSize at 0 the height must match
+ * exactly and a skipped footprint could not differ. A positive bucket size is a deliberate approximation:
+ * the observer may move by less than one bucket vertically without a recompute, so tiles whose height margin
+ * against the observer is within that distance of the blocking threshold can keep a stale visibility until
+ * something else dirties the entity.
  */
 UCLASS()
 class FOGOFWAR_API UMassLocationChangedObserver : public UMassProcessor
@@ -17,10 +29,35 @@ class FOGOFWAR_API UMassLocationChangedObserver : public UMassProcessor
 public:
 	UMassLocationChangedObserver();
 
+	/** Total number of entities flagged for a vision recompute since the processor was created. */
+	uint64 GetTotalVisionRecomputesRequested() const { return TotalVisionRecomputesRequested; }
+
+	/** Total number of vision recomputes skipped because the entity stayed inside its cached vision tile. */
+	uint64 GetTotalVisionRecomputesSkipped() const { return TotalVisionRecomputesSkipped; }
+
 protected:
 	virtual void Execute(FMassEntityManager& EntityManager, FMassExecutionContext& Context) override;
 	virtual void ConfigureQueries(const TSharedRef<FMassEntityManager>& EntityManager) override;
 
+	/** Returns true if recomputing the vision at Location could give a different footprint than CachedVisionData. */
+	static bool CanVisionChange(const AFogOfWar& FogOfWar, float VisionTileSize, const FVector& Location, const FMassVisionFragment& Vision, const FVisionUnitData& CachedVisionData);
+
+	/** Returns true if the local area of CachedVisionData overlaps a heightfield region that changed since the last execution. */
+	bool IsAffectedByHeightfieldChange(const FVisionUnitData& CachedVisionData) const;
+
 private:
+	TObjectPtr<AFogOfWar> FogOfWarActor;
 	FMassEntityQuery EntityQuery;
-};
\ No newline at end of file
+
+	/** Heightfield revision of the fog actor seen by the previous execution. */
+	uint32 SyncedHeightfieldRevision = 0;
+
+	/** Tile regions whose heights changed since the previous execution. */
+	TArray<FIntRect> DirtyTileRects;
+
+	/** True if the change history was truncated and every entity has to be treated as affected. */
+	bool bAllHeightfieldDirty = false;
+
+	uint64 TotalVisionRecomputesRequested = 0;
+	uint64 TotalVisionRecomputesSkipped = 0;
+};
@@ -32,6 +32,14 @@ protected:
 	UPROPERTY(EditAnywhere, Category = "Vision", meta = (ClampMin = "0.0"))
 	float SightRadius = 1024.0f;
 
+	/** 该单位是否固定不动（例如建筑）。静止单位只在生成时计算一次视野，之后仅在其下方地形变化时重新计算。*/
+	UPROPERTY(EditAnywhere, Category = "Vision", meta = (EditCondition = "SightRadius > 0"))
+	bool bStationary = false;
+
+	/** 该单位所属的队伍（0-7）。视野只对本队伍及其同盟可见。*/
+	UPROPERTY(EditAnywhere, Category = "Vision", meta = (EditCondition = "SightRadius > 0", ClampMin = 0, ClampMax = 7, UIMin = 0, UIMax = 7))
+	uint8 TeamIndex = 0;
+
 	// --- 小地图表示属性 (Minimap Representation Properties) ---
 	/** 是否在小地图上显示该单位的图标。*/
 	UPROPERTY(EditAnywhere, Category = "Minimap")
@@ -6,8 +6,8 @@
 #include "MinimapCellObserver.generated.h"
 
 /**
- * Observes entities with minimap representation and tags them with FMinimapCellChangedTag
- * if they have moved to a new minimap grid cell.
+ * Observes entities with minimap representation and sets EFogOfWarDirtyFlags::MinimapCell on their
+ * FMassFogOfWarDirtyFragment (and chunk) in place if they have moved to a new minimap grid cell.
  */
 UCLASS()
 class FOGOFWAR_API UMinimapCellObserver : public UMassProcessor
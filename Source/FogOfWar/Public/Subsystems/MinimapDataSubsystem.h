@@ -121,8 +121,8 @@ public:
 	static FORCEINLINE FIntPoint ConvertVisionGridLocationToTileIJ_Static(const FVector2f& GridLocation);
 	static FORCEINLINE FIntPoint ConvertWorldLocationToVisionTileIJ_Static(const FVector2D& WorldLocation);
 	static FORCEINLINE FVector2D ConvertVisionTileIJToTileCenterWorldLocation_Static(const FIntPoint& IJ);
-	static FORCEINLINE int32 GetVisionGridGlobalIndex_Static(FIntPoint IJ);
-	static FORCEINLINE FIntPoint GetVisionGridTileIJ_Static(int32 GlobalIndex);
+	static FORCEINLINE int64 GetVisionGridGlobalIndex_Static(FIntPoint IJ);
+	static FORCEINLINE FIntPoint GetVisionGridTileIJ_Static(int64 GlobalIndex);
 	static FORCEINLINE bool IsVisionGridIJValid_Static(FIntPoint IJ);
 	
 	//~ Begin Static Minimap Grid Conversion Functions
@@ -167,16 +167,16 @@ FORCEINLINE FVector2D UMinimapDataSubsystem::ConvertVisionTileIJToTileCenterWorl
 	return SingletonInstance->GridBottomLeftWorldLocation + (FVector2D(IJ) + 0.5f) * SingletonInstance->VisionTileSize;
 }
 
-FORCEINLINE int32 UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(FIntPoint IJ)
+FORCEINLINE int64 UMinimapDataSubsystem::GetVisionGridGlobalIndex_Static(FIntPoint IJ)
 {
 	check(SingletonInstance);
-	return IJ.X * SingletonInstance->VisionGridResolution.Y + IJ.Y;
+	return static_cast<int64>(IJ.X) * SingletonInstance->VisionGridResolution.Y + IJ.Y;
 }
 
-FORCEINLINE FIntPoint UMinimapDataSubsystem::GetVisionGridTileIJ_Static(int32 GlobalIndex)
+FORCEINLINE FIntPoint UMinimapDataSubsystem::GetVisionGridTileIJ_Static(int64 GlobalIndex)
 {
 	check(SingletonInstance);
-	return { GlobalIndex / SingletonInstance->VisionGridResolution.Y, GlobalIndex % SingletonInstance->VisionGridResolution.Y };
+	return { static_cast<int32>(GlobalIndex / SingletonInstance->VisionGridResolution.Y), static_cast<int32>(GlobalIndex % SingletonInstance->VisionGridResolution.Y) };
 }
 
 FORCEINLINE bool UMinimapDataSubsystem::IsVisionGridIJValid_Static(FIntPoint IJ)